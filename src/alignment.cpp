@@ -3,69 +3,140 @@
 
 #include "alignment.hpp"
 
-#include <fstream>
-#include <iostream>
+#include <algorithm>
 #include <memory>
 #include <string>
 #include <unordered_map>
 
+#include "text_file.hpp"
+
+Alignment::Alignment(const StringStringMap &data) {
+  for (const auto &[taxon, sequence] : data) {
+    if (names_.empty()) {
+      length_ = sequence.size();
+      states_.reserve(data.size() * length_);
+    } else if (sequence.size() != length_) {
+      Failwith("Sequences of the alignment are not all the same length.");
+    }
+    states_.insert(states_.end(), sequence.begin(), sequence.end());
+    AddRow(taxon);
+  }
+}
+
+StringStringMap Alignment::Data() const {
+  StringStringMap data;
+  for (size_t row = 0; row < SequenceCount(); row++) {
+    SafeInsert(data, names_[row], std::string(Sequence(row)));
+  }
+  return data;
+}
+
 size_t Alignment::Length() const {
   Assert(SequenceCount() > 0,
          "Must have sequences in an alignment to ask for a Length.");
-  return data_.begin()->second.size();
+  return length_;
 }
 
-bool Alignment::IsValid() const {
-  if (data_.empty()) {
+bool Alignment::operator==(const Alignment &other) const {
+  if (SequenceCount() != other.SequenceCount() || length_ != other.length_) {
     return false;
   }
-  auto length = Length();
-  auto is_same_length = [length](const auto &datum) {
-    return (length == datum.second.size());
-  };
-  return std::all_of(data_.cbegin(), data_.cend(), is_same_length);
+  for (size_t row = 0; row < SequenceCount(); row++) {
+    const auto search = other.rows_.find(names_[row]);
+    if (search == other.rows_.end() ||
+        Sequence(row) != other.Sequence(search->second)) {
+      return false;
+    }
+  }
+  return true;
 }
 
-const std::string &Alignment::at(const std::string &taxon) const {
-  auto search = data_.find(taxon);
-  if (search != data_.end()) {
+size_t Alignment::RowOf(const std::string &taxon) const {
+  auto search = rows_.find(taxon);
+  if (search != rows_.end()) {
     return search->second;
   }  // else
   Failwith("Taxon '" + taxon + "' not found in alignment.");
 }
 
-// An edited version of
-// https://stackoverflow.com/questions/35251635/fasta-reader-written-in-c
-// which seems like it was originally taken from
-// http://rosettacode.org/wiki/FASTA_format#C.2B.2B
+std::vector<uint8_t> Alignment::SiteMajorStates() const {
+  const size_t sequence_count = SequenceCount();
+  std::vector<uint8_t> site_major(states_.size());
+  // Transpose block by block, so that we go through both matrices a cache line at a
+  // time.
+  constexpr size_t block_size = 64;
+  for (size_t row_begin = 0; row_begin < sequence_count; row_begin += block_size) {
+    const size_t row_end = std::min(row_begin + block_size, sequence_count);
+    for (size_t site_begin = 0; site_begin < length_; site_begin += block_size) {
+      const size_t site_end = std::min(site_begin + block_size, length_);
+      for (size_t row = row_begin; row < row_end; row++) {
+        const uint8_t *row_states = Row(row);
+        for (size_t site = site_begin; site < site_end; site++) {
+          site_major[site * sequence_count + row] = row_states[site];
+        }
+      }
+    }
+  }
+  return site_major;
+}
+
+void Alignment::AddRow(std::string taxon) {
+  if (!rows_.insert({taxon, names_.size()}).second) {
+    Failwith("Taxon '" + taxon + "' appears more than once in the alignment.");
+  }
+  names_.push_back(std::move(taxon));
+}
+
+// We append the sequence lines of each record straight onto the end of the matrix.
+// The sequences of a chunk of the file can't take up more bytes than the chunk, so we
+// make sure there is that much room before reading each chunk; a plain file is a
+// single chunk, so its matrix gets allocated just once. For a compressed file we grow
+// the matrix geometrically, so that we don't copy it all over again for every chunk.
 Alignment Alignment::ReadFasta(const std::string &fname) {
-  StringStringMap data;
-  auto insert = [&data](std::string taxon, std::string sequence) {
-    if (!taxon.empty()) {
-      SafeInsert(data, taxon, sequence);
+  Alignment alignment;
+  auto &states = alignment.states_;
+  TextFile file(fname);
+  // The taxon of the current record, and where its sequence starts in the matrix.
+  // Like sequences before the first record, sequences without a name get dropped.
+  std::string taxon;
+  size_t row_begin = 0;
+  auto finish_record = [&alignment, &states, &taxon, &row_begin]() {
+    if (taxon.empty()) {
+      states.resize(row_begin);
+      return;
     }
+    const size_t sequence_length = states.size() - row_begin;
+    if (alignment.names_.empty()) {
+      alignment.length_ = sequence_length;
+    } else if (sequence_length != alignment.length_) {
+      Failwith("Sequences of the alignment are not all the same length.");
+    }
+    alignment.AddRow(std::move(taxon));
+    taxon.clear();
   };
-  std::ifstream input(fname);
-  if (!input.good()) {
-    Failwith("Could not open '" + fname + "'");
-  }
-  std::string line, taxon, sequence;
-  while (std::getline(input, line)) {
-    if (line.empty()) {
-      continue;
+  for (auto chunk = file.NextChunk(); !chunk.empty(); chunk = file.NextChunk()) {
+    if (states.capacity() < states.size() + chunk.size()) {
+      states.reserve(std::max(2 * states.capacity(), states.size() + chunk.size()));
     }
-    // else:
-    if (line[0] == '>') {
-      insert(taxon, sequence);
-      taxon = line.substr(1);
-      sequence.clear();
-    } else {
-      sequence += line;
+    while (!chunk.empty()) {
+      const size_t line_end = std::min(chunk.find('\n'), chunk.size());
+      const auto line = chunk.substr(0, line_end);
+      chunk.remove_prefix(std::min(line_end + 1, chunk.size()));
+      if (line.empty()) {
+        continue;
+      }
+      // else:
+      if (line[0] == '>') {
+        finish_record();
+        taxon = line.substr(1);
+        row_begin = states.size();
+      } else if (!taxon.empty()) {
+        states.insert(states.end(), line.begin(), line.end());
+      }
     }
   }
-  // Insert the last taxon, sequence pair.
-  insert(taxon, sequence);
-  Alignment alignment(data);
+  // Finish the last record.
+  finish_record();
   if (!alignment.IsValid()) {
     Failwith("Sequences of the alignment are not all the same length.");
   }
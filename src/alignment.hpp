@@ -1,38 +1,73 @@
 // Copyright 2019-2020 libsbn project contributors.
 // libsbn is free software under the GPLv3; see LICENSE file for details.
+//
+// A multiple sequence alignment, stored column-friendly.
+//
+// The sequences live in one contiguous taxon-major matrix of characters, with a
+// row per sequence, and we find a sequence's row by its taxon name. Accessors hand
+// out views into the matrix rather than copies. As site pattern compression goes
+// site by site, we can also make the site-major transpose of the matrix.
 
 #ifndef SRC_ALIGNMENT_HPP_
 #define SRC_ALIGNMENT_HPP_
 
+#include <cstdint>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 
 #include "sugar.hpp"
 
 class Alignment {
  public:
   Alignment() = default;
-  explicit Alignment(StringStringMap data) : data_(std::move(data)) {}
+  // The sequences must all have the same length.
+  explicit Alignment(const StringStringMap& data);
 
-  StringStringMap Data() const { return data_; }
-  size_t SequenceCount() const { return data_.size(); }
+  // Copy the alignment out into a map from taxon names to sequences.
+  StringStringMap Data() const;
+  size_t SequenceCount() const { return names_.size(); }
   size_t Length() const;
-  bool operator==(const Alignment& other) const { return data_ == other.Data(); }
+  bool operator==(const Alignment& other) const;
 
-  // Is the alignment non-empty and do all sequences have the same length?
-  bool IsValid() const;
-  const std::string& at(const std::string& taxon) const;
+  // Is the alignment non-empty? (All sequences have the same length by construction.)
+  bool IsValid() const { return SequenceCount() > 0; }
+  std::string_view at(const std::string& taxon) const { return Sequence(RowOf(taxon)); }
 
+  // The row of the matrix holding the sequence of a taxon.
+  size_t RowOf(const std::string& taxon) const;
+  const std::string& Name(size_t row) const { return names_[row]; }
+  std::string_view Sequence(size_t row) const {
+    return std::string_view(reinterpret_cast<const char*>(Row(row)), length_);
+  }
+  const uint8_t* Row(size_t row) const { return states_.data() + row * length_; }
+  // The taxon-major matrix, with the character of row i and site j at
+  // i * Length() + j.
+  const std::vector<uint8_t>& States() const { return states_; }
+  // The site-major transpose, with the character of row i and site j at
+  // j * SequenceCount() + i.
+  std::vector<uint8_t> SiteMajorStates() const;
+
+  // Read a FASTA file, which may be gzip-compressed.
   static Alignment ReadFasta(const std::string& fname);
 
   static Alignment HelloAlignment() {
-    return Alignment({{"mars", "CCGAG-AGCAGCAATGGAT-GAGGCATGGCG"},
-                      {"saturn", "GCGCGCAGCTGCTGTAGATGGAGGCATGACG"},
-                      {"jupiter", "GCGCGCAGCAGCTGTGGATGGAAGGATGACG"}});
+    return Alignment(StringStringMap({{"mars", "CCGAG-AGCAGCAATGGAT-GAGGCATGGCG"},
+                                      {"saturn", "GCGCGCAGCTGCTGTAGATGGAGGCATGACG"},
+                                      {"jupiter", "GCGCGCAGCAGCTGTGGATGGAAGGATGACG"}}));
   }
 
  private:
-  StringStringMap data_;
+  // The taxon name of each row.
+  std::vector<std::string> names_;
+  std::unordered_map<std::string, size_t> rows_;
+  size_t length_ = 0;
+  std::vector<uint8_t> states_;
+
+  // Add a row for a taxon, whose sequence must already be at the end of states_.
+  void AddRow(std::string taxon);
 };
 
 #ifdef DOCTEST_LIBRARY_INCLUDED
@@ -40,6 +75,22 @@ TEST_CASE("Alignment") {
   auto alignment = Alignment::ReadFasta("data/hello.fasta");
   CHECK_EQ(alignment, Alignment::HelloAlignment());
   CHECK(alignment.IsValid());
+  CHECK_EQ(Alignment::ReadFasta("data/hello.fasta.gz"), alignment);
+  CHECK_EQ(Alignment(alignment.Data()), alignment);
+  CHECK_EQ(alignment.at("saturn"), "GCGCGCAGCTGCTGTAGATGGAGGCATGACG");
+  const size_t jupiter_row = alignment.RowOf("jupiter");
+  CHECK_EQ(alignment.Name(jupiter_row), "jupiter");
+  CHECK_EQ(alignment.Row(jupiter_row)[2], 'G');
+  const auto site_major = alignment.SiteMajorStates();
+  CHECK_EQ(site_major.size(), alignment.States().size());
+  for (size_t row = 0; row < alignment.SequenceCount(); row++) {
+    for (size_t site = 0; site < alignment.Length(); site++) {
+      CHECK_EQ(site_major[site * alignment.SequenceCount() + row],
+               alignment.Row(row)[site]);
+    }
+  }
+  CHECK_THROWS(alignment.at("pluto"));
+  CHECK_THROWS(Alignment(StringStringMap({{"mars", "ACGT"}, {"venus", "ACG"}})));
 }
 #endif  // DOCTEST_LIBRARY_INCLUDED
 
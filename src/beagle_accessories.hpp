@@ -12,7 +12,7 @@
 #include <vector>
 
 #include "libhmsbeagle/beagle.h"
-#include "node.hpp"
+#include "flat_topology.hpp"
 
 struct BeagleAccessories {
   const int beagle_instance_;
@@ -47,14 +47,14 @@ struct BeagleAccessories {
   // first derivative matrices
   std::vector<int> node_deriv_index_ = {0};
 
-  BeagleAccessories(int beagle_instance, bool rescaling, const Node::NodePtr topology)
+  BeagleAccessories(int beagle_instance, bool rescaling, const FlatTopology &topology)
       : beagle_instance_(beagle_instance),
         rescaling_(rescaling),
-        root_id_(static_cast<int>(topology->Id())),
-        fixed_node_id_(static_cast<int>(topology->Children()[1]->Id())),
-        root_child_id_(static_cast<int>(topology->Children()[0]->Id())),
-        node_count_(static_cast<int>(topology->LeafCount() * 2 - 1)),
-        taxon_count_(static_cast<int>(topology->LeafCount())),
+        root_id_(static_cast<int>(topology.RootId())),
+        fixed_node_id_(static_cast<int>(topology.Child1Id(topology.RootId()))),
+        root_child_id_(static_cast<int>(topology.Child0Id(topology.RootId()))),
+        node_count_(static_cast<int>(topology.LeafCount() * 2 - 1)),
+        taxon_count_(static_cast<int>(topology.LeafCount())),
         internal_count_(taxon_count_ - 1),
         cumulative_scale_index_({rescaling ? 0 : BEAGLE_OP_NONE}),
         node_indices_(IotaVector(node_count_ - 1, 0)) {}
@@ -7,16 +7,51 @@
 
 #include "sugar.hpp"
 
-Bitset::Bitset(std::vector<bool> value) : value_(std::move(value)) {}
+namespace {
+size_t PopCount(uint64_t word) {
+  return static_cast<size_t>(__builtin_popcountll(word));
+}
+// The number of leading zeros of a nonzero word, which is the position of the first
+// set bit given our most-significant-first layout.
+size_t LeadingZeros(uint64_t word) {
+  return static_cast<size_t>(__builtin_clzll(word));
+}
 
-Bitset::Bitset(size_t n, bool initial_value) : value_(n, initial_value) {}
+// The multiply-fold mixing function from wyhash: take the full 128-bit product and
+// xor its two halves together.
+uint64_t WyMix(uint64_t a, uint64_t b) {
+  __uint128_t product = static_cast<__uint128_t>(a) * b;
+  return static_cast<uint64_t>(product) ^ static_cast<uint64_t>(product >> 64);
+}
+// The default secret from wyhash.
+constexpr uint64_t kHashSecret[4] = {0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL,
+                                     0x8ebc6af09c88c6e3ULL, 0x589965cc75374cc3ULL};
+}  // namespace
+
+Bitset::Bitset(const std::vector<bool>& value) : Bitset(value.size()) {
+  for (size_t i = 0; i < value.size(); i++) {
+    if (value[i]) {
+      MutableWords()[i / BitsPerWord] |= BitMask(i);
+    }
+  }
+}
+
+Bitset::Bitset(size_t n, bool initial_value) : size_(n), inline_words_{} {
+  if (!IsInline()) {
+    heap_words_.assign(WordCount(), Word(0));
+  }
+  if (initial_value) {
+    std::fill(MutableWords(), MutableWords() + WordCount(), ~Word(0));
+    ClearPadding();
+  }
+}
 
 Bitset::Bitset(std::string str) : Bitset(str.length()) {
-  for (size_t i = 0; i < value_.size(); i++) {
+  for (size_t i = 0; i < size_; i++) {
     if (str[i] == '0') {
-      value_[i] = false;
+      // Already zero.
     } else if (str[i] == '1') {
-      value_[i] = true;
+      MutableWords()[i / BitsPerWord] |= BitMask(i);
     } else {
       Failwith("String constructor for Bitset must use only 0s or 1s; found '" +
                std::string(1, str[i]) + "'.");
@@ -24,125 +59,155 @@ Bitset::Bitset(std::string str) : Bitset(str.length()) {
   }
 }
 
-bool Bitset::operator[](size_t i) const { return value_[i]; }
-
-size_t Bitset::size() const { return value_.size(); }
-
 void Bitset::set(size_t i, bool value) {
-  Assert(i < value_.size(), "i out of range in Bitset::set.");
-  value_[i] = value;
+  Assert(i < size_, "i out of range in Bitset::set.");
+  if (value) {
+    MutableWords()[i / BitsPerWord] |= BitMask(i);
+  } else {
+    MutableWords()[i / BitsPerWord] &= ~BitMask(i);
+  }
 }
 
 void Bitset::reset(size_t i) {
-  Assert(i < value_.size(), "i out of range in Bitset::reset.");
-  value_[i] = false;
+  Assert(i < size_, "i out of range in Bitset::reset.");
+  MutableWords()[i / BitsPerWord] &= ~BitMask(i);
 }
 
-void Bitset::flip() { value_.flip(); }
+void Bitset::flip() {
+  Word* words = MutableWords();
+  for (size_t k = 0; k < WordCount(); k++) {
+    words[k] = ~words[k];
+  }
+  ClearPadding();
+}
 
-bool Bitset::operator==(const Bitset& other) const { return value_ == other.value_; }
-bool Bitset::operator!=(const Bitset& other) const { return value_ != other.value_; }
-bool Bitset::operator<(const Bitset& other) const { return value_ < other.value_; }
-bool Bitset::operator<=(const Bitset& other) const { return value_ <= other.value_; }
-bool Bitset::operator>(const Bitset& other) const { return value_ > other.value_; }
-bool Bitset::operator>=(const Bitset& other) const { return value_ >= other.value_; }
+bool Bitset::operator==(const Bitset& other) const {
+  return size_ == other.size_ &&
+         std::equal(Words(), Words() + WordCount(), other.Words());
+}
+bool Bitset::operator!=(const Bitset& other) const { return !(*this == other); }
+bool Bitset::operator<(const Bitset& other) const { return Compare(other) < 0; }
+bool Bitset::operator<=(const Bitset& other) const { return Compare(other) <= 0; }
+bool Bitset::operator>(const Bitset& other) const { return Compare(other) > 0; }
+bool Bitset::operator>=(const Bitset& other) const { return Compare(other) >= 0; }
 
 Bitset Bitset::operator&(const Bitset& other) const {
-  Assert(value_.size() == other.size(), "Size mismatch in Bitset::operator&.");
-  Bitset r(value_.size());
-  for (size_t i = 0; i < value_.size(); i++) {
-    if (value_[i] && other.value_[i]) {
-      r.set(i);
-    }
-  }
+  Bitset r(*this);
+  r &= other;
   return r;
 }
 
 Bitset Bitset::operator|(const Bitset& other) const {
-  Assert(value_.size() == other.size(), "Size mismatch in Bitset::operator|.");
-  Bitset r(value_.size());
-  for (size_t i = 0; i < value_.size(); i++) {
-    if (value_[i] || other.value_[i]) {
-      r.set(i);
-    }
-  }
+  Bitset r(*this);
+  r |= other;
   return r;
 }
 
 Bitset Bitset::operator^(const Bitset& other) const {
-  Assert(value_.size() == other.size(), "Size mismatch in Bitset::operator^.");
-  Bitset r(value_.size());
-  for (size_t i = 0; i < value_.size(); i++) {
-    if (value_[i] != other.value_[i]) {
-      r.set(i);
-    }
+  Assert(size_ == other.size_, "Size mismatch in Bitset::operator^.");
+  Bitset r(*this);
+  Word* words = r.MutableWords();
+  const Word* other_words = other.Words();
+  for (size_t k = 0; k < WordCount(); k++) {
+    words[k] ^= other_words[k];
   }
   return r;
 }
 
 Bitset Bitset::operator~() const {
-  Bitset r(value_);
-  r.value_.flip();
+  Bitset r(*this);
+  r.flip();
   return r;
 }
 
 Bitset Bitset::operator+(const Bitset& other) const {
-  Bitset sum(value_.size() + other.size());
+  Bitset sum(size_ + other.size());
   sum.CopyFrom(*this, 0, false);
-  sum.CopyFrom(other, value_.size(), false);
+  sum.CopyFrom(other, size_, false);
   return sum;
 }
 
 void Bitset::operator&=(const Bitset& other) {
-  Assert(value_.size() == other.size(), "Size mismatch in Bitset::operator&=.");
-  for (size_t i = 0; i < value_.size(); i++) {
-    value_[i] = value_[i] && other[i];
+  Assert(size_ == other.size_, "Size mismatch in Bitset::operator&=.");
+  Word* words = MutableWords();
+  const Word* other_words = other.Words();
+  for (size_t k = 0; k < WordCount(); k++) {
+    words[k] &= other_words[k];
   }
 }
 
 void Bitset::operator|=(const Bitset& other) {
-  Assert(value_.size() == other.size(), "Size mismatch in Bitset::operator|=.");
-  for (size_t i = 0; i < value_.size(); i++) {
-    value_[i] = value_[i] || other[i];
+  Assert(size_ == other.size_, "Size mismatch in Bitset::operator|=.");
+  Word* words = MutableWords();
+  const Word* other_words = other.Words();
+  for (size_t k = 0; k < WordCount(); k++) {
+    words[k] |= other_words[k];
   }
 }
 
 // These methods aren't in the bitset interface.
 
-void Bitset::Zero() { std::fill(value_.begin(), value_.end(), false); }
+void Bitset::Zero() {
+  std::fill(MutableWords(), MutableWords() + WordCount(), Word(0));
+}
+
+size_t Bitset::ComputeHash() const { return HashWords(Words(), WordCount(), size_); }
 
-size_t Bitset::Hash() const { return std::hash<std::vector<bool>>{}(value_); }
+size_t Bitset::HashWords(const Word* words, size_t word_count, size_t bit_count) {
+  // Absorb one word at a time with the wyhash mixing step, starting from a seed
+  // that depends on the size so that e.g. "0" and "00" hash differently.
+  Word hash = WyMix(Word(bit_count) ^ kHashSecret[0], kHashSecret[1]);
+  for (size_t k = 0; k < word_count; k++) {
+    hash = WyMix(words[k] ^ kHashSecret[2], hash ^ kHashSecret[3]);
+  }
+  return static_cast<size_t>(WyMix(hash, kHashSecret[1]));
+}
 
 std::string Bitset::ToString() const {
   std::string str;
-  for (size_t i = 0; i < value_.size(); ++i) {
-    str += (value_[i] ? '1' : '0');
+  str.reserve(size_);
+  for (size_t i = 0; i < size_; ++i) {
+    str += ((*this)[i] ? '1' : '0');
   }
   return str;
 }
 
 bool Bitset::All() const {
-  for (size_t i = 0; i < value_.size(); ++i) {
-    if (!value_[i]) {
+  if (size_ == 0) {
+    return true;
+  }
+  const Word* words = Words();
+  for (size_t k = 0; k + 1 < WordCount(); k++) {
+    if (words[k] != ~Word(0)) {
       return false;
     }
   }
-  return true;
+  return words[WordCount() - 1] == LastWordMask();
 }
 
 bool Bitset::Any() const {
-  for (size_t i = 0; i < value_.size(); ++i) {
-    if (value_[i]) {
+  const Word* words = Words();
+  for (size_t k = 0; k < WordCount(); k++) {
+    if (words[k] != 0) {
       return true;
     }
   }
   return false;
 }
 
+size_t Bitset::Count() const {
+  size_t count = 0;
+  const Word* words = Words();
+  for (size_t k = 0; k < WordCount(); k++) {
+    count += PopCount(words[k]);
+  }
+  return count;
+}
+
 void Bitset::Minorize() {
-  Assert(!(value_.empty()), "Can't Bitset::Minorize an empty bitset.");
-  if (value_[0]) {
-    value_.flip();
+  Assert(size_ > 0, "Can't Bitset::Minorize an empty bitset.");
+  if ((*this)[0]) {
+    flip();
   }
 }
 
@@ -150,34 +215,105 @@ void Bitset::Minorize() {
 // begin, and optionally flipping the bits as they get copied.
 void Bitset::CopyFrom(const Bitset& other, size_t begin, bool flip) {
   Assert(begin + other.size() <= size(), "Can't fit copy in Bitset::CopyFrom.");
-  if (flip) {
-    for (size_t i = 0; i < other.size(); i++) {
-      value_[i + begin] = !other[i];
-    }
-  } else {
-    for (size_t i = 0; i < other.size(); i++) {
-      value_[i + begin] = other[i];
+  Word* words = MutableWords();
+  const Word* other_words = other.Words();
+  for (size_t k = 0; k < other.WordCount(); k++) {
+    // The number of bits of other that live in its kth word.
+    const size_t bit_count = std::min(BitsPerWord, other.size() - k * BitsPerWord);
+    const Word mask = ~Word(0) << (BitsPerWord - bit_count);
+    const Word source = (flip ? ~other_words[k] : other_words[k]) & mask;
+    // Our target position, which generally straddles two of our words.
+    const size_t position = begin + k * BitsPerWord;
+    const size_t word_index = position / BitsPerWord;
+    const size_t offset = position % BitsPerWord;
+    words[word_index] = (words[word_index] & ~(mask >> offset)) | (source >> offset);
+    if (offset > 0 && bit_count > BitsPerWord - offset) {
+      const size_t shift = BitsPerWord - offset;
+      words[word_index + 1] =
+          (words[word_index + 1] & ~(mask << shift)) | (source << shift);
     }
   }
 }
 
 std::optional<uint32_t> Bitset::SingletonOption() const {
-  bool found_already = false;
-  uint32_t found_index;
-  for (uint32_t i = 0; i < size(); i++) {
-    if (value_[i]) {
-      if (found_already) {
-        // We previously found an index, so this isn't a singleton.
-        return std::nullopt;
-      }  // else
-      found_already = true;
-      found_index = i;
+  const Word* words = Words();
+  std::optional<uint32_t> found_index = std::nullopt;
+  for (size_t k = 0; k < WordCount(); k++) {
+    if (words[k] == 0) {
+      continue;
     }
+    if (found_index || PopCount(words[k]) > 1) {
+      // We previously found an index, so this isn't a singleton.
+      return std::nullopt;
+    }
+    found_index = static_cast<uint32_t>(k * BitsPerWord + LeadingZeros(words[k]));
   }
-  if (found_already) {
-    return found_index;
-  }  // else
-  return std::nullopt;
+  return found_index;
+}
+
+// ** Private word-level helpers
+
+Bitset::Word Bitset::LastWordMask() const {
+  const size_t remainder = size_ % BitsPerWord;
+  return remainder == 0 ? ~Word(0) : ~Word(0) << (BitsPerWord - remainder);
+}
+
+void Bitset::ClearPadding() {
+  if (WordCount() > 0) {
+    MutableWords()[WordCount() - 1] &= LastWordMask();
+  }
+}
+
+Bitset::Word Bitset::WordAt(size_t begin) const {
+  const size_t word_index = begin / BitsPerWord;
+  const size_t offset = begin % BitsPerWord;
+  if (word_index >= WordCount()) {
+    return Word(0);
+  }
+  const Word* words = Words();
+  Word result = words[word_index] << offset;
+  if (offset > 0 && word_index + 1 < WordCount()) {
+    result |= words[word_index + 1] >> (BitsPerWord - offset);
+  }
+  return result;
+}
+
+Bitset Bitset::Slice(size_t begin, size_t length) const {
+  Assert(begin + length <= size_, "Slice out of range in Bitset::Slice.");
+  Bitset slice(length);
+  Word* slice_words = slice.MutableWords();
+  for (size_t k = 0; k < slice.WordCount(); k++) {
+    slice_words[k] = WordAt(begin + k * BitsPerWord);
+  }
+  slice.ClearPadding();
+  return slice;
+}
+
+int Bitset::Compare(const Bitset& other) const {
+  // Compare the common prefix a word at a time, then fall back to the sizes, just as
+  // lexicographic comparison of std::vector<bool> does.
+  const size_t common_size = std::min(size_, other.size_);
+  const Word* words = Words();
+  const Word* other_words = other.Words();
+  const size_t full_word_count = common_size / BitsPerWord;
+  for (size_t k = 0; k < full_word_count; k++) {
+    if (words[k] != other_words[k]) {
+      return words[k] < other_words[k] ? -1 : 1;
+    }
+  }
+  const size_t remainder = common_size % BitsPerWord;
+  if (remainder > 0) {
+    const Word mask = ~Word(0) << (BitsPerWord - remainder);
+    const Word ours = words[full_word_count] & mask;
+    const Word theirs = other_words[full_word_count] & mask;
+    if (ours != theirs) {
+      return ours < theirs ? -1 : 1;
+    }
+  }
+  if (size_ == other.size_) {
+    return 0;
+  }
+  return size_ < other.size_ ? -1 : 1;
 }
 
 // ** SBN-related functions
@@ -186,10 +322,8 @@ Bitset Bitset::RotateSubsplit() const {
   Assert(size() % 2 == 0, "Bitset::RotateSubsplit requires an even-size bitset.");
   Bitset exchanged(size());
   size_t chunk_size = size() / 2;
-  for (size_t i = 0; i < chunk_size; i++) {
-    exchanged.set(i, value_[i + chunk_size]);
-    exchanged.set(i + chunk_size, value_[i]);
-  }
+  exchanged.CopyFrom(SplitChunk(1), 0, false);
+  exchanged.CopyFrom(SplitChunk(0), chunk_size, false);
   return exchanged;
 }
 
@@ -197,9 +331,7 @@ Bitset Bitset::SplitChunk(size_t i) const {
   Assert(size() % 2 == 0, "Bitset::SplitChunk requires an even-size bitset.");
   Assert(i < 2, "Bitset::SplitChunk only allows 2 chunks.");
   size_t chunk_size = size() / 2;
-  std::vector<bool> new_value(value_.begin() + int32_t(i * chunk_size),
-                              value_.begin() + int32_t((i + 1) * chunk_size));
-  return Bitset(new_value);
+  return Slice(i * chunk_size, chunk_size);
 }
 
 std::string Bitset::ToStringChunked(size_t chunk_count) const {
@@ -207,9 +339,9 @@ std::string Bitset::ToStringChunked(size_t chunk_count) const {
          "Size isn't a multiple of chunk_count in Bitset::ToStringChunked.");
   size_t chunk_size = size() / chunk_count;
   std::string str;
-  for (size_t i = 0; i < value_.size(); ++i) {
-    str += (value_[i] ? '1' : '0');
-    if ((i + 1) % chunk_size == 0 && i + 1 < value_.size()) {
+  for (size_t i = 0; i < size_; ++i) {
+    str += ((*this)[i] ? '1' : '0');
+    if ((i + 1) % chunk_size == 0 && i + 1 < size_) {
       // The next item will start a new chunk, so add a separator.
       str += '|';
     }
@@ -227,33 +359,26 @@ size_t Bitset::PCSPChunkSize() const {
 
 Bitset Bitset::PCSPChunk(size_t i) const {
   size_t chunk_size = PCSPChunkSize();
-  std::vector<bool> new_value(value_.begin() + int32_t(i * chunk_size),
-                              value_.begin() + int32_t((i + 1) * chunk_size));
-  return Bitset(new_value);
+  return Slice(i * chunk_size, chunk_size);
 }
 
 Bitset Bitset::PCSPParent() const {
   size_t chunk_size = PCSPChunkSize();
-  std::vector<bool> new_value(value_.begin(), value_.begin() + int32_t(2 * chunk_size));
-  return Bitset(new_value);
+  return Slice(0, 2 * chunk_size);
 }
 
 Bitset Bitset::PCSPWithoutParent() const {
   size_t chunk_size = PCSPChunkSize();
-  std::vector<bool> new_value(value_.begin() + int32_t(chunk_size), value_.end());
-  return Bitset(new_value);
+  return Slice(chunk_size, 2 * chunk_size);
 }
 
 Bitset Bitset::PCSPChildSubsplit() const {
   size_t chunk_size = PCSPChunkSize();
-  std::vector<bool> new_value(value_.begin() + int32_t(chunk_size),
-                              value_.begin() + int32_t(3 * chunk_size));
-  for (size_t i = 0; i < chunk_size; i++) {
-    // If A is the child clade, and B is one half of the child split, take the
-    // things that are in A but not in B.
-    new_value[i] = new_value[i] && !(new_value[i + chunk_size]);
-  }
-  return Bitset(new_value);
+  Bitset child_subsplit = Slice(chunk_size, 2 * chunk_size);
+  // If A is the child clade, and B is one half of the child split, take the
+  // things that are in A but not in B.
+  child_subsplit.CopyFrom(PCSPChunk(1) & ~PCSPChunk(2), 0, false);
+  return child_subsplit;
 }
 
 bool Bitset::PCSPIsValid() const {
@@ -298,9 +423,7 @@ Bitset Bitset::ChildSubsplit(const Bitset& parent_subsplit, const Bitset& child_
   Bitset result(2 * taxon_count);
   Assert(result.size() == parent_subsplit.size(),
          "Size mismatch in Bitset::ChildSubsplit.");
-  for (size_t i = 0; i < taxon_count; i++) {
-    result.set(i, parent_subsplit[taxon_count + i] ^ child_half[i]);
-    result.set(i + taxon_count, child_half[i]);
-  }
+  result.CopyFrom(parent_subsplit.SplitChunk(1) ^ child_half, 0, false);
+  result.CopyFrom(child_half, taxon_count, false);
   return result;
 }
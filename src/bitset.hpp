@@ -5,7 +5,11 @@
 #define SRC_BITSET_HPP_
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
 #include <functional>
+#include <limits>
 #include <optional>
 #include <string>
 #include <vector>
@@ -15,15 +19,38 @@
 // this class goes way beyond what std::bitset offers.
 // Note that we can't use std::bitset because we don't know the size of the
 // bitsets at compile time.
+//
+// The bits are packed into 64-bit words so that the set operations and queries
+// work a word at a time. Bit i lives in word i / 64, and within a word we store
+// the bits most-significant first. That way comparing words as unsigned integers
+// gives the same lexicographic order as comparing the bits one at a time, which
+// is the order that the rest of the code (e.g. std::min on child subsplits)
+// relies on. Bits past size() in the last word are always kept at zero.
+//
+// Bitsets of up to InlineWordCount words (i.e. clades on up to 256 taxa) are
+// stored inline, so building and copying them doesn't touch the heap; larger
+// bitsets fall back to a std::vector.
+//
+// Bitsets are used as keys in all of our indexing maps, so we hash them a word at
+// a time with a wyhash-style multiply-fold mix, and cache the result. Any call
+// that modifies the bits invalidates the cache, and the hash is recomputed the
+// next time it is asked for. The cache is atomic, so that threads can look up the
+// same const Bitset at once.
 
 class Bitset {
  public:
-  explicit Bitset(std::vector<bool> value);
+  using Word = uint64_t;
+  static constexpr size_t BitsPerWord = 64;
+  static constexpr size_t InlineWordCount = 4;
+
+  explicit Bitset(const std::vector<bool>& value);
   explicit Bitset(size_t n, bool initial_value = false);
   explicit Bitset(std::string);
 
-  bool operator[](size_t i) const;
-  size_t size() const;
+  bool operator[](size_t i) const {
+    return (Words()[i / BitsPerWord] & BitMask(i)) != 0;
+  }
+  size_t size() const { return size_; }
 
   void set(size_t i, bool value = true);
   void reset(size_t i);
@@ -48,12 +75,27 @@ class Bitset {
   // These methods aren't in the bitset interface, so they get our usual
   // convention.
   void Zero();
-  size_t Hash() const;
+  // The (cached) hash of this bitset.
+  size_t Hash() const {
+    size_t hash = hash_.Load();
+    if (hash == HashCache::invalid_) {
+      hash = ComputeHash();
+      hash_.Store(hash);
+    }
+    return hash;
+  }
+  // Compute the hash from scratch, ignoring the cache.
+  size_t ComputeHash() const;
+  // The hash of a bitset of size bit_count stored in the given words, using the same
+  // layout as ours.
+  static size_t HashWords(const Word *words, size_t word_count, size_t bit_count);
   std::string ToString() const;
   // Are all of the bits 1?
   bool All() const;
   // Are any of the bits 1?
   bool Any() const;
+  // The number of bits that are 1.
+  size_t Count() const;
   void Minorize();
   void CopyFrom(const Bitset &other, size_t begin, bool flip);
   // If the bitset only has one bit on, then we return the location of that bit.
@@ -103,7 +145,62 @@ class Bitset {
   static Bitset ChildSubsplit(const Bitset &parent_subsplit, const Bitset &child_half);
 
  private:
-  std::vector<bool> value_;
+  // FixedBitset shares our word layout, and converts directly to and from our words.
+  template <size_t>
+  friend class FixedBitset;
+
+  // The cached hash, which copies like a plain value. Its loads and stores are
+  // relaxed: racing threads all store the same hash, so it doesn't matter which
+  // store wins. A bitset whose hash happens to be invalid_ just never gets cached.
+  class HashCache {
+   public:
+    static constexpr size_t invalid_ = std::numeric_limits<size_t>::max();
+
+    HashCache() = default;
+    HashCache(const HashCache &other) : value_(other.Load()) {}
+    HashCache &operator=(const HashCache &other) {
+      Store(other.Load());
+      return *this;
+    }
+
+    size_t Load() const { return value_.load(std::memory_order_relaxed); }
+    void Store(size_t value) const { value_.store(value, std::memory_order_relaxed); }
+
+   private:
+    mutable std::atomic<size_t> value_{invalid_};
+  };
+
+  size_t size_;
+  std::array<Word, InlineWordCount> inline_words_;
+  std::vector<Word> heap_words_;
+  HashCache hash_;
+
+  static size_t WordCountOf(size_t n) { return (n + BitsPerWord - 1) / BitsPerWord; }
+  // The mask selecting bit i within its word.
+  static Word BitMask(size_t i) {
+    return Word(1) << (BitsPerWord - 1 - i % BitsPerWord);
+  }
+  // The mask of the bits of the last word that are actually in use.
+  Word LastWordMask() const;
+
+  size_t WordCount() const { return WordCountOf(size_); }
+  bool IsInline() const { return WordCount() <= InlineWordCount; }
+  const Word* Words() const {
+    return IsInline() ? inline_words_.data() : heap_words_.data();
+  }
+  // Access to the words for modification, which invalidates the cached hash.
+  Word* MutableWords() {
+    hash_.Store(HashCache::invalid_);
+    return IsInline() ? inline_words_.data() : heap_words_.data();
+  }
+  // Zero out the bits past size() in the last word.
+  void ClearPadding();
+  // The word starting at bit position begin, zero-padded past the end.
+  Word WordAt(size_t begin) const;
+  // Make a new bitset out of the bits in [begin, begin + length).
+  Bitset Slice(size_t begin, size_t length) const;
+  // Lexicographic comparison: negative, zero, or positive as in strcmp.
+  int Compare(const Bitset &other) const;
 };
 
 // This is how we inject a hash routine and a custom comparator into the std
@@ -121,6 +218,8 @@ struct equal_to<Bitset> {
 }  // namespace std
 
 #ifdef DOCTEST_LIBRARY_INCLUDED
+#include <thread>
+
 TEST_CASE("Bitset") {
   Bitset a("1100");
 
@@ -206,6 +305,9 @@ TEST_CASE("Bitset") {
   CHECK_EQ(Bitset("100001110001").PCSPChildSubsplit(), Bitset("01100001"));
 
   CHECK_EQ(Bitset::Singleton(4, 2), Bitset("0010"));
+  CHECK_EQ(Bitset::Singleton(4, 2).SingletonOption(), 2);
+  CHECK_EQ(Bitset("0110").SingletonOption(), std::nullopt);
+  CHECK_EQ(Bitset("0110").Count(), 2);
 
   // parent clade is 1110, child is 0100, so child subsplit is 1010|0100.
   CHECK_EQ(Bitset::ChildSubsplit(Bitset("00011110"), Bitset("0100")),
@@ -213,6 +315,73 @@ TEST_CASE("Bitset") {
   CHECK_EQ(Bitset::ChildSubsplit(Bitset("00011110"), Bitset("1010")),
            Bitset("01001010"));
 }
+
+TEST_CASE("Bitset: multi-word") {
+  // Check the word-level operations against a bit-by-bit reference on sizes that
+  // straddle word boundaries and the switch from inline to heap storage.
+  for (size_t n : {63, 64, 65, 130, 256, 257, 300}) {
+    std::vector<bool> x(n), y(n);
+    for (size_t i = 0; i < n; i++) {
+      x[i] = (i * 7 + 3) % 5 < 2;
+      y[i] = (i * 11 + 1) % 3 == 0;
+    }
+    Bitset a(x);
+    Bitset b(y);
+    CHECK_EQ(a.size(), n);
+    size_t count = 0;
+    for (size_t i = 0; i < n; i++) {
+      CHECK_EQ(a[i], x[i]);
+      CHECK_EQ((a & b)[i], x[i] && y[i]);
+      CHECK_EQ((a | b)[i], x[i] || y[i]);
+      CHECK_EQ((a ^ b)[i], x[i] != y[i]);
+      CHECK_EQ((~a)[i], !x[i]);
+      count += x[i];
+    }
+    CHECK_EQ(a.Count(), count);
+    CHECK_EQ(a < b, x < y);
+    CHECK_EQ(b < a, y < x);
+    CHECK_EQ(Bitset(n, true).All(), true);
+    CHECK_EQ((~Bitset(n, true)).Any(), false);
+    CHECK_EQ((a + b).SplitChunk(0), a);
+    CHECK_EQ((a + b).SplitChunk(1), b);
+    CHECK_EQ((a + b).RotateSubsplit(), b + a);
+    CHECK_EQ(Bitset::Singleton(n, n - 1).SingletonOption(), n - 1);
+    CHECK_EQ(Bitset(a.ToString()), a);
+    CHECK_EQ(Bitset(a.ToString()).Hash(), a.Hash());
+  }
+  // Modification invalidates the cached hash.
+  Bitset c("1100");
+  const size_t hash = c.Hash();
+  c.set(3);
+  CHECK_NE(c.Hash(), hash);
+  CHECK_EQ(c.Hash(), Bitset("1101").Hash());
+  c.reset(3);
+  CHECK_EQ(c.Hash(), hash);
+  c.Minorize();
+  CHECK_EQ(c.Hash(), Bitset("0011").Hash());
+  c.CopyFrom(Bitset("11"), 0, false);
+  CHECK_EQ(c.Hash(), Bitset("1111").Hash());
+  c &= Bitset("0101");
+  CHECK_EQ(c.Hash(), c.ComputeHash());
+  // Bitsets that only differ in size hash differently.
+  CHECK_NE(Bitset(3).Hash(), Bitset(4).Hash());
+  // Copies carry the cached hash, and threads can hash the same bitset at once.
+  const Bitset d("1010110");
+  CHECK_EQ(Bitset(d).Hash(), d.Hash());
+  const Bitset e("0110101");
+  std::vector<size_t> hashes(4);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < hashes.size(); i++) {
+    threads.emplace_back([&e, &hashes, i]() { hashes[i] = e.Hash(); });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  CHECK_EQ(hashes, std::vector<size_t>(hashes.size(), e.ComputeHash()));
+  // A prefix compares less than the longer bitset.
+  CHECK_LT(Bitset(std::string(70, '1')), Bitset(std::string(71, '1')));
+  CHECK_LT(Bitset(std::string(70, '0')), Bitset("1"));
+}
 #endif  // DOCTEST_LIBRARY_INCLUDED
 
 #endif  // SRC_BITSET_HPP_
@@ -7,6 +7,7 @@
 #include <string>
 
 #include "rooted_sbn_instance.hpp"
+#include "task_processor.hpp"
 #include "taxon_name_munging.hpp"
 #include "unrooted_sbn_instance.hpp"
 
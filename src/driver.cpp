@@ -6,14 +6,20 @@
 
 #include "driver.hpp"
 
+#include <algorithm>
+#include <charconv>
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
 #include <memory>
-#include <regex>
+#include <optional>
+#include <thread>
 #include <unordered_map>
 #include <utility>
 
+#include "mmapped_file.hpp"
 #include "parser.hpp"
+#include "task_processor.hpp"
 #include "taxon_name_munging.hpp"
 
 Driver::Driver()
@@ -21,7 +27,11 @@ Driver::Driver()
       taxa_complete_(false),
       trace_parsing_(0),
       trace_scanning_(false),
-      latest_tree_(nullptr) {}
+      latest_tree_(nullptr),
+      use_node_arena_(true),
+      use_fast_parser_(true),
+      thread_count_(0),
+      min_chunk_size_(1 << 18) {}
 
 void Driver::Clear() {
   next_id_ = 0;
@@ -31,6 +41,20 @@ void Driver::Clear() {
   latest_tree_ = nullptr;
   taxa_.clear();
   branch_lengths_.clear();
+  taxon_ids_.clear();
+  node_store_.clear();
+  // The arena only holds nodes if a parse failed part way, in which case nobody
+  // needs them.
+  if (node_arena_.Capacity() > 0) {
+    node_arena_ = NodeArena();
+  }
+}
+
+void Driver::ReleaseNodes() {
+  latest_tree_ = nullptr;
+  node_store_.clear();
+  // The trees we have already returned keep the old arena alive.
+  node_arena_ = NodeArena();
 }
 
 // This parser will allow anything before the first '('.
@@ -58,78 +82,173 @@ TreeCollection Driver::ParseNewick(std::ifstream &in) {
 
 TreeCollection Driver::ParseNewickFile(const std::string &fname) {
   Clear();
-  std::ifstream in(fname.c_str());
-  if (!in) {
-    Failwith("Cannot open the File : " + fname);
+  TreeCollection perhaps_quoted_trees;
+  TextFile file(fname, TextChunkSize());
+  // The bison parser reads from a std::ifstream, so compressed files and pipes always
+  // go through the hand-written parser.
+  if (use_fast_parser_ || file.IsStreamed()) {
+    perhaps_quoted_trees = ParseTextFile(file, file.NextChunk(), 1);
+  } else {
+    std::ifstream in(fname.c_str());
+    if (!in) {
+      Failwith("Cannot open the File : " + fname);
+    }
+    perhaps_quoted_trees = ParseNewick(in);
   }
-  TreeCollection perhaps_quoted_trees = ParseNewick(in);
+  ReleaseNodes();
   return TreeCollection(
       std::move(perhaps_quoted_trees.trees_),
       TaxonNameMunging::DequoteTagStringMap(perhaps_quoted_trees.TagTaxonMap()));
 }
 
+namespace {
+
+// Whitespace in the sense of std::isspace in the "C" locale.
+bool IsSpace(char c) { return c == ' ' || (c >= '\t' && c <= '\r'); }
+
+std::string_view TrimLeadingSpace(std::string_view str) {
+  while (!str.empty() && IsSpace(str.front())) {
+    str.remove_prefix(1);
+  }
+  return str;
+}
+
+// Fail because the text of a Nexus file ended before the first tree.
+void FailIncompleteNexusHeader(bool found_trees_block) {
+  if (!found_trees_block) {
+    Failwith("Finished reading and couldn't find 'begin trees;'");
+  }  // else
+  Failwith(
+      "Reached the end of the file before finding the first tree after the "
+      "translate block.");
+}
+
+}  // namespace
+
+std::optional<size_t> Driver::ParseNexusHeader(std::string_view text,
+                                               TagStringMap *long_name_taxon_map,
+                                               bool *found_trees_block) {
+  *found_trees_block = false;
+  size_t position = 0;
+  // Return the line starting at position, without its newline, and move past it.
+  auto next_line = [&text, &position]() {
+    const size_t end = std::min(text.find('\n', position), text.size());
+    const auto line = text.substr(position, end - position);
+    position = std::min(end + 1, text.size());
+    return line;
+  };
+  if (next_line() != "#NEXUS") {
+    Failwith("Putative Nexus file doesn't begin with #NEXUS.");
+  }
+  std::string_view line;
+  do {
+    if (position == text.size()) {
+      return std::nullopt;
+    }
+    line = next_line();
+    // BEAST uses "Begin trees;" so we allow either case for the first letter.
+  } while (line.empty() || (line.front() != 'b' && line.front() != 'B') ||
+           line.substr(1) != "egin trees;");
+  *found_trees_block = true;
+  if (position == text.size()) {
+    return std::nullopt;
+  }
+  line = TrimLeadingSpace(next_line());
+  if (line.empty() || (line.front() != 't' && line.front() != 'T') ||
+      line.substr(1) != "ranslate") {
+    Failwith("Missing translate block.");
+  }
+  // Translation statements look like "12 Homo_sapiens," with a comma or a
+  // semicolon at the end.
+  // We only fill in taxa_ and long_name_taxon_map once we have the whole block.
+  std::map<std::string, uint32_t> taxa;
+  TagStringMap long_name_taxa;
+  size_t line_position;
+  uint32_t leaf_id = 0;
+  while (true) {
+    line_position = position;
+    if (position == text.size()) {
+      return std::nullopt;
+    }
+    line = TrimLeadingSpace(next_line());
+    // BEAST has the ending semicolon on a line of its own.
+    if (line == ";") {
+      break;
+    }
+    const size_t digit_count =
+        std::min(line.find_first_not_of("0123456789"), line.size());
+    // The short name has to be followed by exactly one whitespace character,
+    // anything after which (other than the final comma or semicolon) is the long name.
+    if (digit_count == 0 || digit_count == line.size() || !IsSpace(line[digit_count])) {
+      break;
+    }
+    const auto short_name = line.substr(0, digit_count);
+    auto long_name = line.substr(digit_count + 1);
+    const bool is_last = !long_name.empty() && long_name.back() == ';';
+    if (!long_name.empty() && (is_last || long_name.back() == ',')) {
+      long_name.remove_suffix(1);
+    }
+    if (long_name.find_first_of(",;") != std::string_view::npos) {
+      break;
+    }
+    // We prepare taxa_ so that it can parse the short taxon names.
+    SafeInsert(taxa, std::string(short_name), leaf_id);
+    // However, we keep the long names for the TagTaxonMap.
+    SafeInsert(long_name_taxa, PackInts(leaf_id, 1), std::string(long_name));
+    leaf_id++;
+    // MrBayes puts the semicolon at the end of the last translation statement.
+    if (is_last) {
+      line_position = position;
+      break;
+    }
+  }
+  Assert(leaf_id > 0, "No taxa found in translate block!");
+  taxa_ = std::move(taxa);
+  *long_name_taxon_map = std::move(long_name_taxa);
+  taxa_complete_ = true;
+  // The first tree starts on the line after the translate block.
+  return line_position;
+}
+
+size_t Driver::ReadNexusHeader(TextFile &file, std::string_view *chunk,
+                              TagStringMap *long_name_taxon_map) {
+  bool found_trees_block;
+  auto first_tree_position =
+      ParseNexusHeader(*chunk, long_name_taxon_map, &found_trees_block);
+  // The header may not fit in the first chunk of a compressed file.
+  while (!first_tree_position.has_value()) {
+    if (file.AtEnd()) {
+      FailIncompleteNexusHeader(found_trees_block);
+    }
+    *chunk = file.ExtendChunk();
+    first_tree_position =
+        ParseNexusHeader(*chunk, long_name_taxon_map, &found_trees_block);
+  }
+  return *first_tree_position;
+}
+
 TreeCollection Driver::ParseNexusFile(const std::string &fname) {
   Clear();
-  std::ifstream in(fname.c_str());
   try {
-    if (!in) {
-      throw std::runtime_error("Cannot open file.");
-    }
-    std::string line;
-    std::getline(in, line);
-    if (line != "#NEXUS") {
-      throw std::runtime_error("Putative Nexus file doesn't begin with #NEXUS.");
-    }
-    do {
-      if (in.eof()) {
-        throw std::runtime_error("Finished reading and couldn't find 'begin trees;'");
-      }
-      std::getline(in, line);
-      // BEAST uses "Begin trees;" so we tolower here.
-      line[0] = std::tolower(line[0]);
-    } while (line != "begin trees;");
-    std::getline(in, line);
-    std::regex translate_start("^\\s*[Tt]ranslate");
-    if (!std::regex_match(line, translate_start)) {
-      throw std::runtime_error("Missing translate block.");
-    }
-    std::getline(in, line);
-    std::regex translate_item_regex(R"raw(^\s*(\d+)\s([^,;]*)[,;]?$)raw");
-    std::regex lone_semicolon_regex(R"raw(\s*;$)raw");
-    std::smatch match;
-    auto previous_position = in.tellg();
+    TextFile file(fname, TextChunkSize());
+    auto chunk = file.NextChunk();
     TagStringMap long_name_taxon_map;
-    uint32_t leaf_id = 0;
-    while (std::regex_match(line, match, translate_item_regex)) {
-      const auto short_name = match[1].str();
-      const auto long_name = match[2].str();
-      // We prepare taxa_ so that it can parse the short taxon names.
-      SafeInsert(taxa_, short_name, leaf_id);
-      // However, we keep the long names for the TagTaxonMap.
-      SafeInsert(long_name_taxon_map, PackInts(leaf_id, 1), long_name);
-      leaf_id++;
-      // Semicolon marks the end of the translate block.
-      // It appears at the end of a translation statement line in MrBayes.
-      if (match[3].str() == ";") {
-        break;
-      }
-      previous_position = in.tellg();
-      std::getline(in, line);
-      // BEAST has the ending semicolon on a line of its own.
-      if (std::regex_match(line, match, lone_semicolon_regex)) {
-        break;
-      }
-      if (in.eof()) {
-        throw std::runtime_error("Encountered EOF while parsing translate block.");
-      }
-    }
-    Assert(leaf_id > 0, "No taxa found in translate block!");
-    taxa_complete_ = true;
-    // Back up one line to hit the first tree.
-    in.seekg(previous_position);
+    const size_t first_tree_position =
+        ReadNexusHeader(file, &chunk, &long_name_taxon_map);
     // Now we make a new TagTaxonMap to replace the one with numbers in place of
     // taxon names.
-    auto short_name_tree_collection = ParseNewick(in);
+    TreeCollection short_name_tree_collection;
+    if (use_fast_parser_ || file.IsStreamed()) {
+      const auto header = chunk.substr(0, first_tree_position);
+      short_name_tree_collection =
+          ParseTextFile(file, chunk.substr(first_tree_position),
+                        1 + std::count(header.begin(), header.end(), '\n'));
+    } else {
+      std::ifstream in(fname.c_str());
+      in.seekg(first_tree_position);
+      short_name_tree_collection = ParseNewick(in);
+    }
+    ReleaseNodes();
     // We're using the public member directly rather than the const accessor because we
     // want to move.
     return TreeCollection(std::move(short_name_tree_collection.trees_),
@@ -139,24 +258,587 @@ TreeCollection Driver::ParseNexusFile(const std::string &fname) {
   }
 }
 
+namespace {
+
+// We can't jump around in a compressed file.
+void CheckUncompressed(std::string_view text, const std::string &fname) {
+  const auto header = text.substr(0, 4);
+  if (TextFile::IsGzipMagic(header) || TextFile::IsZstdMagic(header)) {
+    Failwith("Cannot index the compressed File : " + fname +
+             "\nDecompress it to parse a range of its trees.");
+  }
+}
+
+}  // namespace
+
+TreeCollection Driver::ParseNewickFileRange(const std::string &fname, size_t begin,
+                                            size_t end, size_t stride) {
+  Clear();
+  const MmappedFile file(fname);
+  CheckUncompressed(file.View(), fname);
+  const auto index = TreeFileIndex::OfFile(fname, file.View(), 0);
+  auto perhaps_quoted_trees = ParseIndexedTrees(file.View(), index, begin, end, stride);
+  ReleaseNodes();
+  return TreeCollection(
+      std::move(perhaps_quoted_trees.trees_),
+      TaxonNameMunging::DequoteTagStringMap(perhaps_quoted_trees.TagTaxonMap()));
+}
+
+TreeCollection Driver::ParseNexusFileRange(const std::string &fname, size_t begin,
+                                           size_t end, size_t stride) {
+  Clear();
+  try {
+    const MmappedFile file(fname);
+    const auto text = file.View();
+    CheckUncompressed(text, fname);
+    TagStringMap long_name_taxon_map;
+    bool found_trees_block;
+    const auto first_tree_position =
+        ParseNexusHeader(text, &long_name_taxon_map, &found_trees_block);
+    if (!first_tree_position) {
+      FailIncompleteNexusHeader(found_trees_block);
+    }
+    const auto index = TreeFileIndex::OfFile(fname, text, *first_tree_position);
+    auto short_name_tree_collection =
+        ParseIndexedTrees(text, index, begin, end, stride);
+    ReleaseNodes();
+    return TreeCollection(std::move(short_name_tree_collection.trees_),
+                          TaxonNameMunging::DequoteTagStringMap(long_name_taxon_map));
+  } catch (const std::exception &exception) {
+    Failwith("Problem parsing '" + fname + "':\n" + exception.what());
+  }
+}
+
+TreeCollection Driver::ParseIndexedTrees(std::string_view text,
+                                         const TreeFileIndex &index, size_t begin,
+                                         size_t end, size_t stride) {
+  if (stride == 0) {
+    Failwith("The stride for parsing a range of trees must be positive.");
+  }
+  end = std::min(end, index.TreeCount());
+  IndexTaxa();
+  auto parse_tree = [this, &text, &index](size_t tree_index, TextParser &parser) {
+    try {
+      return ParseTreeText(index.TreeText(text, tree_index), parser);
+    } catch (const std::exception &exception) {
+      Failwith("Problem parsing tree on line " +
+               std::to_string(index.LineNumber(tree_index)) + " at " +
+               exception.what());
+    }
+  };
+  if (!taxa_complete_ && index.TreeCount() > 0) {
+    // The first tree sets the taxon numbering of a Newick file, even if we don't
+    // want it.
+    NodeStore node_store;
+    TextParser parser(&node_store, nullptr);
+    parse_tree(0, parser);
+  }
+  if (begin >= end) {
+    return TreeCollection(Tree::TreeVector(), this->TagTaxonMap());
+  }
+  if (stride == 1) {
+    // The trees are contiguous, so we can parse them in parallel as usual.
+    const size_t text_begin = index.Offset(begin);
+    const size_t text_end =
+        index.Offset(end - 1) + index.TreeText(text, end - 1).size();
+    return ParseNewickText(text.substr(text_begin, text_end - text_begin),
+                           index.LineNumber(begin));
+  }
+  TextParser parser(&node_store_, use_node_arena_ ? &node_arena_ : nullptr);
+  Tree::TreeVector trees;
+  trees.reserve((end - begin + stride - 1) / stride);
+  for (size_t tree_index = begin; tree_index < end; tree_index += stride) {
+    trees.push_back(parse_tree(tree_index, parser));
+  }
+  return TreeCollection(std::move(trees), this->TagTaxonMap());
+}
+
 Tree Driver::ParseString(yy::parser *parser_instance, const std::string &str) {
   // Scan the string using the lexer into hidden state.
   this->ScanString(str);
   // Parse the scanned string.
   int return_code = (*parser_instance)();
   Assert(return_code == 0, "Parser had nonzero return value.");
-  return *latest_tree_;
+  // The parsed topology is a temporary, but its canonical nodes live as long as the
+  // collection, so only those go in the arena.
+  std::optional<NodeArena::Scope> arena_scope;
+  if (use_node_arena_) {
+    arena_scope.emplace(node_arena_);
+  }
+  return Tree(node_store_.Canonicalize(latest_tree_->Topology()),
+              std::move(latest_tree_->branch_lengths_));
 }
 
 TreeCollection Driver::ParseString(const std::string &str) {
   Clear();
-  yy::parser parser_instance(*this);
-  parser_instance.set_debug_level(trace_parsing_);
-  Tree::TreeVector trees = {ParseString(&parser_instance, str)};
+  Tree::TreeVector trees;
+  if (use_fast_parser_) {
+    IndexTaxa();
+    TextParser parser(&node_store_, use_node_arena_ ? &node_arena_ : nullptr);
+    try {
+      trees.push_back(ParseTreeText(str, parser));
+    } catch (const std::exception &exception) {
+      Failwith(std::string("Problem parsing tree at ") + exception.what());
+    }
+  } else {
+    yy::parser parser_instance(*this);
+    parser_instance.set_debug_level(trace_parsing_);
+    trees.push_back(ParseString(&parser_instance, str));
+  }
+  ReleaseNodes();
   return TreeCollection(trees,
                         TaxonNameMunging::DequoteTagStringMap(this->TagTaxonMap()));
 }
 
+namespace {
+
+bool IsBlank(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+
+// The characters of an unquoted label, as in the LABEL pattern of scanner.ll.
+bool IsLabelCharacter(char c) {
+  return c > ' ' && c < 127 && c != '(' && c != ')' && c != ';' && c != ',' &&
+         c != ':' && c != '\'' && c != '[' && c != ']';
+}
+
+}  // namespace
+
+size_t Driver::ThreadCount() const {
+  return thread_count_ > 0
+             ? thread_count_
+             : std::max(size_t(1), size_t(std::thread::hardware_concurrency()));
+}
+
+size_t Driver::TextChunkSize() const { return 4 * ThreadCount() * min_chunk_size_; }
+
+TreeCollection Driver::ParseTextFile(TextFile &file, std::string_view chunk,
+                                     size_t first_line_number) {
+  Tree::TreeVector trees;
+  size_t line_number = first_line_number;
+  // The given chunk may be empty, if it ended with the header of a Nexus file.
+  while (true) {
+    auto chunk_trees = ParseNewickText(chunk, line_number).trees_;
+    trees.insert(trees.end(), std::make_move_iterator(chunk_trees.begin()),
+                 std::make_move_iterator(chunk_trees.end()));
+    if (file.AtEnd()) {
+      break;
+    }
+    line_number += std::count(chunk.begin(), chunk.end(), '\n');
+    chunk = file.NextChunk();
+  }
+  return TreeCollection(std::move(trees), this->TagTaxonMap());
+}
+
+TreeCollection Driver::ParseNewickText(std::string_view text,
+                                       size_t first_line_number) {
+  IndexTaxa();
+  TextParser parser(&node_store_, use_node_arena_ ? &node_arena_ : nullptr);
+  // The text of each chunk and what we parsed from it.
+  std::vector<std::string_view> chunks;
+  std::vector<ParsedLines> parsed_chunks;
+  auto parse_chunk = [this, &chunks, &parsed_chunks, &parser](std::string_view chunk) {
+    chunks.push_back(chunk);
+    parsed_chunks.push_back(ParseLines(chunk, parser));
+  };
+  // Until the taxon set is complete, parse line by line.
+  while (!text.empty() && !taxa_complete_) {
+    const size_t line_end = std::min(text.find('\n'), text.size() - 1);
+    parse_chunk(text.substr(0, line_end + 1));
+    text.remove_prefix(line_end + 1);
+    if (parsed_chunks.back().error_line_ != SIZE_MAX) {
+      text = {};
+    }
+  }
+  // Then split the rest into chunks of whole lines, about four per thread so that
+  // the threads stay busy if the chunks take different times.
+  const size_t thread_count = ThreadCount();
+  const size_t chunk_count =
+      std::max(size_t(1), std::min(4 * thread_count, text.size() / min_chunk_size_));
+  if (thread_count == 1 || chunk_count == 1) {
+    if (!text.empty()) {
+      parse_chunk(text);
+    }
+  } else {
+    const size_t first_parallel_chunk = chunks.size();
+    const size_t target_chunk_size = text.size() / chunk_count;
+    while (!text.empty()) {
+      const size_t line_end = text.find('\n', std::min(target_chunk_size, text.size()));
+      const size_t chunk_size = std::min(line_end, text.size() - 1) + 1;
+      chunks.push_back(text.substr(0, chunk_size));
+      text.remove_prefix(chunk_size);
+    }
+    parsed_chunks.resize(chunks.size());
+    // Each thread builds its trees out of a node store and arena of its own.
+    std::vector<std::unique_ptr<NodeStore>> node_stores;
+    std::vector<std::unique_ptr<NodeArena>> node_arenas;
+    std::vector<std::unique_ptr<TextParser>> parsers;
+    std::queue<TextParser *> parser_queue;
+    for (size_t i = 0; i < thread_count; i++) {
+      node_stores.push_back(std::make_unique<NodeStore>());
+      node_arenas.push_back(std::make_unique<NodeArena>());
+      parsers.push_back(std::make_unique<TextParser>(
+          node_stores.back().get(),
+          use_node_arena_ ? node_arenas.back().get() : nullptr));
+      parser_queue.push(parsers.back().get());
+    }
+    std::queue<size_t> chunk_queue;
+    for (size_t i = first_parallel_chunk; i < chunks.size(); i++) {
+      chunk_queue.push(i);
+    }
+    TaskProcessor<TextParser *, size_t> task_processor(
+        std::move(parser_queue), std::move(chunk_queue),
+        [this, &chunks, &parsed_chunks](TextParser *parser, size_t chunk_index) {
+          parsed_chunks[chunk_index] = ParseLines(chunks[chunk_index], *parser);
+        });
+    task_processor.Wait();
+  }
+  // Put the trees together in file order, reporting the first error.
+  Tree::TreeVector trees;
+  size_t line_number = first_line_number;
+  for (size_t i = 0; i < chunks.size(); i++) {
+    if (parsed_chunks[i].error_line_ != SIZE_MAX) {
+      Failwith("Problem parsing tree on line " +
+               std::to_string(line_number + parsed_chunks[i].error_line_) + " at " +
+               parsed_chunks[i].error_);
+    }
+    line_number += std::count(chunks[i].begin(), chunks[i].end(), '\n');
+    trees.insert(trees.end(), std::make_move_iterator(parsed_chunks[i].trees_.begin()),
+                 std::make_move_iterator(parsed_chunks[i].trees_.end()));
+  }
+  return TreeCollection(std::move(trees), this->TagTaxonMap());
+}
+
+TagStringMap Driver::StreamNewickFile(const std::string &fname,
+                                      const TreeBatchFunction &tree_batch_function,
+                                      size_t burn_in_count, size_t thinning,
+                                      size_t batch_size) {
+  Clear();
+  TextFile file(fname, TextChunkSize());
+  StreamNewickText(file, file.NextChunk(), 0, 1, tree_batch_function, burn_in_count,
+                   thinning, batch_size);
+  return TaxonNameMunging::DequoteTagStringMap(TagTaxonMap());
+}
+
+TagStringMap Driver::StreamNexusFile(const std::string &fname,
+                                     const TreeBatchFunction &tree_batch_function,
+                                     size_t burn_in_count, size_t thinning,
+                                     size_t batch_size) {
+  Clear();
+  TextFile file(fname, TextChunkSize());
+  auto chunk = file.NextChunk();
+  TagStringMap long_name_taxon_map;
+  size_t first_tree_position;
+  try {
+    first_tree_position = ReadNexusHeader(file, &chunk, &long_name_taxon_map);
+  } catch (const std::exception &exception) {
+    Failwith("Problem parsing '" + fname + "':\n" + exception.what());
+  }
+  const auto header = chunk.substr(0, first_tree_position);
+  StreamNewickText(file, chunk, first_tree_position,
+                   1 + std::count(header.begin(), header.end(), '\n'),
+                   tree_batch_function, burn_in_count, thinning, batch_size);
+  return TaxonNameMunging::DequoteTagStringMap(long_name_taxon_map);
+}
+
+void Driver::StreamNewickText(TextFile &file, std::string_view chunk, size_t begin,
+                              size_t first_line_number,
+                              const TreeBatchFunction &tree_batch_function,
+                              size_t burn_in_count, size_t thinning,
+                              size_t batch_size) {
+  Assert(thinning > 0 && batch_size > 0,
+         "Driver::StreamNewickText needs positive thinning and batch_size.");
+  IndexTaxa();
+  // We don't use an arena, because it would stay alive as long as any tree of the
+  // batch does.
+  NodeStore node_store;
+  TextParser parser(&node_store, nullptr);
+  std::string_view text = chunk;
+  size_t position = begin;
+  size_t line_number = first_line_number;
+  size_t tree_index = 0;
+  // The text and line number of each tree of the current batch.
+  std::vector<std::pair<std::string_view, size_t>> batch;
+  batch.reserve(batch_size);
+  auto parse_tree = [this, &parser](std::string_view tree_text, size_t line_number) {
+    try {
+      return ParseTreeText(tree_text, parser);
+    } catch (const std::exception &exception) {
+      Failwith("Problem parsing tree on line " + std::to_string(line_number) + " at " +
+               exception.what());
+    }
+  };
+  auto flush_batch = [&]() {
+    Tree::TreeVector trees;
+    trees.reserve(batch.size());
+    for (const auto &[tree_text, tree_line_number] : batch) {
+      trees.push_back(parse_tree(tree_text, tree_line_number));
+    }
+    batch.clear();
+    node_store.clear();
+    tree_batch_function(std::move(trees));
+    file.Release(position);
+  };
+  while (true) {
+    if (position >= text.size()) {
+      if (file.AtEnd()) {
+        break;
+      }
+      // The batch views the current chunk, so it has to go before the chunk does.
+      if (!batch.empty()) {
+        flush_batch();
+      }
+      text = file.NextChunk();
+      position = 0;
+      continue;
+    }
+    const size_t line_end = std::min(text.find('\n', position), text.size());
+    const auto line = text.substr(position, line_end - position);
+    const auto tree_start = line.find('(');
+    if (tree_start != std::string_view::npos) {
+      if (tree_index >= burn_in_count && (tree_index - burn_in_count) % thinning == 0) {
+        batch.emplace_back(line.substr(tree_start), line_number);
+      } else if (!taxa_complete_) {
+        parse_tree(line.substr(tree_start), line_number);
+      }
+      tree_index++;
+    }
+    position = line_end + 1;
+    line_number++;
+    if (batch.size() == batch_size) {
+      flush_batch();
+    }
+  }
+  if (!batch.empty()) {
+    flush_batch();
+  }
+}
+
+Driver::ParsedLines Driver::ParseLines(std::string_view text, TextParser &parser) {
+  ParsedLines parsed_lines;
+  for (size_t line_index = 0; !text.empty(); line_index++) {
+    const size_t line_end = std::min(text.find('\n'), text.size());
+    const auto line = text.substr(0, line_end);
+    const auto tree_start = line.find('(');
+    if (tree_start != std::string_view::npos) {
+      try {
+        parsed_lines.trees_.push_back(ParseTreeText(line.substr(tree_start), parser));
+      } catch (const std::exception &exception) {
+        // We're perhaps on a worker thread, so we pass errors back rather than throw.
+        parsed_lines.error_line_ = line_index;
+        parsed_lines.error_ = exception.what();
+        break;
+      }
+    }
+    text.remove_prefix(std::min(line_end + 1, text.size()));
+  }
+  return parsed_lines;
+}
+
+Tree Driver::ParseTreeText(std::string_view text, TextParser &parser) {
+  auto &parsed_nodes = parser.parsed_nodes_;
+  auto &parsed_children = parser.parsed_children_;
+  auto &canonical_nodes = parser.canonical_nodes_;
+  NodeStore *node_store = parser.node_store_;
+  size_t position = 0;
+  auto fail = [&text, &position](const std::string &message) {
+    Failwith("column " + std::to_string(position + 1) + ": " + message + "\n" +
+             std::string(text));
+  };
+  // Skip blanks and return the next character, or '\0' at the end of the text.
+  auto peek = [&text, &position]() {
+    while (position < text.size() && IsBlank(text[position])) {
+      position++;
+    }
+    return position < text.size() ? text[position] : '\0';
+  };
+  auto read_label = [&text, &position, &fail]() {
+    const size_t start = position;
+    if (text[position] == '\'') {
+      // Quoted labels can contain anything but quotes, which get doubled.
+      do {
+        const size_t end = text.find('\'', position + 1);
+        if (end == std::string_view::npos) {
+          fail("unterminated quoted label");
+        }
+        position = end + 1;
+      } while (position < text.size() && text[position] == '\'');
+    } else {
+      while (position < text.size() && IsLabelCharacter(text[position])) {
+        position++;
+      }
+    }
+    return text.substr(start, position - start);
+  };
+  auto leaf_id_of = [this, &fail](std::string_view label) {
+    const auto search = taxon_ids_.find(label);
+    if (search != taxon_ids_.end()) {
+      return search->second;
+    }  // else
+    if (taxa_complete_) {
+      fail("Taxon '" + std::string(label) + "' is not known in our taxon set.\n" +
+           "Either it is missing in the translate block or it didn't appear in the "
+           "first tree.");
+    }
+    // This is our first tree, so we're initializing the taxon set.
+    const auto [iter, inserted] = taxa_.emplace(std::string(label), next_id_);
+    taxon_ids_.insert({std::string_view(iter->first), next_id_});
+    return next_id_++;
+  };
+  // Read an optional branch length, with an optional [&metadata] comment.
+  auto read_branch_length = [&text, &position, &peek, &fail](double &branch_length) {
+    if (peek() != ':') {
+      return;
+    }
+    position++;
+    if (peek() == '[') {
+      const size_t end = text.find(']', position);
+      if (text.substr(position, 2) != "[&" || end == std::string_view::npos) {
+        fail("expected a [&metadata] comment");
+      }
+      position = end + 1;
+    }
+    peek();
+    const size_t start = position;
+    while (position < text.size() && IsLabelCharacter(text[position])) {
+      position++;
+    }
+    const auto label = text.substr(start, position - start);
+    // The bison parser converts branch lengths with std::stod, which also takes a
+    // leading '+' and hexadecimal numbers, neither of which std::from_chars does. So
+    // we skip a '+', and leave hexadecimal (which is rare enough) to std::strtod.
+    const auto number = label.substr(!label.empty() && label[0] == '+' ? 1 : 0);
+    const auto [end, error] =
+        std::from_chars(number.data(), number.data() + number.size(), branch_length);
+    if (number.empty() || error != std::errc() ||
+        end != number.data() + number.size()) {
+      const std::string number_string(number);
+      char *number_end = nullptr;
+      branch_length = std::strtod(number_string.c_str(), &number_end);
+      // Labels have no blanks, but std::strtod would take a second '+'.
+      if (number_string.empty() || number_string[0] == '+' ||
+          number_end != number_string.c_str() + number_string.size()) {
+        fail("Float conversion failed on branch length '" + std::string(label) + "'");
+      }
+    }
+  };
+
+  // First we read the nodes in the order in which they appear. The children of the
+  // inner nodes that are still open are on child_stack, and open_child_stack_sizes
+  // has the size of child_stack when each of those nodes was opened.
+  parsed_nodes.clear();
+  parsed_children.clear();
+  std::vector<uint32_t> child_stack;
+  std::vector<size_t> open_child_stack_sizes;
+  size_t internal_node_count = 0;
+  while (true) {
+    char next = peek();
+    if (next == '(') {
+      open_child_stack_sizes.push_back(child_stack.size());
+      position++;
+      continue;
+    }  // else
+    if (next != '\'' && !IsLabelCharacter(next)) {
+      fail("expected a taxon name or '('");
+    }
+    const uint32_t leaf_id = leaf_id_of(read_label());
+    child_stack.push_back(static_cast<uint32_t>(parsed_nodes.size()));
+    parsed_nodes.push_back({leaf_id, 0, 0, 0.});
+    read_branch_length(parsed_nodes.back().branch_length_);
+    // Close as many inner nodes as we can.
+    while ((next = peek()) == ')') {
+      if (open_child_stack_sizes.empty()) {
+        fail("unbalanced ')'");
+      }
+      position++;
+      const size_t first_child = open_child_stack_sizes.back();
+      open_child_stack_sizes.pop_back();
+      const auto children_begin = static_cast<uint32_t>(parsed_children.size());
+      parsed_children.insert(parsed_children.end(), child_stack.begin() + first_child,
+                              child_stack.end());
+      // Order the children by their max leaf ids, as Node::Join does.
+      const auto by_max_leaf_id = [&parsed_nodes](uint32_t lhs, uint32_t rhs) {
+        return parsed_nodes[lhs].max_leaf_id_ < parsed_nodes[rhs].max_leaf_id_;
+      };
+      std::sort(parsed_children.begin() + children_begin, parsed_children.end(),
+                by_max_leaf_id);
+      for (auto child = parsed_children.begin() + children_begin + 1;
+           child < parsed_children.end(); child++) {
+        if (!by_max_leaf_id(*(child - 1), *child)) {
+          fail("Do you have a taxon name repeated?");
+        }
+      }
+      child_stack.resize(first_child);
+      child_stack.push_back(static_cast<uint32_t>(parsed_nodes.size()));
+      parsed_nodes.push_back(
+          {parsed_nodes[parsed_children.back()].max_leaf_id_, children_begin,
+           static_cast<uint32_t>(parsed_children.size() - children_begin), 0.});
+      internal_node_count++;
+      read_branch_length(parsed_nodes.back().branch_length_);
+    }
+    if (next == ',' && !open_child_stack_sizes.empty()) {
+      position++;
+    } else if (next == ';' && open_child_stack_sizes.empty()) {
+      position++;
+      break;
+    } else {
+      fail("expected ',', ')' or ';'");
+    }
+  }
+  if (peek() != '\0') {
+    fail("unexpected text after ';'");
+  }
+  if (!taxa_complete_) {
+    taxa_complete_ = true;
+  }
+
+  // Then we build the canonical topology in the postorder of the polished topology,
+  // giving the nodes the ids that Node::Polish would.
+  std::optional<NodeArena::Scope> arena_scope;
+  if (parser.node_arena_ != nullptr) {
+    arena_scope.emplace(*parser.node_arena_);
+  }
+  const uint32_t root = child_stack.back();
+  const size_t leaf_count = parsed_nodes[root].max_leaf_id_ + 1;
+  size_t next_internal_id = leaf_count;
+  Tree::BranchLengthVector branch_lengths(leaf_count + internal_node_count, 0.);
+  canonical_nodes.resize(parsed_nodes.size());
+  Node::NodePtrVec children;
+  // Pairs of a parsed node and the number of its children that we have visited.
+  std::vector<std::pair<uint32_t, uint32_t>> stack = {{root, 0}};
+  while (!stack.empty()) {
+    const auto [parsed_id, visited_child_count] = stack.back();
+    const ParsedNode &node = parsed_nodes[parsed_id];
+    if (visited_child_count < node.child_count_) {
+      stack.back().second++;
+      stack.emplace_back(parsed_children[node.children_begin_ + visited_child_count],
+                         0);
+      continue;
+    }  // else
+    stack.pop_back();
+    size_t id;
+    if (node.child_count_ == 0) {
+      id = node.max_leaf_id_;
+      canonical_nodes[parsed_id] = node_store->Leaf(node.max_leaf_id_, leaf_count);
+    } else {
+      id = next_internal_id++;
+      children.clear();
+      for (uint32_t i = 0; i < node.child_count_; i++) {
+        children.push_back(
+            std::move(canonical_nodes[parsed_children[node.children_begin_ + i]]));
+      }
+      canonical_nodes[parsed_id] = node_store->Join(children, id);
+    }
+    branch_lengths[id] = node.branch_length_;
+  }
+  return Tree(std::move(canonical_nodes[root]), std::move(branch_lengths));
+}
+
+void Driver::IndexTaxa() {
+  taxon_ids_.clear();
+  for (const auto &[name, id] : taxa_) {
+    taxon_ids_.insert({std::string_view(name), id});
+  }
+}
+
 TagStringMap Driver::TagTaxonMap() {
   TagStringMap m;
   for (const auto &iter : taxa_) {
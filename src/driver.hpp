@@ -5,14 +5,24 @@
 
 #ifndef SRC_DRIVER_HPP_
 #define SRC_DRIVER_HPP_
+#include <fstream>
+#include <functional>
 #include <map>
 #include <memory>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <unordered_set>
 #include <vector>
 
+#include "flat_hash_map.hpp"
+#include "node_arena.hpp"
+#include "node_store.hpp"
 #include "parser.hpp"
 #include "sugar.hpp"
+#include "text_file.hpp"
 #include "tree_collection.hpp"
+#include "tree_file_index.hpp"
 
 // Give Flex the prototype of yylex we want ...
 #define YY_DECL yy::parser::symbol_type yylex(Driver& drv)
@@ -47,14 +57,59 @@ class Driver {
   TagDoubleMap branch_lengths_;
   // The token's location, used by the scanner to give good debug info.
   yy::location location_;
+  // The parsed topologies get canonicalized through this store, so that the trees
+  // we parse share their identical subtrees. We only need it while parsing a
+  // collection, and empty it once we are done (see ReleaseNodes).
+  NodeStore node_store_;
+  // If set, the canonical nodes of each parsed collection get allocated in an arena
+  // of their own, which is freed all at once when the collection goes away.
+  bool use_node_arena_;
+  // The arena for the next collection we parse.
+  NodeArena node_arena_;
+  // If set, we parse with a hand-written single-pass parser that reads files through
+  // a memory map, rather than with flex and bison. The two accept the same trees.
+  bool use_fast_parser_;
+  // The number of threads for the hand-written parser; 0 means one per core.
+  size_t thread_count_;
+  // We don't split the text for parallel parsing into chunks smaller than this
+  // number of bytes.
+  size_t min_chunk_size_;
 
   // These three parsing methods also remove quotes from Newick strings and Nexus files.
+  // Files may be gzip-compressed, in which case we decompress them in chunks as we
+  // parse them, always with the hand-written parser.
   // Make a parser and then parse a string for a one-off parsing.
   TreeCollection ParseString(const std::string& s);
   // Run the parser on a Newick file.
   TreeCollection ParseNewickFile(const std::string& fname);
   // Run the parser on a Nexus file.
   TreeCollection ParseNexusFile(const std::string& fname);
+  // Stream the trees of a file to tree_batch_function in batches of at most
+  // batch_size trees rather than returning them all at once, so that memory use
+  // doesn't grow with the number of trees. We skip the first burn_in_count trees and
+  // then keep every thinning-th tree. Skipped trees don't get parsed, apart from the
+  // first tree of a Newick file, which sets the taxon numbering. These always use the
+  // hand-written parser, only share subtrees within a batch, and return the
+  // TagTaxonMap (without quotes) of the trees.
+  using TreeBatchFunction = std::function<void(Tree::TreeVector)>;
+  TagStringMap StreamNewickFile(const std::string& fname,
+                                const TreeBatchFunction& tree_batch_function,
+                                size_t burn_in_count = 0, size_t thinning = 1,
+                                size_t batch_size = 1024);
+  TagStringMap StreamNexusFile(const std::string& fname,
+                               const TreeBatchFunction& tree_batch_function,
+                               size_t burn_in_count = 0, size_t thinning = 1,
+                               size_t batch_size = 1024);
+  // Parse only the trees of a plain-text file with indices begin, begin + stride, and
+  // so on, up to but not including end (which may be past the last tree). We jump
+  // straight to them through the TreeFileIndex of the file, which gets built the
+  // first time and then loaded from its sidecar file. The first tree of a Newick file
+  // also gets parsed, as it sets the taxon numbering. These always use the
+  // hand-written parser, and remove quotes like the methods above.
+  TreeCollection ParseNewickFileRange(const std::string& fname, size_t begin,
+                                      size_t end, size_t stride = 1);
+  TreeCollection ParseNexusFileRange(const std::string& fname, size_t begin,
+                                     size_t end, size_t stride = 1);
   // Clear out stored state.
   void Clear();
   // Make the map from the edge tags of the tree to the taxon names from taxa_.
@@ -67,9 +122,96 @@ class Driver {
   Tree ParseString(yy::parser* parser_instance, const std::string& str);
   // Run the parser on a Newick stream.
   TreeCollection ParseNewick(std::ifstream& in);
+  // Scan the text of a Nexus file up to its first tree, preparing taxa_ to parse the
+  // short taxon names of the translate block and filling in the long names. Returns
+  // the position of the line of the first tree, or nullopt (without changing
+  // anything) if the text ends before we get there, in which case found_trees_block
+  // tells whether we got as far as the "begin trees;" line.
+  std::optional<size_t> ParseNexusHeader(std::string_view text,
+                                         TagStringMap* long_name_taxon_map,
+                                         bool* found_trees_block);
+  // Run ParseNexusHeader on the first chunk of a file, extending the chunk until it
+  // holds the whole header.
+  size_t ReadNexusHeader(TextFile& file, std::string_view* chunk,
+                         TagStringMap* long_name_taxon_map);
+
+  // A node of a tree as the hand-written parser reads it, before we know its id.
+  struct ParsedNode {
+    // The taxon id of a leaf, or the largest taxon id below an internal node.
+    uint32_t max_leaf_id_;
+    // The children of an internal node are parsed_children_[children_begin_] onwards.
+    uint32_t children_begin_;
+    uint32_t child_count_;
+    double branch_length_;
+  };
+  // The state of the hand-written parser for one thread. It builds canonical
+  // topologies out of the given node store, allocating them in the given arena
+  // unless that is nullptr.
+  struct TextParser {
+    TextParser(NodeStore* node_store, const NodeArena* node_arena)
+        : node_store_(node_store), node_arena_(node_arena) {}
+    NodeStore* node_store_;
+    const NodeArena* node_arena_;
+    // Scratch space, indexed by the order in which the nodes get parsed.
+    std::vector<ParsedNode> parsed_nodes_;
+    std::vector<uint32_t> parsed_children_;
+    std::vector<Node::NodePtr> canonical_nodes_;
+  };
+  // The trees parsed from some lines of text, or the (zero-based) index of the line
+  // on which parsing failed along with the error message.
+  struct ParsedLines {
+    Tree::TreeVector trees_;
+    size_t error_line_ = SIZE_MAX;
+    std::string error_;
+  };
+
+  // The hand-written parser. Like ParseNewick, ParseNewickText parses every line that
+  // contains a '(' as a tree starting at that '('; the first line of the text has the
+  // given line number, for error messages. Once the taxon set is complete, we split
+  // the text into chunks of lines and parse those on thread_count_ threads, each with
+  // its own node store.
+  TreeCollection ParseNewickText(std::string_view text, size_t first_line_number);
+  // Run ParseNewickText on the given chunk of a file and then on the rest of the
+  // chunks of the file.
+  TreeCollection ParseTextFile(TextFile& file, std::string_view chunk,
+                               size_t first_line_number);
+  // Parse the selected trees of the text of a file, as in ParseNewickFileRange.
+  TreeCollection ParseIndexedTrees(std::string_view text, const TreeFileIndex& index,
+                                   size_t begin, size_t end, size_t stride);
+  // Stream the trees of a file from the given position of its current chunk on, as in
+  // StreamNewickFile.
+  void StreamNewickText(TextFile& file, std::string_view chunk, size_t begin,
+                        size_t first_line_number,
+                        const TreeBatchFunction& tree_batch_function,
+                        size_t burn_in_count, size_t thinning, size_t batch_size);
+  // Parse the trees on the lines of text, stopping at the first error.
+  ParsedLines ParseLines(std::string_view text, TextParser& parser);
+  // Parse a single tree, which must take up all of the text apart from blanks.
+  // Only the first tree of a Newick file may add taxa, so this only modifies the
+  // Driver if taxa_complete_ is false.
+  Tree ParseTreeText(std::string_view text, TextParser& parser);
+  // Point taxon_ids_ at the names in taxa_.
+  void IndexTaxa();
+  // Let go of the nodes of the collection we just parsed. The node store holds weak
+  // pointers to them, and a weak pointer to a node allocated in an arena keeps the
+  // whole arena alive, so without this the arena would outlive the collection. We
+  // also start a new arena for the next collection.
+  void ReleaseNodes();
+  // The number of threads to parse on, resolving a thread_count_ of 0.
+  size_t ThreadCount() const;
+  // The size of the chunks in which we decompress compressed files, which is enough
+  // to keep all of the threads busy.
+  size_t TextChunkSize() const;
+
+  // The taxon ids by name, viewing the keys of taxa_.
+  FlatHashMap<std::string_view, uint32_t> taxon_ids_;
 };
 
 #ifdef DOCTEST_LIBRARY_INCLUDED
+#include <sys/stat.h>
+
+#include <thread>
+
 
 TEST_CASE("Driver") {
   Driver driver;
@@ -93,6 +235,16 @@ TEST_CASE("Driver") {
   driver.Clear();
   auto newick_collection = driver.ParseNewickFile("data/DS1.subsampled_10.t.nwk");
   CHECK_EQ(nexus_collection, newick_collection);
+  // Parsed trees share their leaves and other identical subtrees.
+  std::unordered_set<const Node*> distinct_nodes;
+  size_t node_count = 0;
+  for (const auto& tree : newick_collection.Trees()) {
+    tree.Topology()->PreOrder([&distinct_nodes, &node_count](const Node* node) {
+      distinct_nodes.insert(node);
+      node_count++;
+    });
+  }
+  CHECK_LT(distinct_nodes.size(), node_count);
   driver.Clear();
   auto five_taxon = driver.ParseNewickFile("data/five_taxon_unrooted.nwk");
   std::vector<std::string> correct_five_taxon_names({"x0", "x1", "x2", "x3", "x4"});
@@ -115,6 +267,218 @@ TEST_CASE("Driver") {
     CHECK_EQ(topology->LeafCount(), beast_taxa.size());
   }
 }
+
+TEST_CASE("Driver: hand-written and bison parsers agree") {
+  Driver fast_driver;
+  Driver bison_driver;
+  bison_driver.use_fast_parser_ = false;
+  auto check_files = [&fast_driver, &bison_driver](const std::string& path,
+                                                    bool is_nexus) {
+    auto parse = [&path, is_nexus](Driver& driver) {
+      return is_nexus ? driver.ParseNexusFile(path) : driver.ParseNewickFile(path);
+    };
+    const auto fast_collection = parse(fast_driver);
+    const auto bison_collection = parse(bison_driver);
+    CHECK_EQ(fast_collection, bison_collection);
+    CHECK_EQ(fast_collection.TagTaxonMap(), bison_collection.TagTaxonMap());
+  };
+  check_files("data/DS1.subsampled_10.t.nwk", false);
+  check_files("data/five_taxon_unrooted.nwk", false);
+  check_files("data/DS1.subsampled_10.t.reordered", true);
+  check_files("data/test_beast_tree_parsing.nexus", true);
+  for (const auto& newick :
+       {"(a:0,b:0,c:0,d:0):0;", "((b:0,a:0):0,c:0):0;", "( a :1e-3, 'b c':2 ,c);",
+        "((a:1.1,b:2):0.4,c:[&rate=1.5]3):0;", "a;", "(a:1e-3,b:+2,c:0x10);"}) {
+    CHECK_EQ(fast_driver.ParseString(newick), bison_driver.ParseString(newick));
+  }
+  CHECK_THROWS(fast_driver.ParseString("(a:++2,b:1);"));
+  CHECK_THROWS(bison_driver.ParseString("(a:++2,b:1);"));
+  // Parsing in parallel chunks gives the same trees in the same order.
+  Driver parallel_driver;
+  parallel_driver.thread_count_ = 3;
+  parallel_driver.min_chunk_size_ = 1000;
+  for (const auto& path :
+       {"data/DS1.subsampled_10.t.nwk", "data/DS1.100_topologies.nwk"}) {
+    CHECK_EQ(parallel_driver.ParseNewickFile(path), bison_driver.ParseNewickFile(path));
+  }
+  CHECK_EQ(parallel_driver.ParseNexusFile("data/DS1.subsampled_10.t.reordered"),
+           bison_driver.ParseNexusFile("data/DS1.subsampled_10.t.reordered"));
+  // Compressed files give the same trees, also when we decompress them in chunks
+  // smaller than a tree or the Nexus header.
+  Driver compressed_driver;
+  compressed_driver.thread_count_ = 1;
+  compressed_driver.min_chunk_size_ = 100;
+  CHECK_EQ(compressed_driver.ParseNewickFile("data/DS1.100_topologies.nwk.gz"),
+           bison_driver.ParseNewickFile("data/DS1.100_topologies.nwk"));
+  CHECK_EQ(compressed_driver.ParseNexusFile("data/DS1.subsampled_10.t.gz"),
+           bison_driver.ParseNexusFile("data/DS1.subsampled_10.t"));
+  CHECK_EQ(bison_driver.ParseNexusFile("data/DS1.subsampled_10.t.gz"),
+           fast_driver.ParseNexusFile("data/DS1.subsampled_10.t"));
+  // Streaming gives the trees after burn-in and thinning, in batches.
+  auto check_stream = [&fast_driver](const std::string& path, bool is_nexus) {
+    const auto collection =
+        is_nexus ? fast_driver.ParseNexusFile(path) : fast_driver.ParseNewickFile(path);
+    const size_t burn_in_count = 5;
+    const size_t thinning = 3;
+    const size_t batch_size = 2;
+    Tree::TreeVector streamed_trees;
+    auto add_batch = [&streamed_trees, batch_size](Tree::TreeVector trees) {
+      CHECK_LE(trees.size(), batch_size);
+      streamed_trees.insert(streamed_trees.end(), trees.begin(), trees.end());
+    };
+    Driver streaming_driver;
+    streaming_driver.thread_count_ = 1;
+    streaming_driver.min_chunk_size_ = 100;
+    const auto tag_taxon_map =
+        is_nexus ? streaming_driver.StreamNexusFile(path, add_batch, burn_in_count,
+                                                    thinning, batch_size)
+                 : streaming_driver.StreamNewickFile(path, add_batch, burn_in_count,
+                                                     thinning, batch_size);
+    CHECK_EQ(tag_taxon_map, collection.TagTaxonMap());
+    Tree::TreeVector expected_trees;
+    for (size_t i = burn_in_count; i < collection.TreeCount(); i += thinning) {
+      expected_trees.push_back(collection.GetTree(i));
+    }
+    CHECK_EQ(TreeCollection(streamed_trees, tag_taxon_map),
+             TreeCollection(expected_trees, collection.TagTaxonMap()));
+  };
+  check_stream("data/DS1.subsampled_10.t.nwk", false);
+  check_stream("data/DS1.subsampled_10.t.reordered", true);
+  check_stream("data/DS1.100_topologies.nwk.gz", false);
+  check_stream("data/DS1.subsampled_10.t.gz", true);
+  // Malformed trees.
+  for (const auto& newick : {"(a,b", "(a,b));", "(a,b)x;", "(a:x,b);", "(a,a);",
+                             "(a,b); c", "(a,(b)", "()"}) {
+    CHECK_THROWS(fast_driver.ParseString(newick));
+  }
+}
+
+TEST_CASE("Driver: parsing ranges of trees") {
+  auto check_range = [](const std::string& path, bool is_nexus, size_t begin,
+                        size_t end, size_t stride) {
+    Driver driver;
+    const auto collection =
+        is_nexus ? driver.ParseNexusFile(path) : driver.ParseNewickFile(path);
+    // Once to build the index and once to load it.
+    for (size_t pass = 0; pass < 2; pass++) {
+      Driver range_driver;
+      range_driver.min_chunk_size_ = 100;
+      const auto range =
+          is_nexus ? range_driver.ParseNexusFileRange(path, begin, end, stride)
+                   : range_driver.ParseNewickFileRange(path, begin, end, stride);
+      Tree::TreeVector expected_trees;
+      for (size_t i = begin; i < std::min(end, collection.TreeCount()); i += stride) {
+        expected_trees.push_back(collection.GetTree(i));
+      }
+      CHECK_EQ(range, TreeCollection(expected_trees, collection.TagTaxonMap()));
+    }
+    std::remove(TreeFileIndex::SidecarPath(path).c_str());
+  };
+  check_range("data/DS1.100_topologies.nwk", false, 10, 60, 1);
+  check_range("data/DS1.100_topologies.nwk", false, 3, 1000, 7);
+  check_range("data/DS1.100_topologies.nwk", false, 0, 0, 1);
+  check_range("data/DS1.subsampled_10.t.reordered", true, 2, 9, 1);
+  check_range("data/DS1.subsampled_10.t", true, 1, 10, 4);
+  Driver driver;
+  CHECK_THROWS(driver.ParseNewickFileRange("data/DS1.100_topologies.nwk.gz", 0, 10));
+  CHECK_THROWS(driver.ParseNewickFileRange("data/DS1.100_topologies.nwk", 0, 10, 0));
+}
+
+TEST_CASE("Driver: parsed trees don't outlive their collection") {
+  Driver driver;
+  // Parse on one thread, so that the trees go in the driver's own arena.
+  driver.thread_count_ = 1;
+  for (const bool use_fast_parser : {true, false}) {
+    driver.use_fast_parser_ = use_fast_parser;
+    // The arena of the next parse is the current arena of the driver.
+    const auto resource = driver.node_arena_.WeakResource();
+    {
+      const auto collection = driver.ParseNexusFile("data/DS1.subsampled_10.t");
+      CHECK_FALSE(resource.expired());
+    }
+    CHECK(resource.expired());
+  }
+}
+
+TEST_CASE("Driver: incomplete Nexus headers") {
+  const std::string path = "_driver_test.t";
+  // The messages also say which file we were parsing and where we failed, so we
+  // just look for the part that tells what went wrong.
+  auto message_of = [](const std::function<void()>& parse) -> std::string {
+    try {
+      parse();
+    } catch (const std::runtime_error& e) {
+      return e.what();
+    }
+    return "";
+  };
+  auto check_message = [&path, &message_of](const std::string& header,
+                                            const std::string& message) {
+    {
+      std::ofstream file(path);
+      file << header;
+    }
+    Driver driver;
+    const auto file_message = message_of([&] { driver.ParseNexusFile(path); });
+    CHECK_NE(file_message.find(message), std::string::npos);
+    const auto range_message =
+        message_of([&] { driver.ParseNexusFileRange(path, 0, 1); });
+    CHECK_NE(range_message.find(message), std::string::npos);
+    std::remove(path.c_str());
+    std::remove(TreeFileIndex::SidecarPath(path).c_str());
+  };
+  check_message("#NEXUS\nbegin taxa;\nend;\n",
+                "Finished reading and couldn't find 'begin trees;'");
+  check_message(
+      "#NEXUS\nbegin trees;\ntranslate\n1 a,\n",
+      "Reached the end of the file before finding the first tree after the "
+      "translate block.");
+}
+
+TEST_CASE("Driver: parsing through a pipe") {
+  // Feed a file through a named pipe, which we can't memory-map or go back in. The
+  // files are smaller than the pipe's buffer, so the writer never waits on us.
+  const std::string pipe_path = "_driver_test.pipe";
+  auto parse_through_pipe = [&pipe_path](const std::string& path, auto parse) {
+    REQUIRE_EQ(mkfifo(pipe_path.c_str(), 0600), 0);
+    std::thread writer([&pipe_path, &path] {
+      std::ofstream pipe(pipe_path, std::ios::binary);
+      pipe << std::ifstream(path, std::ios::binary).rdbuf();
+    });
+    TreeCollection collection;
+    try {
+      collection = parse(pipe_path);
+    } catch (...) {
+      writer.join();
+      std::remove(pipe_path.c_str());
+      throw;
+    }
+    writer.join();
+    std::remove(pipe_path.c_str());
+    return collection;
+  };
+  for (const bool use_fast_parser : {true, false}) {
+    Driver driver;
+    driver.use_fast_parser_ = use_fast_parser;
+    const auto newick_path = "data/five_taxon_unrooted.nwk";
+    const auto newick_trees = driver.ParseNewickFile(newick_path);
+    CHECK_EQ(newick_trees.TreeCount(), 4);
+    CHECK_EQ(parse_through_pipe(newick_path,
+                                [&driver](const std::string& pipe) {
+                                  return driver.ParseNewickFile(pipe);
+                                }),
+             newick_trees);
+    const auto nexus_trees = driver.ParseNexusFile("data/DS1.subsampled_10.t");
+    for (const auto nexus_path :
+         {"data/DS1.subsampled_10.t", "data/DS1.subsampled_10.t.gz"}) {
+      CHECK_EQ(parse_through_pipe(nexus_path,
+                                  [&driver](const std::string& pipe) {
+                                    return driver.ParseNexusFile(pipe);
+                                  }),
+               nexus_trees);
+    }
+  }
+}
 #endif  // DOCTEST_LIBRARY_INCLUDED
 
 #endif  // SRC_DRIVER_HPP_
@@ -3,6 +3,7 @@
 
 #include "engine.hpp"
 
+#include <algorithm>
 #include <numeric>
 
 #include "beagle_flag_names.hpp"
@@ -25,6 +26,21 @@ Engine::Engine(const EngineSpecification &engine_specification,
         model_specification, site_pattern_, beagle_preference_flags,
         engine_specification.use_tip_states_));
   }
+  const size_t pattern_block_count =
+      std::min(engine_specification.thread_count_,
+               site_pattern_.PatternCount() / min_pattern_block_size_);
+  if (pattern_block_count > 1 &&
+      !(fat_beagles_[0]->GetBeagleFlags() & BEAGLE_FLAG_PROCESSOR_GPU)) {
+    for (size_t block = 0; block < pattern_block_count; block++) {
+      const size_t begin = site_pattern_.PatternCount() * block / pattern_block_count;
+      const size_t end =
+          site_pattern_.PatternCount() * (block + 1) / pattern_block_count;
+      pattern_block_fat_beagles_.push_back(std::make_unique<FatBeagle>(
+          model_specification, site_pattern_.Slice(begin, end),
+          beagle_preference_flags, engine_specification.use_tip_states_));
+    }
+  }
+  thread_pool_ = std::make_unique<ThreadPool>(engine_specification.thread_count_);
   if (!engine_specification.beagle_flag_vector_.empty()) {
     std::cout << "We asked BEAGLE for: "
               << BeagleFlagNames::OfBeagleFlags(beagle_preference_flags) << std::endl;
@@ -54,34 +70,33 @@ const BlockSpecification &Engine::GetPhyloModelBlockSpecification() const {
 std::vector<double> Engine::LogLikelihoods(
     const UnrootedTreeCollection &tree_collection,
     const EigenMatrixXdRef phylo_model_params, const bool rescaling) const {
-  return FatBeagleParallelize<double, UnrootedTree, UnrootedTreeCollection>(
-      FatBeagle::StaticUnrootedLogLikelihood, fat_beagles_, tree_collection,
-      phylo_model_params, rescaling);
+  return Parallelize<double, UnrootedTree, UnrootedTreeCollection>(
+      FatBeagle::StaticUnrootedLogLikelihood, tree_collection, phylo_model_params,
+      rescaling);
 }
 
 std::vector<double> Engine::LogLikelihoods(const RootedTreeCollection &tree_collection,
                                            const EigenMatrixXdRef phylo_model_params,
                                            const bool rescaling) const {
-  return FatBeagleParallelize<double, RootedTree, RootedTreeCollection>(
-      FatBeagle::StaticRootedLogLikelihood, fat_beagles_, tree_collection,
-      phylo_model_params, rescaling);
+  return Parallelize<double, RootedTree, RootedTreeCollection>(
+      FatBeagle::StaticRootedLogLikelihood, tree_collection, phylo_model_params,
+      rescaling);
 }
 
 std::vector<UnrootedPhyloGradient> Engine::Gradients(
     const UnrootedTreeCollection &tree_collection,
     const EigenMatrixXdRef phylo_model_params, const bool rescaling) const {
-  return FatBeagleParallelize<UnrootedPhyloGradient, UnrootedTree,
-                              UnrootedTreeCollection>(FatBeagle::StaticUnrootedGradient,
-                                                      fat_beagles_, tree_collection,
-                                                      phylo_model_params, rescaling);
+  return Parallelize<UnrootedPhyloGradient, UnrootedTree, UnrootedTreeCollection>(
+      FatBeagle::StaticUnrootedGradient, tree_collection, phylo_model_params,
+      rescaling);
 }
 
 std::vector<RootedPhyloGradient> Engine::Gradients(
     const RootedTreeCollection &tree_collection,
     const EigenMatrixXdRef phylo_model_params, const bool rescaling) const {
-  return FatBeagleParallelize<RootedPhyloGradient, RootedTree, RootedTreeCollection>(
-      FatBeagle::StaticRootedGradient, fat_beagles_, tree_collection,
-      phylo_model_params, rescaling);
+  return Parallelize<RootedPhyloGradient, RootedTree, RootedTreeCollection>(
+      FatBeagle::StaticRootedGradient, tree_collection, phylo_model_params,
+      rescaling);
 }
 
 const FatBeagle *const Engine::GetFirstFatBeagle() const {
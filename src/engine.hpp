@@ -43,11 +43,46 @@ class Engine {
       const RootedTreeCollection &tree_collection,
       const EigenMatrixXdRef phylo_model_params, const bool rescaling) const;
 
+  // The number of blocks into which we split the site patterns when there are fewer
+  // trees than threads, or 0 if we never split them.
+  size_t PatternBlockCount() const { return pattern_block_fat_beagles_.size(); }
+
  private:
   SitePattern site_pattern_;
+  // One FatBeagle per thread, each of which evaluates whole trees.
   std::vector<std::unique_ptr<FatBeagle>> fat_beagles_;
+  // One FatBeagle per block of consecutive site patterns. When there are fewer trees
+  // than threads, splitting the trees between the threads would leave some idle, so
+  // we split the patterns instead and add up the results over the blocks. This is
+  // empty if there is one thread, if there are too few patterns to be worth
+  // splitting, or if BEAGLE is running on a GPU (which parallelizes over patterns
+  // itself).
+  std::vector<std::unique_ptr<FatBeagle>> pattern_block_fat_beagles_;
+  // We don't split the patterns into blocks smaller than this.
+  static constexpr size_t min_pattern_block_size_ = 256;
+  // The threads stick around between calls, as the optimization loops call us many
+  // times on a few trees. This comes last so that the threads stop before the
+  // FatBeagles go away.
+  std::unique_ptr<ThreadPool> thread_pool_;
 
   const FatBeagle *const GetFirstFatBeagle() const;
+  bool UsePatternBlocks(size_t tree_count) const {
+    return !pattern_block_fat_beagles_.empty() && tree_count < fat_beagles_.size();
+  }
+  // Run f on the trees, splitting either the trees or the patterns between threads.
+  template <typename TOut, typename TTree, typename TTreeCollection>
+  std::vector<TOut> Parallelize(std::function<TOut(FatBeagle *, const TTree &)> f,
+                                const TTreeCollection &tree_collection,
+                                const EigenMatrixXdRef phylo_model_params,
+                                const bool rescaling) const {
+    if (UsePatternBlocks(tree_collection.TreeCount())) {
+      return FatBeaglePatternParallelize<TOut, TTree, TTreeCollection>(
+          f, pattern_block_fat_beagles_, *thread_pool_, tree_collection,
+          phylo_model_params, rescaling);
+    }  // else
+    return FatBeagleParallelize<TOut, TTree, TTreeCollection>(
+        f, fat_beagles_, *thread_pool_, tree_collection, phylo_model_params, rescaling);
+  }
 };
 
 #endif  // SRC_ENGINE_HPP_
@@ -44,17 +44,70 @@ void FatBeagle::SetParameters(const EigenVectorXdRef param_vector) {
   UpdatePhyloModelInBeagle();
 }
 
+void FatBeagle::SetRescaling(const bool rescaling) {
+  // The operations depend on whether we are rescaling, so switching invalidates
+  // the cached schedules.
+  if (rescaling != rescaling_) {
+    schedule_cache_.clear();
+  }
+  rescaling_ = rescaling;
+}
+
+FatBeagle::OperationSchedule::OperationSchedule(BeagleInstance beagle_instance,
+                                                bool rescaling,
+                                                const FlatTopology &topology)
+    : ba_(beagle_instance, rescaling, topology),
+      pre_buffer_indices_(BeagleAccessories::IotaVector(ba_.node_count_ - 1,
+                                                        ba_.node_count_)),
+      // The derivative matrix goes in the spare slot after the transition matrices.
+      derivative_matrix_indices_(ba_.node_count_ - 1, ba_.node_count_ - 1) {
+  AddLowerPartialOperations(lower_operations_, ba_, topology);
+  AddUpperPartialOperations(upper_operations_, ba_, topology);
+}
+
+const FatBeagle::OperationSchedule &FatBeagle::CachedSchedule(
+    const FlatTopology &key, const std::function<FlatTopology()> &make_topology) const {
+  auto search = schedule_cache_.find(key);
+  if (search != schedule_cache_.end()) {
+    return *search->second;
+  }  // else
+  if (schedule_cache_.size() >= schedule_cache_capacity_) {
+    schedule_cache_.clear();
+  }
+  auto schedule =
+      std::make_unique<const OperationSchedule>(beagle_instance_, rescaling_,
+                                                make_topology());
+  return *schedule_cache_.emplace(key, std::move(schedule)).first->second;
+}
+
+const FatBeagle::OperationSchedule &FatBeagle::ScheduleOf(
+    const UnrootedTree &tree) const {
+  return CachedSchedule(tree.Flat(), [&tree]() {
+    return FlatTopology(tree.Detrifurcate().Topology());
+  });
+}
+
+const FatBeagle::OperationSchedule &FatBeagle::ScheduleOf(
+    const RootedTree &tree) const {
+  return CachedSchedule(tree.Flat(), [&tree]() { return tree.Flat(); });
+}
+
+// The branch lengths of tree.Detrifurcate(), without building its topology.
+std::vector<double> DetrifurcatedBranchLengths(const UnrootedTree &tree) {
+  auto branch_lengths = tree.BranchLengths();
+  branch_lengths[tree.Id()] = 0.;
+  branch_lengths.push_back(0.);
+  return branch_lengths;
+}
+
 // This is the "core" of the likelihood calculation, assuming that the tree is
 // bifurcating.
 double FatBeagle::LogLikelihoodInternals(
-    const Node::NodePtr topology, const std::vector<double> &branch_lengths) const {
-  BeagleAccessories ba(beagle_instance_, rescaling_, topology);
-  BeagleOperationVector operations;
+    const OperationSchedule &schedule,
+    const std::vector<double> &branch_lengths) const {
+  const BeagleAccessories &ba = schedule.ba_;
+  const BeagleOperationVector &operations = schedule.lower_operations_;
   beagleResetScaleFactors(beagle_instance_, 0);
-  topology->BinaryIdPostOrder(
-      [&operations, &ba](int node_id, int child0_id, int child1_id) {
-        AddLowerPartialOperation(operations, ba, node_id, child0_id, child1_id);
-      });
   UpdateBeagleTransitionMatrices(ba, branch_lengths, nullptr);
   beagleUpdatePartials(beagle_instance_,
                        operations.data(),  // eigenIndex
@@ -69,9 +122,7 @@ double FatBeagle::LogLikelihoodInternals(
 }
 
 double FatBeagle::LogLikelihood(const UnrootedTree &tree) const {
-  auto detrifurcated_tree = tree.Detrifurcate();
-  return LogLikelihoodInternals(detrifurcated_tree.Topology(),
-                                detrifurcated_tree.BranchLengths());
+  return LogLikelihoodInternals(ScheduleOf(tree), DetrifurcatedBranchLengths(tree));
 }
 
 double FatBeagle::LogLikelihood(const RootedTree &tree) const {
@@ -79,7 +130,7 @@ double FatBeagle::LogLikelihood(const RootedTree &tree) const {
   for (size_t i = 0; i < tree.BranchLengths().size() - 1; i++) {
     branch_lengths[i] *= tree.rates_[i];
   }
-  return LogLikelihoodInternals(tree.Topology(), branch_lengths);
+  return LogLikelihoodInternals(ScheduleOf(tree), branch_lengths);
 }
 
 // Build differential matrix and scale it.
@@ -96,53 +147,39 @@ EigenMatrixXd BuildDifferentialMatrices(const SubstitutionModel &substitution_mo
 }
 
 std::pair<double, std::vector<double>> FatBeagle::BranchGradientInternals(
-    const Node::NodePtr topology, const std::vector<double> &branch_lengths,
+    const OperationSchedule &schedule, const std::vector<double> &branch_lengths,
     const EigenMatrixXd &dQ) const {
+  const BeagleAccessories &ba = schedule.ba_;
   beagleResetScaleFactors(beagle_instance_, 0);
-  BeagleAccessories ba(beagle_instance_, rescaling_, topology);
   UpdateBeagleTransitionMatrices(ba, branch_lengths, nullptr);
   SetRootPreorderPartialsToStateFrequencies(ba);
 
   // Set differential matrices.
-  int derivative_matrix_idx = ba.node_count_ - 1;
-  beagleSetDifferentialMatrix(beagle_instance_, derivative_matrix_idx, dQ.data());
-  const auto derivative_matrix_indices =
-      std::vector<int>(ba.node_count_ - 1, derivative_matrix_idx);
+  beagleSetDifferentialMatrix(beagle_instance_,
+                              schedule.derivative_matrix_indices_.front(), dQ.data());
 
   // Calculate post-order partials
-  BeagleOperationVector operations;
-  topology->BinaryIdPostOrder(
-      [&operations, &ba](int node_id, int child0_id, int child1_id) {
-        AddLowerPartialOperation(operations, ba, node_id, child0_id, child1_id);
-      });
-  beagleUpdatePartials(beagle_instance_, operations.data(),
-                       static_cast<int>(operations.size()),
+  beagleUpdatePartials(beagle_instance_, schedule.lower_operations_.data(),
+                       static_cast<int>(schedule.lower_operations_.size()),
                        ba.cumulative_scale_index_[0]);  // cumulative scale index
 
   // Calculate pre-order partials.
-  operations.clear();
-  topology->TripleIdPreOrderBifurcating(
-      [&operations, &ba](int node_id, int sister_id, int parent_id) {
-        AddUpperPartialOperation(operations, ba, node_id, sister_id, parent_id);
-      });
-  beagleUpdatePrePartials(beagle_instance_, operations.data(),
-                          static_cast<int>(operations.size()),
+  beagleUpdatePrePartials(beagle_instance_, schedule.upper_operations_.data(),
+                          static_cast<int>(schedule.upper_operations_.size()),
                           BEAGLE_OP_NONE);  // cumulative scale index
 
   // Actually compute the gradient.
   std::vector<double> gradient(ba.node_count_, 0.);
-  const auto pre_buffer_indices =
-      BeagleAccessories::IotaVector(ba.node_count_ - 1, ba.node_count_);
   beagleCalculateEdgeDerivatives(
       beagle_instance_,
-      ba.node_indices_.data(),           // list of post order buffer indices
-      pre_buffer_indices.data(),         // list of pre order buffer indices
-      derivative_matrix_indices.data(),  // differential Q matrix indices
-      ba.category_weight_index_.data(),  // category weights indices
-      ba.node_count_ - 1,                // number of edges
-      nullptr,                           // derivative-per-site output array
-      gradient.data(),                   // sum of derivatives across sites output array
-      nullptr);                          // sum of squared derivatives output array
+      ba.node_indices_.data(),                     // post order buffer indices
+      schedule.pre_buffer_indices_.data(),         // pre order buffer indices
+      schedule.derivative_matrix_indices_.data(),  // differential Q matrix indices
+      ba.category_weight_index_.data(),            // category weights indices
+      ba.node_count_ - 1,                          // number of edges
+      nullptr,                                     // derivative-per-site output array
+      gradient.data(),  // sum of derivatives across sites output array
+      nullptr);         // sum of squared derivatives output array
 
   // Also calculate the likelihood.
   double log_like = 0.;
@@ -334,6 +371,41 @@ void FatBeagle::AddUpperPartialOperation(BeagleOperationVector &operations,
       sister_id                    // matrices of sibling
   });
 }
+// Add the lower partial operations for every internal node, children first.
+void FatBeagle::AddLowerPartialOperations(BeagleOperationVector &operations,
+                                          const BeagleAccessories &ba,
+                                          const FlatTopology &topology) {
+  Assert(!topology.IsRootTrifurcating(), "FatBeagle expects a bifurcating tree.");
+  operations.reserve(operations.size() + ba.internal_count_);
+  for (const auto node_id : topology.PostOrder()) {
+    if (!topology.IsLeaf(node_id)) {
+      AddLowerPartialOperation(operations, ba, static_cast<int>(node_id),
+                               static_cast<int>(topology.Child0Id(node_id)),
+                               static_cast<int>(topology.Child1Id(node_id)));
+    }
+  }
+}
+
+// Add the upper partial operations for every non-root node. Visiting the parents
+// in preorder guarantees that the upper partial of a parent is computed before
+// those of its children.
+void FatBeagle::AddUpperPartialOperations(BeagleOperationVector &operations,
+                                          const BeagleAccessories &ba,
+                                          const FlatTopology &topology) {
+  Assert(!topology.IsRootTrifurcating(), "FatBeagle expects a bifurcating tree.");
+  operations.reserve(operations.size() + ba.node_count_ - 1);
+  for (const auto parent_id : topology.PreOrder()) {
+    if (!topology.IsLeaf(parent_id)) {
+      const auto child0_id = static_cast<int>(topology.Child0Id(parent_id));
+      const auto child1_id = static_cast<int>(topology.Child1Id(parent_id));
+      AddUpperPartialOperation(operations, ba, child0_id, child1_id,
+                               static_cast<int>(parent_id));
+      AddUpperPartialOperation(operations, ba, child1_id, child0_id,
+                               static_cast<int>(parent_id));
+    }
+  }
+}
+
 // Calculation of the substitution rate gradient.
 // \partial{L}/\partial{r_i} = \partial{L}/\partial{b_i} \partial{b_i}/\partial{r_i}
 // For strict clock:
@@ -372,13 +444,18 @@ std::vector<double> DiscreteSiteModelGradient(
 }
 
 UnrootedPhyloGradient FatBeagle::Gradient(const UnrootedTree &in_tree) const {
-  auto tree = in_tree.Detrifurcate();
-  tree.SlideRootPosition();
+  const auto &schedule = ScheduleOf(in_tree);
+  // Get the branch lengths of the detrifurcated tree, and then slide the root
+  // position as in Tree::SlideRootPosition.
+  auto branch_lengths = DetrifurcatedBranchLengths(in_tree);
+  const auto fixed_node_id = schedule.ba_.fixed_node_id_;
+  branch_lengths[schedule.ba_.root_child_id_] += branch_lengths[fixed_node_id];
+  branch_lengths[fixed_node_id] = 0.;
   EigenMatrixXd dQ =
       BuildDifferentialMatrices(*phylo_model_->GetSubstitutionModel(),
                                 phylo_model_->GetSiteModel()->GetCategoryRates());
   auto [log_likelihood, branch_length_gradient] =
-      BranchGradientInternals(tree.Topology(), tree.BranchLengths(), dQ);
+      BranchGradientInternals(schedule, branch_lengths, dQ);
 
   std::vector<double> substitution_model_gradient;
   std::vector<double> site_model_gradient;
@@ -390,19 +467,20 @@ UnrootedPhyloGradient FatBeagle::Gradient(const UnrootedTree &in_tree) const {
         BuildDifferentialMatrices(*phylo_model_->GetSubstitutionModel(),
                                   phylo_model_->GetSiteModel()->GetRateGradient());
     auto [log_likelihood, unscaled_category_gradient] =
-        BranchGradientInternals(tree.Topology(), tree.BranchLengths(), dQ);
+        BranchGradientInternals(schedule, branch_lengths, dQ);
     site_model_gradient =
-        DiscreteSiteModelGradient(tree.BranchLengths(), unscaled_category_gradient);
+        DiscreteSiteModelGradient(branch_lengths, unscaled_category_gradient);
   }
 
   // We want the fixed node to have a zero gradient.
-  branch_length_gradient[tree.Topology()->Children()[1]->Id()] = 0.;
+  branch_length_gradient[fixed_node_id] = 0.;
 
   return {log_likelihood, branch_length_gradient, site_model_gradient,
           substitution_model_gradient};
 }
 
 RootedPhyloGradient FatBeagle::Gradient(const RootedTree &tree) const {
+  const auto &schedule = ScheduleOf(tree);
   // Scale time with clock rate.
   std::vector<double> branch_lengths = tree.BranchLengths();
   for (size_t i = 0; i < tree.BranchLengths().size() - 1; i++) {
@@ -414,7 +492,7 @@ RootedPhyloGradient FatBeagle::Gradient(const RootedTree &tree) const {
       BuildDifferentialMatrices(*phylo_model_->GetSubstitutionModel(),
                                 phylo_model_->GetSiteModel()->GetCategoryRates());
   auto [log_likelihood, branch_gradient] =
-      BranchGradientInternals(tree.Topology(), branch_lengths, dQ);
+      BranchGradientInternals(schedule, branch_lengths, dQ);
 
   std::vector<double> substitution_model_gradient;
   // Calculate substitution model parameter gradient, if needed.
@@ -430,15 +508,20 @@ RootedPhyloGradient FatBeagle::Gradient(const RootedTree &tree) const {
         BuildDifferentialMatrices(*phylo_model_->GetSubstitutionModel(),
                                   phylo_model_->GetSiteModel()->GetRateGradient());
     auto [log_likelihood, unscaled_category_gradient] =
-        BranchGradientInternals(tree.Topology(), branch_lengths, dQ);
+        BranchGradientInternals(schedule, branch_lengths, dQ);
     site_model_gradient =
         DiscreteSiteModelGradient(branch_lengths, unscaled_category_gradient);
   }
 
-  return {log_likelihood,
-          branch_gradient,
-          RatioGradientOfBranchGradient(tree, branch_gradient),
-          ClockGradient(tree, branch_gradient),
-          site_model_gradient,
-          substitution_model_gradient};
+  RootedPhyloGradient gradient(log_likelihood, branch_gradient, {}, {},
+                               site_model_gradient, substitution_model_gradient);
+  SetRatioAndClockGradients(tree, &gradient);
+  return gradient;
+}
+
+void FatBeagle::SetRatioAndClockGradients(const RootedTree &tree,
+                                          RootedPhyloGradient *gradient) {
+  gradient->ratios_root_height_ =
+      RatioGradientOfBranchGradient(tree, gradient->branch_lengths_);
+  gradient->clock_model_ = ClockGradient(tree, gradient->branch_lengths_);
 }
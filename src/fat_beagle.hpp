@@ -5,7 +5,7 @@
 #define SRC_FAT_BEAGLE_HPP_
 
 #include <memory>
-#include <queue>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -13,7 +13,7 @@
 #include "phylo_model.hpp"
 #include "rooted_tree_collection.hpp"
 #include "site_pattern.hpp"
-#include "task_processor.hpp"
+#include "thread_pool.hpp"
 #include "tree_gradient.hpp"
 #include "unrooted_tree_collection.hpp"
 
@@ -37,7 +37,7 @@ class FatBeagle {
   const PackedBeagleFlags &GetBeagleFlags() const { return beagle_flags_; };
 
   void SetParameters(const EigenVectorXdRef param_vector);
-  void SetRescaling(const bool rescaling) { rescaling_ = rescaling; }
+  void SetRescaling(const bool rescaling);
 
   double LogLikelihood(const UnrootedTree &tree) const;
   double LogLikelihood(const RootedTree &tree) const;
@@ -45,6 +45,10 @@ class FatBeagle {
   // length, as a vector of first derivatives indexed by node id.
   UnrootedPhyloGradient Gradient(const UnrootedTree &tree) const;
   RootedPhyloGradient Gradient(const RootedTree &tree) const;
+  // Compute the ratio and root height gradient and the clock gradient of a rooted
+  // gradient from its branch length gradient.
+  static void SetRatioAndClockGradients(const RootedTree &tree,
+                                        RootedPhyloGradient *gradient);
 
   // We can pass these static methods to FatBeagleParallelize.
   static double StaticUnrootedLogLikelihood(FatBeagle *fat_beagle,
@@ -60,12 +64,35 @@ class FatBeagle {
   using BeagleInstance = int;
   using BeagleOperationVector = std::vector<BeagleOperation>;
 
+  // Everything about a likelihood or gradient computation that depends only on
+  // the topology (and on rescaling_): the accessories and the operation lists. We
+  // cache these, so evaluating a topology that we have seen before just uploads the
+  // branch lengths and replays the stored operations.
+  struct OperationSchedule {
+    OperationSchedule(BeagleInstance beagle_instance, bool rescaling,
+                      const FlatTopology &topology);
+
+    BeagleAccessories ba_;
+    BeagleOperationVector lower_operations_;
+    BeagleOperationVector upper_operations_;
+    // The pre-order partial buffers and derivative matrices used for the gradient.
+    std::vector<int> pre_buffer_indices_;
+    std::vector<int> derivative_matrix_indices_;
+  };
+  using OperationScheduleCache =
+      std::unordered_map<FlatTopology, std::unique_ptr<const OperationSchedule>>;
+  // We clear the cache rather than let it grow past this many schedules.
+  static constexpr size_t schedule_cache_capacity_ = 4096;
+
   std::unique_ptr<PhyloModel> phylo_model_;
   bool rescaling_;
   BeagleInstance beagle_instance_;
   PackedBeagleFlags beagle_flags_;
   int pattern_count_;
   bool use_tip_states_;
+  // Each FatBeagle is only used by one thread at a time, so this cache doesn't
+  // need a lock.
+  mutable OperationScheduleCache schedule_cache_;
 
   std::pair<BeagleInstance, PackedBeagleFlags> CreateInstance(
       const SitePattern &site_pattern, PackedBeagleFlags beagle_preference_flags);
@@ -75,10 +102,19 @@ class FatBeagle {
   void UpdateSubstitutionModelInBeagle();
   void UpdatePhyloModelInBeagle();
 
-  double LogLikelihoodInternals(const Node::NodePtr topology,
+  // Get the schedule for the topology key from the cache, building it using the
+  // bifurcating topology made by make_topology if it isn't there.
+  const OperationSchedule &CachedSchedule(
+      const FlatTopology &key,
+      const std::function<FlatTopology()> &make_topology) const;
+  // Unrooted trees get the schedule of their detrifurcated version.
+  const OperationSchedule &ScheduleOf(const UnrootedTree &tree) const;
+  const OperationSchedule &ScheduleOf(const RootedTree &tree) const;
+
+  double LogLikelihoodInternals(const OperationSchedule &schedule,
                                 const std::vector<double> &branch_lengths) const;
   std::pair<double, std::vector<double>> BranchGradientInternals(
-      const Node::NodePtr topology, const std::vector<double> &branch_lengths,
+      const OperationSchedule &schedule, const std::vector<double> &branch_lengths,
       const EigenMatrixXd &dQ) const;
 
   void UpdateBeagleTransitionMatrices(
@@ -93,36 +129,41 @@ class FatBeagle {
   static inline void AddUpperPartialOperation(BeagleOperationVector &operations,
                                               const BeagleAccessories &ba, int node_id,
                                               int sister_id, int parent_id);
+  static void AddLowerPartialOperations(BeagleOperationVector &operations,
+                                        const BeagleAccessories &ba,
+                                        const FlatTopology &topology);
+  static void AddUpperPartialOperations(BeagleOperationVector &operations,
+                                        const BeagleAccessories &ba,
+                                        const FlatTopology &topology);
   static inline std::pair<double, double> ComputeGradientEntry(
       BeagleAccessories &ba, const SizeVectorVector &indices_above, int node_id,
       int sister_id);
 };
 
+// Evaluate f on each tree on the threads of the pool, with thread i using the ith
+// FatBeagle, so there must be a FatBeagle for each thread.
 template <typename TOut, typename TTree, typename TTreeCollection>
 std::vector<TOut> FatBeagleParallelize(
     std::function<TOut(FatBeagle *, const TTree &)> f,
-    const std::vector<std::unique_ptr<FatBeagle>> &fat_beagles,
+    const std::vector<std::unique_ptr<FatBeagle>> &fat_beagles, ThreadPool &thread_pool,
     const TTreeCollection &tree_collection, EigenMatrixXdRef param_matrix,
     const bool rescaling) {
   if (fat_beagles.empty()) {
     Failwith("Please add some FatBeagles that can be used for computation.");
   }
-  std::vector<TOut> results(tree_collection.TreeCount());
-  std::queue<FatBeagle *> fat_beagle_queue;
   for (const auto &fat_beagle : fat_beagles) {
     Assert(fat_beagle != nullptr, "Got a fat_beagle nullptr!");
-    fat_beagle_queue.push(fat_beagle.get());
-  }
-  std::queue<size_t> tree_number_queue;
-  for (size_t i = 0; i < tree_collection.TreeCount(); i++) {
-    tree_number_queue.push(i);
   }
+  Assert(fat_beagles.size() >= thread_pool.ThreadCount(),
+         "We need a FatBeagle for each thread of the pool.");
   Assert(tree_collection.TreeCount() == param_matrix.rows(),
          "We param_matrix needs as many rows as we have trees.");
-  TaskProcessor<FatBeagle *, size_t> task_processor(
-      std::move(fat_beagle_queue), std::move(tree_number_queue),
-      [&results, &tree_collection, &param_matrix, &rescaling, &f](FatBeagle *fat_beagle,
-                                                                  size_t tree_number) {
+  std::vector<TOut> results(tree_collection.TreeCount());
+  thread_pool.ParallelFor(
+      tree_collection.TreeCount(),
+      [&results, &fat_beagles, &tree_collection, &param_matrix, &rescaling, &f](
+          size_t thread_index, size_t tree_number) {
+        FatBeagle *fat_beagle = fat_beagles[thread_index].get();
         fat_beagle->SetParameters(param_matrix.row(tree_number));
         fat_beagle->SetRescaling(rescaling);
         results[tree_number] = f(fat_beagle, tree_collection.GetTree(tree_number));
@@ -130,5 +171,54 @@ std::vector<TOut> FatBeagleParallelize(
   return results;
 }
 
+// After adding up a result over the blocks of site patterns, fill in the parts of it
+// that aren't sums over sites.
+template <typename TOut, typename TTree>
+void FinishPatternBlockSum(const TTree &, TOut *) {}
+inline void FinishPatternBlockSum(const RootedTree &tree,
+                                  RootedPhyloGradient *gradient) {
+  FatBeagle::SetRatioAndClockGradients(tree, gradient);
+}
+
+// Like FatBeagleParallelize, but for FatBeagles that each have their own block of the
+// site patterns: each FatBeagle gets a thread of the pool on which it evaluates f on
+// all of the trees for its block. Then we add up the results for each tree over the
+// blocks, in block order, so the sums don't depend on the thread timing.
+template <typename TOut, typename TTree, typename TTreeCollection>
+std::vector<TOut> FatBeaglePatternParallelize(
+    std::function<TOut(FatBeagle *, const TTree &)> f,
+    const std::vector<std::unique_ptr<FatBeagle>> &pattern_block_fat_beagles,
+    ThreadPool &thread_pool, const TTreeCollection &tree_collection,
+    EigenMatrixXdRef param_matrix, const bool rescaling) {
+  if (pattern_block_fat_beagles.empty()) {
+    Failwith("Please add some FatBeagles that can be used for computation.");
+  }
+  Assert(tree_collection.TreeCount() == param_matrix.rows(),
+         "The param_matrix needs as many rows as we have trees.");
+  const size_t block_count = pattern_block_fat_beagles.size();
+  std::vector<std::vector<TOut>> block_results(block_count);
+  thread_pool.ParallelFor(
+      block_count, [&block_results, &pattern_block_fat_beagles, &tree_collection,
+                    &param_matrix, &rescaling, &f](size_t, size_t block) {
+        FatBeagle *fat_beagle = pattern_block_fat_beagles[block].get();
+        auto &results = block_results[block];
+        results.reserve(tree_collection.TreeCount());
+        for (size_t tree_number = 0; tree_number < tree_collection.TreeCount();
+             tree_number++) {
+          fat_beagle->SetParameters(param_matrix.row(tree_number));
+          fat_beagle->SetRescaling(rescaling);
+          results.push_back(f(fat_beagle, tree_collection.GetTree(tree_number)));
+        }
+      });
+  std::vector<TOut> results = std::move(block_results[0]);
+  for (size_t tree_number = 0; tree_number < results.size(); tree_number++) {
+    for (size_t block = 1; block < block_count; block++) {
+      results[tree_number] += block_results[block][tree_number];
+    }
+    FinishPatternBlockSum(tree_collection.GetTree(tree_number), &results[tree_number]);
+  }
+  return results;
+}
+
 // Tests live in rooted_sbn_instance.hpp and unrooted_sbn_instance.hpp.
 #endif  // SRC_FAT_BEAGLE_HPP_
@@ -0,0 +1,298 @@
+// Copyright 2019-2020 libsbn project contributors.
+// libsbn is free software under the GPLv3; see LICENSE file for details.
+//
+// A bitset whose storage is a compile-time number of 64-bit words.
+//
+// The number of taxa is fixed for a whole run, so once we know it we can pick a
+// FixedBitset<WordCount> big enough to hold our (sub)splits and PCSP parents. All of
+// the loops below then have compile-time bounds, so the compiler can unroll and
+// vectorize them, and there is no heap storage at all. The bits are laid out
+// exactly as in Bitset (most significant bit first within each word), so converting
+// between the two is a copy of words, and the hash of a FixedBitset is the same as
+// that of the corresponding Bitset.
+//
+// DispatchOnBitCount picks the specialization at runtime: it calls a function with
+// the smallest supported word count that holds a given number of bits, or calls a
+// fallback for larger sizes, which can use the dynamic Bitset.
+
+#ifndef SRC_FIXED_BITSET_HPP_
+#define SRC_FIXED_BITSET_HPP_
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <type_traits>
+
+#include "bitset.hpp"
+#include "sugar.hpp"
+
+template <size_t WordCount>
+class FixedBitset {
+ public:
+  using Word = Bitset::Word;
+  static constexpr size_t BitsPerWord = Bitset::BitsPerWord;
+  static constexpr size_t Capacity = WordCount * BitsPerWord;
+
+  constexpr FixedBitset() = default;
+  explicit constexpr FixedBitset(size_t n) : size_(n) {}
+
+  static FixedBitset Of(const Bitset &bitset) {
+    Assert(bitset.size() <= Capacity, "Bitset too big for FixedBitset::Of.");
+    FixedBitset result(bitset.size());
+    const Word *words = bitset.Words();
+    for (size_t k = 0; k < bitset.WordCount(); k++) {
+      result.words_[k] = words[k];
+    }
+    return result;
+  }
+
+  Bitset ToBitset() const {
+    Bitset result(size_);
+    Word *words = result.MutableWords();
+    for (size_t k = 0; k < result.WordCount(); k++) {
+      words[k] = words_[k];
+    }
+    return result;
+  }
+
+  constexpr size_t size() const { return size_; }
+  constexpr bool operator[](size_t i) const {
+    return (words_[i / BitsPerWord] & BitMask(i)) != 0;
+  }
+  constexpr void set(size_t i, bool value = true) {
+    if (value) {
+      words_[i / BitsPerWord] |= BitMask(i);
+    } else {
+      words_[i / BitsPerWord] &= ~BitMask(i);
+    }
+  }
+
+  constexpr bool operator==(const FixedBitset &other) const {
+    if (size_ != other.size_) {
+      return false;
+    }
+    for (size_t k = 0; k < WordCount; k++) {
+      if (words_[k] != other.words_[k]) {
+        return false;
+      }
+    }
+    return true;
+  }
+  constexpr bool operator!=(const FixedBitset &other) const {
+    return !(*this == other);
+  }
+  // Lexicographic order, for bitsets of the same size (as in Bitset, which see).
+  constexpr bool operator<(const FixedBitset &other) const {
+    for (size_t k = 0; k < WordCount; k++) {
+      if (words_[k] != other.words_[k]) {
+        return words_[k] < other.words_[k];
+      }
+    }
+    return size_ < other.size_;
+  }
+
+  constexpr FixedBitset operator&(const FixedBitset &other) const {
+    FixedBitset result(*this);
+    for (size_t k = 0; k < WordCount; k++) {
+      result.words_[k] &= other.words_[k];
+    }
+    return result;
+  }
+  constexpr FixedBitset operator|(const FixedBitset &other) const {
+    FixedBitset result(*this);
+    for (size_t k = 0; k < WordCount; k++) {
+      result.words_[k] |= other.words_[k];
+    }
+    return result;
+  }
+  constexpr FixedBitset operator~() const {
+    FixedBitset result(*this);
+    result.flip();
+    return result;
+  }
+
+  constexpr void flip() {
+    for (size_t k = 0; k < WordCount; k++) {
+      words_[k] = ~words_[k];
+    }
+    ClearPadding();
+  }
+  constexpr void Minorize() {
+    if ((*this)[0]) {
+      flip();
+    }
+  }
+  size_t Hash() const {
+    return Bitset::HashWords(words_.data(), Bitset::WordCountOf(size_), size_);
+  }
+  std::optional<uint32_t> SingletonOption() const {
+    return ToBitset().SingletonOption();
+  }
+
+  // Copy all of the bits from another bitset into this bitset, starting at begin, and
+  // optionally flipping the bits as they get copied.
+  constexpr void CopyFrom(const FixedBitset &other, size_t begin, bool flip) {
+    for (size_t k = 0; k < WordCount && k * BitsPerWord < other.size_; k++) {
+      const size_t bit_count = std::min(BitsPerWord, other.size_ - k * BitsPerWord);
+      const Word mask = ~Word(0) << (BitsPerWord - bit_count);
+      const Word source = (flip ? ~other.words_[k] : other.words_[k]) & mask;
+      const size_t position = begin + k * BitsPerWord;
+      const size_t word_index = position / BitsPerWord;
+      const size_t offset = position % BitsPerWord;
+      words_[word_index] =
+          (words_[word_index] & ~(mask >> offset)) | (source >> offset);
+      if (offset > 0 && bit_count > BitsPerWord - offset) {
+        const size_t shift = BitsPerWord - offset;
+        words_[word_index + 1] =
+            (words_[word_index + 1] & ~(mask << shift)) | (source << shift);
+      }
+    }
+  }
+
+  // Make a new bitset out of the bits in [begin, begin + length).
+  constexpr FixedBitset Slice(size_t begin, size_t length) const {
+    FixedBitset result(length);
+    for (size_t k = 0; k < WordCount && k * BitsPerWord < length; k++) {
+      result.words_[k] = WordAt(begin + k * BitsPerWord);
+    }
+    result.ClearPadding();
+    return result;
+  }
+
+  // The subsplit and PCSP chunk operations, as in Bitset.
+  constexpr FixedBitset SplitChunk(size_t i) const {
+    const size_t chunk_size = size_ / 2;
+    return Slice(i * chunk_size, chunk_size);
+  }
+  constexpr FixedBitset RotateSubsplit() const {
+    const size_t chunk_size = size_ / 2;
+    FixedBitset result(size_);
+    result.CopyFrom(SplitChunk(1), 0, false);
+    result.CopyFrom(SplitChunk(0), chunk_size, false);
+    return result;
+  }
+  constexpr FixedBitset PCSPChunk(size_t i) const {
+    const size_t chunk_size = size_ / 3;
+    return Slice(i * chunk_size, chunk_size);
+  }
+
+ private:
+  std::array<Word, WordCount> words_ = {};
+  size_t size_ = 0;
+
+  static constexpr Word BitMask(size_t i) {
+    return Word(1) << (BitsPerWord - 1 - i % BitsPerWord);
+  }
+  constexpr void ClearPadding() {
+    for (size_t k = 0; k < WordCount; k++) {
+      const size_t begin = k * BitsPerWord;
+      if (begin >= size_) {
+        words_[k] = 0;
+      } else if (size_ - begin < BitsPerWord) {
+        words_[k] &= ~Word(0) << (BitsPerWord - (size_ - begin));
+      }
+    }
+  }
+  // The word starting at bit position begin, zero-padded past the end.
+  constexpr Word WordAt(size_t begin) const {
+    const size_t word_index = begin / BitsPerWord;
+    const size_t offset = begin % BitsPerWord;
+    if (word_index >= WordCount) {
+      return Word(0);
+    }
+    Word result = words_[word_index] << offset;
+    if (offset > 0 && word_index + 1 < WordCount) {
+      result |= words_[word_index + 1] >> (BitsPerWord - offset);
+    }
+    return result;
+  }
+};
+
+namespace std {
+template <size_t WordCount>
+struct hash<FixedBitset<WordCount>> {
+  size_t operator()(const FixedBitset<WordCount> &x) const { return x.Hash(); }
+};
+}  // namespace std
+
+// Call fixed_function with a std::integral_constant holding the smallest word count
+// among 1, 2, 4, and 8 such that FixedBitset of that word count holds bit_count bits.
+// If bit_count is bigger than that, call dynamic_function instead.
+template <class FixedFunction, class DynamicFunction>
+auto DispatchOnBitCount(size_t bit_count, FixedFunction &&fixed_function,
+                        DynamicFunction &&dynamic_function) {
+  constexpr size_t bits_per_word = Bitset::BitsPerWord;
+  if (bit_count <= 1 * bits_per_word) {
+    return fixed_function(std::integral_constant<size_t, 1>{});
+  }  // else
+  if (bit_count <= 2 * bits_per_word) {
+    return fixed_function(std::integral_constant<size_t, 2>{});
+  }  // else
+  if (bit_count <= 4 * bits_per_word) {
+    return fixed_function(std::integral_constant<size_t, 4>{});
+  }  // else
+  if (bit_count <= 8 * bits_per_word) {
+    return fixed_function(std::integral_constant<size_t, 8>{});
+  }  // else
+  return dynamic_function();
+}
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+template <size_t WordCount>
+void CheckFixedBitsetAgainstBitset(size_t n) {
+  std::vector<bool> x(n), y(n);
+  for (size_t i = 0; i < n; i++) {
+    x[i] = (i * 7 + 3) % 5 < 2;
+    y[i] = (i * 11 + 1) % 3 == 0;
+  }
+  const Bitset a(x);
+  const Bitset b(y);
+  const auto fixed_a = FixedBitset<WordCount>::Of(a);
+  const auto fixed_b = FixedBitset<WordCount>::Of(b);
+  CHECK_EQ(fixed_a.ToBitset(), a);
+  CHECK_EQ(fixed_a.Hash(), a.Hash());
+  CHECK_EQ((fixed_a | fixed_b).ToBitset(), a | b);
+  CHECK_EQ((fixed_a & fixed_b).ToBitset(), a & b);
+  CHECK_EQ((~fixed_a).ToBitset(), ~a);
+  CHECK_EQ(fixed_a < fixed_b, a < b);
+  CHECK_EQ(fixed_b < fixed_a, b < a);
+  if (n % 2 == 0) {
+    CHECK_EQ(fixed_a.SplitChunk(0).ToBitset(), a.SplitChunk(0));
+    CHECK_EQ(fixed_a.SplitChunk(1).ToBitset(), a.SplitChunk(1));
+    CHECK_EQ(fixed_a.RotateSubsplit().ToBitset(), a.RotateSubsplit());
+  }
+  if (n % 3 == 0) {
+    for (size_t i = 0; i < 3; i++) {
+      CHECK_EQ(fixed_a.PCSPChunk(i).ToBitset(), a.PCSPChunk(i));
+    }
+  }
+  auto copy = fixed_a;
+  copy.CopyFrom(fixed_b.Slice(0, n / 2), n / 3, true);
+  auto bitset_copy = a;
+  bitset_copy.CopyFrom(Bitset(b.ToString().substr(0, n / 2)), n / 3, true);
+  CHECK_EQ(copy.ToBitset(), bitset_copy);
+}
+
+TEST_CASE("FixedBitset") {
+  CheckFixedBitsetAgainstBitset<1>(6);
+  CheckFixedBitsetAgainstBitset<1>(64);
+  CheckFixedBitsetAgainstBitset<2>(78);
+  CheckFixedBitsetAgainstBitset<4>(162);
+  CheckFixedBitsetAgainstBitset<8>(510);
+  CHECK_EQ(FixedBitset<1>::Of(Bitset("000100")).SingletonOption(), 3);
+
+  auto word_count_of = [](size_t bit_count) {
+    return DispatchOnBitCount(
+        bit_count, [](auto word_count) { return decltype(word_count)::value; },
+        []() { return size_t(0); });
+  };
+  CHECK_EQ(word_count_of(54), 1);
+  CHECK_EQ(word_count_of(65), 2);
+  CHECK_EQ(word_count_of(200), 4);
+  CHECK_EQ(word_count_of(512), 8);
+  CHECK_EQ(word_count_of(513), 0);
+}
+#endif  // DOCTEST_LIBRARY_INCLUDED
+
+#endif  // SRC_FIXED_BITSET_HPP_
@@ -0,0 +1,309 @@
+// Copyright 2019-2020 libsbn project contributors.
+// libsbn is free software under the GPLv3; see LICENSE file for details.
+//
+// A cache-friendly hash map for our indexers.
+//
+// The (key, value) entries are stored contiguously in a vector in insertion order,
+// and a separate open-addressing table of slots (linear probing) maps hashes to
+// positions in that vector. Each slot is just two 32-bit integers: the entry
+// position and a fragment of the hash, so probing rarely has to look at a key at
+// all, and iteration is a linear scan over densely packed entries in a
+// deterministic order. Compared to std::unordered_map this avoids one heap
+// allocation per entry, which matters for our indexers as they are built once and
+// then looked up many times in inner loops.
+//
+// The interface follows std::unordered_map for the parts we use. Differences:
+// * the value_type is std::pair<Key, T> rather than std::pair<const Key, T>, so
+// don't modify keys through an iterator;
+// * iterators and references are invalidated by any insertion or erasure;
+// * erase moves the last entry into the erased position.
+
+#ifndef SRC_FLAT_HASH_MAP_HPP_
+#define SRC_FLAT_HASH_MAP_HPP_
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "sugar.hpp"
+
+template <class Key, class T, class Hash = std::hash<Key>,
+          class KeyEqual = std::equal_to<Key>>
+class FlatHashMap {
+ public:
+  using key_type = Key;
+  using mapped_type = T;
+  using value_type = std::pair<Key, T>;
+  using iterator = typename std::vector<value_type>::iterator;
+  using const_iterator = typename std::vector<value_type>::const_iterator;
+
+  FlatHashMap() = default;
+  FlatHashMap(std::initializer_list<value_type> init) {
+    reserve(init.size());
+    for (const auto &entry : init) {
+      insert(entry);
+    }
+  }
+
+  size_t size() const { return entries_.size(); }
+  bool empty() const { return entries_.empty(); }
+  iterator begin() { return entries_.begin(); }
+  iterator end() { return entries_.end(); }
+  const_iterator begin() const { return entries_.begin(); }
+  const_iterator end() const { return entries_.end(); }
+  const_iterator cbegin() const { return entries_.cbegin(); }
+  const_iterator cend() const { return entries_.cend(); }
+
+  void clear() {
+    entries_.clear();
+    slots_.clear();
+  }
+
+  // Make room for entry_count entries without rehashing.
+  void reserve(size_t entry_count) {
+    entries_.reserve(entry_count);
+    if (SlotCountFor(entry_count) > slots_.size()) {
+      Rehash(SlotCountFor(entry_count));
+    }
+  }
+
+  iterator find(const Key &key) {
+    const size_t slot_idx = FindSlot(key, HashOf(key));
+    return slots_.empty() || slots_[slot_idx].IsEmpty()
+               ? entries_.end()
+               : entries_.begin() + slots_[slot_idx].entry_idx;
+  }
+  const_iterator find(const Key &key) const {
+    const size_t slot_idx = FindSlot(key, HashOf(key));
+    return slots_.empty() || slots_[slot_idx].IsEmpty()
+               ? entries_.cend()
+               : entries_.cbegin() + slots_[slot_idx].entry_idx;
+  }
+  size_t count(const Key &key) const { return find(key) == end() ? 0 : 1; }
+  bool contains(const Key &key) const { return find(key) != end(); }
+
+  T &at(const Key &key) {
+    auto search = find(key);
+    Assert(search != end(), "Key not found in FlatHashMap::at.");
+    return search->second;
+  }
+  const T &at(const Key &key) const {
+    auto search = find(key);
+    Assert(search != end(), "Key not found in FlatHashMap::at.");
+    return search->second;
+  }
+
+  T &operator[](const Key &key) { return try_emplace(key).first->second; }
+
+  std::pair<iterator, bool> insert(const value_type &entry) {
+    return try_emplace(entry.first, entry.second);
+  }
+  std::pair<iterator, bool> insert(value_type &&entry) {
+    return try_emplace(std::move(entry.first), std::move(entry.second));
+  }
+  template <class... Args>
+  std::pair<iterator, bool> emplace(Args &&... args) {
+    return insert(value_type(std::forward<Args>(args)...));
+  }
+
+  template <class K, class... Args>
+  std::pair<iterator, bool> try_emplace(K &&key, Args &&... args) {
+    if (SlotCountFor(entries_.size() + 1) > slots_.size()) {
+      Rehash(std::max(SlotCountFor(entries_.size() + 1), 2 * slots_.size()));
+    }
+    const uint64_t hash = HashOf(key);
+    const size_t slot_idx = FindSlot(key, hash);
+    Slot &slot = slots_[slot_idx];
+    if (!slot.IsEmpty()) {
+      return {entries_.begin() + slot.entry_idx, false};
+    }
+    slot.entry_idx = static_cast<uint32_t>(entries_.size());
+    slot.hash_fragment = Fragment(hash);
+    entries_.emplace_back(std::piecewise_construct,
+                          std::forward_as_tuple(std::forward<K>(key)),
+                          std::forward_as_tuple(std::forward<Args>(args)...));
+    return {entries_.end() - 1, true};
+  }
+
+  size_t erase(const Key &key) {
+    if (slots_.empty()) {
+      return 0;
+    }
+    size_t slot_idx = FindSlot(key, HashOf(key));
+    if (slots_[slot_idx].IsEmpty()) {
+      return 0;
+    }
+    const uint32_t entry_idx = slots_[slot_idx].entry_idx;
+    RemoveSlot(slot_idx);
+    // Move the last entry into the hole, and repoint its slot.
+    const uint32_t last_idx = static_cast<uint32_t>(entries_.size() - 1);
+    if (entry_idx != last_idx) {
+      const size_t last_slot_idx = FindSlot(entries_[last_idx].first,
+                                            HashOf(entries_[last_idx].first));
+      slots_[last_slot_idx].entry_idx = entry_idx;
+      entries_[entry_idx] = std::move(entries_[last_idx]);
+    }
+    entries_.pop_back();
+    return 1;
+  }
+
+  bool operator==(const FlatHashMap &other) const {
+    if (size() != other.size()) {
+      return false;
+    }
+    for (const auto &[key, value] : entries_) {
+      auto search = other.find(key);
+      if (search == other.end() || !(search->second == value)) {
+        return false;
+      }
+    }
+    return true;
+  }
+  bool operator!=(const FlatHashMap &other) const { return !(*this == other); }
+
+ private:
+  struct Slot {
+    static constexpr uint32_t empty_ = UINT32_MAX;
+    uint32_t entry_idx = empty_;
+    uint32_t hash_fragment = 0;
+    bool IsEmpty() const { return entry_idx == empty_; }
+  };
+
+  std::vector<value_type> entries_;
+  // The slot table, whose size is always zero or a power of two.
+  std::vector<Slot> slots_;
+
+  // Keep the load factor at most 1/2 to keep probe sequences short.
+  static size_t SlotCountFor(size_t entry_count) {
+    size_t slot_count = 8;
+    while (slot_count < 2 * entry_count) {
+      slot_count *= 2;
+    }
+    return slot_count;
+  }
+
+  // Run the hash through a multiplicative (Fibonacci) finalizer, because we take
+  // the low bits for the slot position and some std::hash implementations, such as
+  // that for integers, are the identity.
+  static uint64_t HashOf(const Key &key) {
+    const uint64_t product = static_cast<uint64_t>(Hash{}(key)) * 0x9e3779b97f4a7c15ULL;
+    return product ^ (product >> 32);
+  }
+  static uint32_t Fragment(uint64_t hash) { return static_cast<uint32_t>(hash >> 32); }
+  size_t Mask() const { return slots_.size() - 1; }
+
+  // Find the slot holding key, or the empty slot where it would go.
+  // Requires a nonempty slot table, except that it returns 0 for an empty one.
+  size_t FindSlot(const Key &key, uint64_t hash) const {
+    if (slots_.empty()) {
+      return 0;
+    }
+    const uint32_t fragment = Fragment(hash);
+    for (size_t slot_idx = hash & Mask();; slot_idx = (slot_idx + 1) & Mask()) {
+      const Slot &slot = slots_[slot_idx];
+      if (slot.IsEmpty() || (slot.hash_fragment == fragment &&
+                             KeyEqual{}(entries_[slot.entry_idx].first, key))) {
+        return slot_idx;
+      }
+    }
+  }
+
+  void Rehash(size_t slot_count) {
+    slots_.assign(slot_count, Slot());
+    for (size_t entry_idx = 0; entry_idx < entries_.size(); entry_idx++) {
+      const uint64_t hash = HashOf(entries_[entry_idx].first);
+      size_t slot_idx = hash & Mask();
+      while (!slots_[slot_idx].IsEmpty()) {
+        slot_idx = (slot_idx + 1) & Mask();
+      }
+      slots_[slot_idx].entry_idx = static_cast<uint32_t>(entry_idx);
+      slots_[slot_idx].hash_fragment = Fragment(hash);
+    }
+  }
+
+  // Empty a slot using backward-shift deletion, so that no tombstones are needed.
+  void RemoveSlot(size_t hole) {
+    for (size_t slot_idx = (hole + 1) & Mask(); !slots_[slot_idx].IsEmpty();
+         slot_idx = (slot_idx + 1) & Mask()) {
+      const size_t home =
+          HashOf(entries_[slots_[slot_idx].entry_idx].first) & Mask();
+      // Move this slot into the hole if its home position isn't cyclically in
+      // (hole, slot_idx].
+      if (((slot_idx - home) & Mask()) >= ((slot_idx - hole) & Mask())) {
+        slots_[hole] = slots_[slot_idx];
+        hole = slot_idx;
+      }
+    }
+    slots_[hole] = Slot();
+  }
+};
+
+template <class Key, class T, class Hash, class KeyEqual>
+void SafeInsert(FlatHashMap<Key, T, Hash, KeyEqual> &map, const Key &k, const T &v) {
+  Assert(map.insert({k, v}).second, "Failed map insertion!");
+}
+template <class Key, class T, class Hash, class KeyEqual>
+void SafeInsert(FlatHashMap<Key, T, Hash, KeyEqual> &map, Key &&k, T &&v) {
+  Assert(map.insert({std::move(k), std::move(v)}).second, "Failed map insertion!");
+}
+template <class Key, class T, class Hash, class KeyEqual>
+T AtWithDefault(const FlatHashMap<Key, T, Hash, KeyEqual> &map, const Key &key,
+                T default_value) {
+  auto search = map.find(key);
+  if (search == map.end()) {
+    return default_value;
+  }
+  return search->second;
+}
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+TEST_CASE("FlatHashMap") {
+  FlatHashMap<size_t, size_t> map;
+  std::unordered_map<size_t, size_t> reference;
+  // Insert enough to force several rehashes, with keys that are identical in their
+  // low bits.
+  for (size_t i = 0; i < 1000; i++) {
+    CHECK(map.insert({i << 10, i}).second);
+    reference.insert({i << 10, i});
+  }
+  CHECK_FALSE(map.insert({0, 17}).second);
+  CHECK_EQ(map.size(), 1000);
+  for (size_t i = 0; i < 1000; i++) {
+    CHECK_EQ(map.at(i << 10), i);
+  }
+  CHECK_EQ(map.count(3), 0);
+  CHECK_EQ(AtWithDefault(map, size_t(3), size_t(42)), 42);
+  CHECK_THROWS(map.at(3));
+  // Iteration is in insertion order.
+  size_t expected = 0;
+  for (const auto &[key, value] : map) {
+    CHECK_EQ(value, expected++);
+  }
+  // Erase every third entry.
+  for (size_t i = 0; i < 1000; i += 3) {
+    CHECK_EQ(map.erase(i << 10), 1);
+    reference.erase(i << 10);
+  }
+  CHECK_EQ(map.erase(0), 0);
+  CHECK_EQ(map.size(), reference.size());
+  for (const auto &[key, value] : reference) {
+    CHECK_EQ(map.at(key), value);
+  }
+  for (size_t i = 0; i < 1000; i += 3) {
+    CHECK_EQ(map.count(i << 10), 0);
+  }
+  map[5] += 2;
+  CHECK_EQ(map.at(5), 2);
+  FlatHashMap<size_t, size_t> copy = map;
+  CHECK(copy == map);
+  copy[5] = 3;
+  CHECK(copy != map);
+}
+#endif  // DOCTEST_LIBRARY_INCLUDED
+
+#endif  // SRC_FLAT_HASH_MAP_HPP_
@@ -0,0 +1,51 @@
+// Copyright 2019-2020 libsbn project contributors.
+// libsbn is free software under the GPLv3; see LICENSE file for details.
+
+#include "flat_topology.hpp"
+
+FlatTopology::FlatTopology(const Node::NodePtr &topology)
+    : leaf_count_(topology->LeafCount()), root_id_(static_cast<Id>(topology->Id())) {
+  const size_t node_count = topology->Id() + 1;
+  Assert(node_count < no_id_, "Too many nodes for FlatTopology.");
+  parent_ids_.assign(node_count, no_id_);
+  child0_ids_.assign(node_count, no_id_);
+  child1_ids_.assign(node_count, no_id_);
+  preorder_.reserve(node_count);
+  postorder_.reserve(node_count);
+  topology->PrePostOrder(
+      [this](const Node *node) { preorder_.push_back(static_cast<Id>(node->Id())); },
+      [this, &topology, node_count](const Node *node) {
+        const auto id = static_cast<Id>(node->Id());
+        Assert(id < node_count, "Node ids aren't polished in FlatTopology.");
+        postorder_.push_back(id);
+        const auto &children = node->Children();
+        if (children.empty()) {
+          return;
+        }  // else
+        if (children.size() == 3 && node == topology.get()) {
+          root_child2_id_ = static_cast<Id>(children[2]->Id());
+          parent_ids_[root_child2_id_] = id;
+        } else {
+          Assert(children.size() == 2,
+                 "FlatTopology expects a bifurcating tree, apart from a possible "
+                 "trifurcation at the root.");
+        }
+        child0_ids_[id] = static_cast<Id>(children[0]->Id());
+        child1_ids_[id] = static_cast<Id>(children[1]->Id());
+        parent_ids_[child0_ids_[id]] = id;
+        parent_ids_[child1_ids_[id]] = id;
+      });
+  Assert(postorder_.size() == node_count,
+         "The number of nodes doesn't match the root id in FlatTopology.");
+}
+
+size_t FlatTopology::Hash() const {
+  // Only the internal nodes have children, so we mix in their child ids.
+  uint64_t hash = NodeCount() ^ (static_cast<uint64_t>(root_child2_id_) << 32);
+  for (size_t id = leaf_count_; id < NodeCount(); id++) {
+    hash ^= (static_cast<uint64_t>(child0_ids_[id]) << 32) | child1_ids_[id];
+    hash *= 0x9e3779b97f4a7c15ULL;
+    hash ^= hash >> 32;
+  }
+  return static_cast<size_t>(hash);
+}
@@ -0,0 +1,149 @@
+// Copyright 2019-2020 libsbn project contributors.
+// libsbn is free software under the GPLv3; see LICENSE file for details.
+//
+// A flat, struct-of-arrays description of a polished topology.
+//
+// Our topologies are built out of Nodes that hold shared_ptrs to their children,
+// so traversing them means chasing pointers and calling a std::function on every
+// node. For the traversals in our inner loops we instead flatten the topology
+// once into arrays indexed by node id: the parent id and the two child ids of each
+// node, along with the node ids in preorder and in postorder. Then a traversal is
+// just a loop over one of the order arrays.
+//
+// Ids are those assigned by Node::Polish, so the leaves have ids 0 through
+// LeafCount() - 1 and the root has the largest id. Every node other than the
+// root must be bifurcating, but we allow a trifurcation at the root so that we
+// can flatten unrooted trees; the third child of such a root is RootChild2Id().
+// Leaves have no_id_ as their children, and the root has no_id_ as its parent.
+
+#ifndef SRC_FLAT_TOPOLOGY_HPP_
+#define SRC_FLAT_TOPOLOGY_HPP_
+
+#include <cstdint>
+#include <vector>
+
+#include "node.hpp"
+#include "sugar.hpp"
+
+class FlatTopology {
+ public:
+  using Id = uint32_t;
+  using IdVector = std::vector<Id>;
+  static constexpr Id no_id_ = UINT32_MAX;
+
+  FlatTopology() = default;
+  explicit FlatTopology(const Node::NodePtr &topology);
+
+  size_t NodeCount() const { return parent_ids_.size(); }
+  size_t LeafCount() const { return leaf_count_; }
+  Id RootId() const { return root_id_; }
+  bool IsLeaf(Id id) const { return id < leaf_count_; }
+  bool IsRootTrifurcating() const { return root_child2_id_ != no_id_; }
+
+  Id ParentId(Id id) const { return parent_ids_[id]; }
+  Id Child0Id(Id id) const { return child0_ids_[id]; }
+  Id Child1Id(Id id) const { return child1_ids_[id]; }
+  Id RootChild2Id() const { return root_child2_id_; }
+  // The other child of the parent of a node whose parent is bifurcating.
+  Id SisterId(Id id) const {
+    const Id parent_id = parent_ids_[id];
+    return child0_ids_[parent_id] == id ? child1_ids_[parent_id]
+                                        : child0_ids_[parent_id];
+  }
+
+  const IdVector &ParentIds() const { return parent_ids_; }
+  const IdVector &Child0Ids() const { return child0_ids_; }
+  const IdVector &Child1Ids() const { return child1_ids_; }
+  // The node ids in the order of Node::PreOrder and Node::PostOrder.
+  const IdVector &PreOrder() const { return preorder_; }
+  const IdVector &PostOrder() const { return postorder_; }
+
+  // Flat topologies are equal when they have the same children with the same ids,
+  // which also determines the parents and the traversal orders.
+  bool operator==(const FlatTopology &other) const {
+    return root_child2_id_ == other.root_child2_id_ &&
+           child0_ids_ == other.child0_ids_ && child1_ids_ == other.child1_ids_;
+  }
+  bool operator!=(const FlatTopology &other) const { return !(*this == other); }
+  size_t Hash() const;
+
+  // The leaf set of each node, indexed by node id. BitsetType can be any bitset
+  // type that has a size constructor, set, and operator|.
+  template <class BitsetType>
+  std::vector<BitsetType> Leaves() const {
+    std::vector<BitsetType> leaves(NodeCount(), BitsetType(leaf_count_));
+    for (const Id id : postorder_) {
+      if (IsLeaf(id)) {
+        leaves[id].set(id);
+      } else {
+        leaves[id] = leaves[child0_ids_[id]] | leaves[child1_ids_[id]];
+      }
+    }
+    if (IsRootTrifurcating()) {
+      leaves[root_id_] = leaves[root_id_] | leaves[root_child2_id_];
+    }
+    return leaves;
+  }
+
+ private:
+  size_t leaf_count_ = 0;
+  Id root_id_ = no_id_;
+  Id root_child2_id_ = no_id_;
+  IdVector parent_ids_;
+  IdVector child0_ids_;
+  IdVector child1_ids_;
+  IdVector preorder_;
+  IdVector postorder_;
+};
+
+namespace std {
+template <>
+struct hash<FlatTopology> {
+  size_t operator()(const FlatTopology &x) const { return x.Hash(); }
+};
+}  // namespace std
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+TEST_CASE("FlatTopology") {
+  for (const auto &topology : Node::ExampleTopologies()) {
+    FlatTopology flat(topology);
+    CHECK_EQ(flat.RootId(), topology->Id());
+    CHECK_EQ(flat.LeafCount(), topology->LeafCount());
+    CHECK_EQ(flat.IsRootTrifurcating(), topology->Children().size() == 3);
+    std::vector<size_t> preorder, postorder;
+    topology->PreOrder(
+        [&preorder](const Node *node) { preorder.push_back(node->Id()); });
+    topology->PostOrder(
+        [&postorder](const Node *node) { postorder.push_back(node->Id()); });
+    CHECK_EQ(std::vector<size_t>(flat.PreOrder().begin(), flat.PreOrder().end()),
+             preorder);
+    CHECK_EQ(std::vector<size_t>(flat.PostOrder().begin(), flat.PostOrder().end()),
+             postorder);
+    const auto parent_ids = topology->ParentIdVector();
+    for (size_t id = 0; id < parent_ids.size(); id++) {
+      CHECK_EQ(flat.ParentId(id), parent_ids[id]);
+    }
+    CHECK_EQ(flat.ParentId(flat.RootId()), FlatTopology::no_id_);
+    const auto leaves = flat.Leaves<Bitset>();
+    topology->PreOrder([&flat, &leaves](const Node *node) {
+      CHECK_EQ(leaves[node->Id()], node->Leaves());
+      if (!node->IsLeaf()) {
+        CHECK_EQ(flat.Child0Id(node->Id()), node->Children()[0]->Id());
+        CHECK_EQ(flat.Child1Id(node->Id()), node->Children()[1]->Id());
+        CHECK_EQ(flat.SisterId(node->Children()[0]->Id()), node->Children()[1]->Id());
+      }
+    });
+  }
+  // Equality and hashing see ids as well as the shape of the topology.
+  const auto examples = Node::ExampleTopologies();
+  CHECK_EQ(FlatTopology(examples[0]), FlatTopology(examples[1]));
+  CHECK_EQ(FlatTopology(examples[0]).Hash(), FlatTopology(examples[1]).Hash());
+  CHECK_NE(FlatTopology(examples[0]), FlatTopology(examples[2]));
+  CHECK_NE(FlatTopology(Node::OfParentIdVector({4, 4, 5, 5, 6, 6})),
+           FlatTopology(Node::OfParentIdVector({5, 5, 4, 4, 6, 6})));
+  // Polytomies away from the root aren't allowed.
+  CHECK_THROWS(FlatTopology(Node::OfParentIdVector({4, 4, 4, 5, 5})));
+}
+#endif  // DOCTEST_LIBRARY_INCLUDED
+
+#endif  // SRC_FLAT_TOPOLOGY_HPP_
@@ -20,6 +20,7 @@
 #include "psp_indexer.hpp"
 #include "rooted_sbn_support.hpp"
 #include "sbn_probability.hpp"
+#include "tree_collection_file.hpp"
 #include "unrooted_sbn_support.hpp"
 
 template <typename TTreeCollection, typename TSBNSupport>
@@ -64,7 +65,7 @@ class GenericSBNInstance {
     } else {
       std::cout << "No trees loaded.\n";
     }
-    std::cout << alignment_.Data().size() << " sequences loaded.\n";
+    std::cout << alignment_.SequenceCount() << " sequences loaded.\n";
   }
 
   BitsetSizeDict RootsplitCounterOf(const Node::TopologyCounter &topologies) const {
@@ -113,7 +114,7 @@ class GenericSBNInstance {
         sbn_support_.IndexerRepresentationCounterOf(topology_counter_);
     SBNProbability::SimpleAverage(sbn_parameters_, indexer_representation_counter,
                                   sbn_support_.RootsplitCount(),
-                                  sbn_support_.ParentToRange());
+                                  sbn_support_.SubsplitIdToRange());
   }
 
   EigenVectorXd NormalizedSBNParameters() const {
@@ -193,6 +194,11 @@ class GenericSBNInstance {
   void ReadFastaFile(const std::string &fname) {
     alignment_ = Alignment::ReadFasta(fname);
   }
+  // Save the loaded trees in the binary format of tree_collection_file.hpp, which
+  // ReadTreeCollectionFile loads much faster than we can parse Newick.
+  void WriteTreeCollectionFile(const std::string &fname) const {
+    TreeCollectionFile::Write(fname, tree_collection_);
+  }
 
  protected:
   // The name of our libsbn instance.
@@ -258,26 +264,29 @@ class GenericSBNInstance {
     // Start by sampling a rootsplit.
     size_t rootsplit_index =
         SampleIndex(std::pair<size_t, size_t>(0, sbn_support_.RootsplitCount()));
-    const Bitset &rootsplit = sbn_support_.RootsplitsAt(rootsplit_index);
-    // The addition below turns the rootsplit into a subsplit.
-    auto topology = rooted ? SampleTopology(rootsplit + ~rootsplit)
-                           : SampleTopology(rootsplit + ~rootsplit)->Deroot();
+    // This is the id of the subsplit made of the rootsplit and its complement.
+    const auto root_subsplit_id = sbn_support_.RootsplitSubsplitIdAt(rootsplit_index);
+    auto topology = rooted ? SampleTopologyBelow(root_subsplit_id)
+                           : SampleTopologyBelow(root_subsplit_id)->Deroot();
     topology->Polish();
     return topology;
   }
 
-  // The input to this function is a parent subsplit (of length 2n).
-  Node::NodePtr SampleTopology(const Bitset &parent_subsplit) const {
-    auto process_subsplit = [this](const Bitset &parent) {
-      auto singleton_option = parent.SplitChunk(1).SingletonOption();
-      if (singleton_option) {
-        return Node::Leaf(*singleton_option);
+  // The input to this function is the id of a parent subsplit in the support's
+  // subsplit interner. We work with ids rather than Bitsets so that sampling doesn't
+  // need to build any Bitsets.
+  Node::NodePtr SampleTopologyBelow(SubsplitInterner::Id parent_subsplit_id) const {
+    const auto &subsplits = sbn_support_.Subsplits();
+    auto process_subsplit = [this, &subsplits](SubsplitInterner::Id parent_id) {
+      const auto singleton = subsplits.SingletonOf(parent_id);
+      if (singleton != SubsplitInterner::missing_id_) {
+        return Node::Leaf(singleton);
       }  // else
-      auto child_index = SampleIndex(sbn_support_.ParentToRangeAt(parent));
-      return SampleTopology(sbn_support_.IndexToChildAt(child_index));
+      auto child_index = SampleIndex(sbn_support_.SubsplitIdToRangeAt(parent_id));
+      return SampleTopologyBelow(sbn_support_.IndexToChildIdAt(child_index));
     };
-    return Node::Join(process_subsplit(parent_subsplit),
-                      process_subsplit(parent_subsplit.RotateSubsplit()));
+    return Node::Join(process_subsplit(parent_subsplit_id),
+                      process_subsplit(subsplits.RotatedOf(parent_subsplit_id)));
   }
 
   // Clear all of the state that depends on the current tree collection.
@@ -287,25 +296,27 @@ class GenericSBNInstance {
     sbn_support_ = TSBNSupport();
   }
 
-  void PushBackRangeForParentIfAvailable(const Bitset &parent,
+  void PushBackRangeForParentIfAvailable(SubsplitInterner::Id parent_id,
                                          RangeVector &range_vector) {
-    if (sbn_support_.ParentInSupport(parent)) {
-      range_vector.push_back(sbn_support_.ParentToRangeAt(parent));
+    if (sbn_support_.SubsplitIdIsParent(parent_id)) {
+      range_vector.push_back(sbn_support_.SubsplitIdToRangeAt(parent_id));
     }
   }
 
   RangeVector GetSubsplitRanges(const SizeVector &rooted_representation) {
+    const auto &subsplits = sbn_support_.Subsplits();
     RangeVector subsplit_ranges;
-    // PROFILE: should we be reserving here?
+    // Each rooted representation entry contributes at most two ranges.
+    subsplit_ranges.reserve(1 + 2 * rooted_representation.size());
     subsplit_ranges.emplace_back(0, sbn_support_.RootsplitCount());
-    Bitset root = sbn_support_.RootsplitsAt(rooted_representation[0]);
-    PushBackRangeForParentIfAvailable(root + ~root, subsplit_ranges);
-    PushBackRangeForParentIfAvailable(~root + root, subsplit_ranges);
+    const auto root_id = sbn_support_.RootsplitSubsplitIdAt(rooted_representation[0]);
+    PushBackRangeForParentIfAvailable(root_id, subsplit_ranges);
+    PushBackRangeForParentIfAvailable(subsplits.RotatedOf(root_id), subsplit_ranges);
     // Starting at 1 here because we took care of the rootsplit above (the 0th element).
     for (size_t i = 1; i < rooted_representation.size(); i++) {
-      Bitset child = sbn_support_.IndexToChildAt(rooted_representation[i]);
-      PushBackRangeForParentIfAvailable(child, subsplit_ranges);
-      PushBackRangeForParentIfAvailable(child.RotateSubsplit(), subsplit_ranges);
+      const auto child_id = sbn_support_.IndexToChildIdAt(rooted_representation[i]);
+      PushBackRangeForParentIfAvailable(child_id, subsplit_ranges);
+      PushBackRangeForParentIfAvailable(subsplits.RotatedOf(child_id), subsplit_ranges);
     }
     return subsplit_ranges;
   }
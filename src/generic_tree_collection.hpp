@@ -10,6 +10,7 @@
 #include <utility>
 #include <vector>
 
+#include "newick_writer.hpp"
 #include "tree.hpp"
 
 template <typename TTree>
@@ -88,18 +89,24 @@ class GenericTreeCollection {
   }
 
   std::string Newick() const {
+    const NewickWriter writer(tag_taxon_map_);
     std::string str;
     for (const auto &tree : trees_) {
-      if (tag_taxon_map_.empty()) {
-        str.append(tree.Newick());
-      } else {
-        str.append(tree.Newick(tag_taxon_map_));
-      }
+      writer.AppendNewick(tree, &str);
       str.push_back('\n');
     }
     return str;
   }
 
+  // Write the trees to a file as Newick() would give them, formatting them on
+  // thread_count threads (0 meaning one per core) without building one big string.
+  void ToNewickFile(const std::string &path, size_t thread_count = 0) const {
+    NewickWriter(tag_taxon_map_)
+        .WriteFile(
+            path, TreeCount(),
+            [this](size_t i) -> const Tree & { return trees_[i]; }, thread_count);
+  }
+
   Node::TopologyCounter TopologyCounter() const {
     Node::TopologyCounter counter;
     for (const auto &tree : trees_) {
@@ -23,7 +23,7 @@ void GPInstance::PrintStatus() {
   } else {
     std::cout << "No trees loaded.\n";
   }
-  std::cout << alignment_.Data().size() << " sequences loaded.\n";
+  std::cout << alignment_.SequenceCount() << " sequences loaded.\n";
   std::cout << dag_.NodeCount() << " DAG nodes representing " << dag_.TopologyCount()
             << " trees.\n";
   std::cout << dag_.GeneralizedPCSPCount() << " continuous parameters.\n";
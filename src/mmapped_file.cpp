@@ -0,0 +1,58 @@
+// Copyright 2019-2020 libsbn project contributors.
+// libsbn is free software under the GPLv3; see LICENSE file for details.
+
+#include "mmapped_file.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "sugar.hpp"
+
+MmappedFile::MmappedFile(const std::string& path) {
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    Failwith("Cannot open the File : " + path);
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0) {
+    close(fd);
+    Failwith("Cannot stat the File : " + path);
+  }
+  // A pipe or a device has no size to speak of, and can't be mapped.
+  if (!S_ISREG(file_stat.st_mode)) {
+    close(fd);
+    Failwith("Cannot memory-map the File : " + path + " as it isn't a regular file.");
+  }
+  size_ = static_cast<size_t>(file_stat.st_size);
+  // We can't map an empty file, but then there is nothing to map.
+  if (size_ > 0) {
+    void* data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      close(fd);
+      Failwith("Cannot memory-map the File : " + path);
+    }
+    // We read front to back, so let the kernel read ahead aggressively.
+    madvise(data, size_, MADV_SEQUENTIAL);
+    data_ = static_cast<const char*>(data);
+  }
+  // The mapping stays valid after we close the file descriptor.
+  close(fd);
+}
+
+MmappedFile::~MmappedFile() {
+  if (data_ != nullptr) {
+    munmap(const_cast<char*>(data_), size_);
+  }
+}
+
+void MmappedFile::Release(size_t byte_count) const {
+  const auto page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  const size_t release_size = std::min(byte_count, size_) / page_size * page_size;
+  if (release_size > 0) {
+    madvise(const_cast<char*>(data_), release_size, MADV_DONTNEED);
+  }
+}
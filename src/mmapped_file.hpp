@@ -0,0 +1,48 @@
+// Copyright 2019-2020 libsbn project contributors.
+// libsbn is free software under the GPLv3; see LICENSE file for details.
+//
+// A read-only memory map of a whole file.
+//
+// This lets us parse big input files in place through a std::string_view rather
+// than copying them line by line into strings. The mapping lasts as long as the
+// MmappedFile, so views into it must not outlive it.
+
+#ifndef SRC_MMAPPED_FILE_HPP_
+#define SRC_MMAPPED_FILE_HPP_
+
+#include <string>
+#include <string_view>
+
+class MmappedFile {
+ public:
+  // Map the file at the given path, failing if it can't be opened or isn't a regular
+  // file.
+  explicit MmappedFile(const std::string& path);
+  MmappedFile(const MmappedFile&) = delete;
+  MmappedFile& operator=(const MmappedFile&) = delete;
+  ~MmappedFile();
+
+  std::string_view View() const { return std::string_view(data_, size_); }
+  size_t size() const { return size_; }
+  // Let the kernel drop the pages holding the first byte_count bytes, as we are done
+  // with them. They get read in again if we look at them after all.
+  void Release(size_t byte_count) const;
+
+ private:
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+TEST_CASE("MmappedFile") {
+  MmappedFile file("data/five_taxon_unrooted.nwk");
+  const auto view = file.View();
+  CHECK_GT(view.size(), 0);
+  CHECK_EQ(view.front(), '(');
+  CHECK_EQ(view.back(), '\n');
+  CHECK_THROWS(MmappedFile("data/no_such_file.nwk"));
+  CHECK_THROWS(MmappedFile("/dev/null"));
+}
+#endif  // DOCTEST_LIBRARY_INCLUDED
+
+#endif  // SRC_MMAPPED_FILE_HPP_
@@ -0,0 +1,174 @@
+// Copyright 2019-2020 libsbn project contributors.
+// libsbn is free software under the GPLv3; see LICENSE file for details.
+
+#include "newick_writer.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <queue>
+#include <thread>
+
+#include "task_processor.hpp"
+
+namespace {
+
+void AppendDouble(double x, std::string *str) {
+  char buffer[32];
+  const auto result = std::to_chars(buffer, buffer + sizeof(buffer), x,
+                                    std::chars_format::general, 6);
+  str->append(buffer, result.ptr);
+}
+
+void AppendUnsigned(size_t x, std::string *str) {
+  char buffer[24];
+  const auto result = std::to_chars(buffer, buffer + sizeof(buffer), x);
+  str->append(buffer, result.ptr);
+}
+
+// A file descriptor open for writing, which gets closed however we leave WriteFile.
+class OutputFile {
+ public:
+  explicit OutputFile(const std::string &path)
+      : path_(path), fd_(open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644)) {
+    if (fd_ < 0) {
+      Failwith("Cannot open the File for writing : " + path);
+    }
+  }
+  OutputFile(const OutputFile &) = delete;
+  OutputFile &operator=(const OutputFile &) = delete;
+  ~OutputFile() {
+    if (fd_ >= 0) {
+      close(fd_);
+    }
+  }
+
+  void Write(const std::string &str) const {
+    const char *data = str.data();
+    size_t remaining = str.size();
+    while (remaining > 0) {
+      const ssize_t written = write(fd_, data, remaining);
+      if (written < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        Failwith("Problem writing to the File : " + path_);
+      }
+      data += written;
+      remaining -= static_cast<size_t>(written);
+    }
+  }
+
+  void Close() {
+    const int fd = fd_;
+    fd_ = -1;
+    if (close(fd) != 0) {
+      Failwith("Problem closing the File : " + path_);
+    }
+  }
+
+ private:
+  std::string path_;
+  int fd_;
+};
+
+}  // namespace
+
+NewickWriter::NewickWriter(const TagStringMap &tag_taxon_map)
+    : leaf_labels_(tag_taxon_map.size()) {
+  for (const auto &[tag, taxon] : tag_taxon_map) {
+    const size_t leaf_id = MaxLeafIDOfTag(tag);
+    Assert(leaf_id < leaf_labels_.size(), "Leaf ids of the taxon map aren't dense.");
+    leaf_labels_[leaf_id] = taxon;
+  }
+}
+
+void NewickWriter::AppendNewick(const Tree &tree, std::string *str) const {
+  AppendNode(tree.Topology().get(), tree.branch_lengths_, str);
+  str->push_back(';');
+}
+
+void NewickWriter::AppendNode(const Node *node,
+                              const Tree::BranchLengthVector &branch_lengths,
+                              std::string *str) const {
+  if (node->IsLeaf()) {
+    if (leaf_labels_.empty()) {
+      AppendUnsigned(node->MaxLeafID(), str);
+    } else {
+      Assert(node->MaxLeafID() < leaf_labels_.size(),
+             "Leaf id missing from the taxon map in NewickWriter.");
+      str->append(leaf_labels_[node->MaxLeafID()]);
+    }
+  } else {
+    str->push_back('(');
+    const auto &children = node->Children();
+    for (auto iter = children.begin(); iter != children.end(); iter++) {
+      if (iter != children.begin()) {
+        str->push_back(',');
+      }
+      AppendNode(iter->get(), branch_lengths, str);
+    }
+    str->push_back(')');
+  }
+  Assert(node->Id() < branch_lengths.size(),
+         "branch_lengths vector is of insufficient length in NewickWriter.");
+  str->push_back(':');
+  AppendDouble(branch_lengths[node->Id()], str);
+}
+
+void NewickWriter::WriteFile(const std::string &path, size_t tree_count,
+                             const TreeGetter &get_tree, size_t thread_count,
+                             size_t chunk_tree_count) const {
+  Assert(chunk_tree_count > 0, "NewickWriter needs a positive chunk size.");
+  if (thread_count == 0) {
+    thread_count = std::max(size_t(1), size_t(std::thread::hardware_concurrency()));
+  }
+  OutputFile file(path);
+  // Two chunks per thread in each round, so that the threads stay busy if the chunks
+  // take different times. We reuse the chunk buffers from round to round.
+  std::vector<std::string> chunks(2 * thread_count);
+  auto format_chunk = [this, &chunks, &get_tree, tree_count, chunk_tree_count](
+                          size_t chunk_index, size_t first_tree) {
+    auto &str = chunks[chunk_index];
+    str.clear();
+    const size_t end = std::min(first_tree + chunk_tree_count, tree_count);
+    for (size_t tree_index = first_tree; tree_index < end; tree_index++) {
+      AppendNewick(get_tree(tree_index), &str);
+      str.push_back('\n');
+    }
+  };
+  const size_t round_tree_count = chunks.size() * chunk_tree_count;
+  for (size_t round_begin = 0; round_begin < tree_count;
+       round_begin += round_tree_count) {
+    const size_t chunk_count =
+        std::min(chunks.size(), (tree_count - round_begin + chunk_tree_count - 1) /
+                                    chunk_tree_count);
+    if (thread_count == 1 || chunk_count == 1) {
+      for (size_t i = 0; i < chunk_count; i++) {
+        format_chunk(i, round_begin + i * chunk_tree_count);
+      }
+    } else {
+      std::queue<size_t> thread_queue;
+      for (size_t i = 0; i < std::min(thread_count, chunk_count); i++) {
+        thread_queue.push(i);
+      }
+      std::queue<size_t> chunk_queue;
+      for (size_t i = 0; i < chunk_count; i++) {
+        chunk_queue.push(i);
+      }
+      TaskProcessor<size_t, size_t> task_processor(
+          std::move(thread_queue), std::move(chunk_queue),
+          [&format_chunk, round_begin, chunk_tree_count](size_t, size_t chunk_index) {
+            format_chunk(chunk_index, round_begin + chunk_index * chunk_tree_count);
+          });
+      task_processor.Wait();
+    }
+    for (size_t i = 0; i < chunk_count; i++) {
+      file.Write(chunks[i]);
+    }
+  }
+  file.Close();
+}
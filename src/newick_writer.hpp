@@ -0,0 +1,101 @@
+// Copyright 2019-2020 libsbn project contributors.
+// libsbn is free software under the GPLv3; see LICENSE file for details.
+//
+// Writing many trees as Newick text, quickly.
+//
+// Node::Newick builds a string per subtree through a std::function labeler and
+// formats each branch length with an ostringstream, which is fine for a tree but
+// slow for a posterior sample. Here we append straight into a buffer, look leaf labels
+// up by leaf id, and format branch lengths with std::to_chars. The output is the same
+// as that of Tree::Newick: std::to_chars with the general format and precision 6 is
+// what an ostream does by default.
+//
+// To write a file, we format the trees in chunks on several threads, then write the
+// chunks to the file descriptor in order before formatting the next round of chunks,
+// so memory use stays bounded however many trees there are.
+
+#ifndef SRC_NEWICK_WRITER_HPP_
+#define SRC_NEWICK_WRITER_HPP_
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "tree.hpp"
+
+class NewickWriter {
+ public:
+  using TreeGetter = std::function<const Tree&(size_t)>;
+
+  // Label leaves with their taxon names from the given map, or with their leaf ids
+  // if the map is empty.
+  explicit NewickWriter(const TagStringMap& tag_taxon_map);
+
+  // Append the Newick string of a tree, ending with ";", to str.
+  void AppendNewick(const Tree& tree, std::string* str) const;
+
+  // Write trees 0 through tree_count - 1 to a file, one per line. We format chunks of
+  // chunk_tree_count trees on thread_count threads (0 meaning one per core).
+  void WriteFile(const std::string& path, size_t tree_count,
+                 const TreeGetter& get_tree, size_t thread_count = 0,
+                 size_t chunk_tree_count = 1024) const;
+
+ private:
+  // Taxon names indexed by leaf id, or empty if we label leaves with their ids.
+  std::vector<std::string> leaf_labels_;
+
+  void AppendNode(const Node* node, const Tree::BranchLengthVector& branch_lengths,
+                  std::string* str) const;
+};
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+#include <fstream>
+#include <sstream>
+
+TEST_CASE("NewickWriter") {
+  auto trees = Tree::ExampleTrees();
+  trees[0].branch_lengths_[0] = 0.000012345678;
+  trees[1].branch_lengths_[2] = 123456789.;
+  trees[2].branch_lengths_[1] = 1. / 3.;
+  TagStringMap tag_taxon_map;
+  for (const auto& name : {"mars", "saturn", "jupiter", "venus"}) {
+    const auto leaf_id = static_cast<uint32_t>(tag_taxon_map.size());
+    SafeInsert(tag_taxon_map, PackInts(leaf_id, 1), std::string(name));
+  }
+  // Repeat the trees so that we get lots of chunks, with a short one at the end.
+  Tree::TreeVector many_trees;
+  for (size_t i = 0; i < 100; i++) {
+    many_trees.insert(many_trees.end(), trees.begin(), trees.end());
+  }
+  for (const auto& labels : {TagStringMap(), tag_taxon_map}) {
+    const NewickWriter writer(labels);
+    std::string expected;
+    for (const auto& tree : many_trees) {
+      std::string str;
+      writer.AppendNewick(tree, &str);
+      const auto tree_newick = labels.empty() ? tree.Newick() : tree.Newick(labels);
+      CHECK_EQ(str, tree_newick);
+      expected += tree_newick + "\n";
+    }
+    const std::string path = "_newick_writer_test.nwk";
+    for (const size_t thread_count : {1, 3}) {
+      writer.WriteFile(
+          path, many_trees.size(),
+          [&many_trees](size_t i) -> const Tree& { return many_trees[i]; },
+          thread_count, 7);
+      std::ifstream file(path);
+      std::stringstream written;
+      written << file.rdbuf();
+      CHECK_EQ(written.str(), expected);
+    }
+    std::remove(path.c_str());
+  }
+  CHECK_THROWS(NewickWriter(tag_taxon_map)
+                   .WriteFile("no_such_directory/trees.nwk", many_trees.size(),
+                              [&many_trees](size_t i) -> const Tree& {
+                                return many_trees[i];
+                              }));
+}
+#endif  // DOCTEST_LIBRARY_INCLUDED
+
+#endif  // SRC_NEWICK_WRITER_HPP_
@@ -16,6 +16,8 @@
 #include <unordered_map>
 #include <vector>
 
+#include "node_arena.hpp"
+
 // We assume that the sizes of things related to trees are smaller than
 // UINT32_MAX and so use that as our fundamental type. Because we use the STL,
 // we use size_t as well, the size of which is implementation-dependent. Here we
@@ -60,6 +62,10 @@ Node::Node(NodePtrVec children, size_t id, Bitset leaves)
 }
 
 bool Node::operator==(const Node& other) const {
+  // Nodes from a NodeStore share identical subtrees, so check for identity first.
+  if (this == &other) {
+    return true;
+  }
   if (this->Hash() != other.Hash()) {
     return false;
   }
@@ -75,19 +81,10 @@ bool Node::operator==(const Node& other) const {
   return true;
 }
 
+// The std::function overloads of the traversals call the templated versions in
+// node.hpp.
 void Node::PreOrder(std::function<void(const Node*)> f) const {
-  std::stack<const Node*> stack;
-  stack.push(this);
-  const Node* node;
-  while (stack.size()) {
-    node = stack.top();
-    stack.pop();
-    f(node);
-    const auto& children = node->Children();
-    for (auto iter = children.rbegin(); iter != children.rend(); ++iter) {
-      stack.push((*iter).get());
-    }
-  }
+  PreOrder<const std::function<void(const Node*)>&>(f);
 }
 
 void Node::ConditionalPreOrder(std::function<bool(const Node*)> f) const {
@@ -132,9 +129,7 @@ void Node::MutablePostOrder(std::function<void(Node*)> f) {
 }
 
 void Node::PostOrder(std::function<void(const Node*)> f) const {
-  // https://stackoverflow.com/a/56603436/467327
-  Node* mutable_this = const_cast<Node*>(this);
-  mutable_this->MutablePostOrder(f);
+  PostOrder<const std::function<void(const Node*)>&>(f);
 }
 
 void Node::PrePostOrder(std::function<void(const Node*)> pre,
@@ -176,147 +171,38 @@ void Node::LevelOrder(std::function<void(const Node*)> f) const {
   }
 }
 
-static std::function<void(const Node*, const Node*, const Node*)> const TripletIdInfix(
-    std::function<void(int, int, int)> f) {
-  return [&f](const Node* node0, const Node* node1, const Node* node2) {
-    f(static_cast<int>(node0->Id()), static_cast<int>(node1->Id()),
-      static_cast<int>(node2->Id()));
-  };
-}
-
 void Node::TripleIdPreOrderBifurcating(std::function<void(int, int, int)> f) const {
-  TriplePreOrderBifurcating(TripletIdInfix(f));
-}
-
-static std::function<void(const Node*)> const BinaryIdInfix(
-    std::function<void(int, int, int)> f) {
-  return [&f](const Node* node) {
-    if (!node->IsLeaf()) {
-      Assert(node->Children().size() == 2, "BinaryIdInfix expects a bifurcating tree.");
-      f(static_cast<int>(node->Id()), static_cast<int>(node->Children()[0]->Id()),
-        static_cast<int>(node->Children()[1]->Id()));
-    }
-  };
+  TripleIdPreOrderBifurcating<const std::function<void(int, int, int)>&>(f);
 }
 
 void Node::BinaryIdPreOrder(const std::function<void(int, int, int)> f) const {
-  PreOrder(BinaryIdInfix(f));
+  BinaryIdPreOrder<const std::function<void(int, int, int)>&>(f);
 }
 
 void Node::BinaryIdPostOrder(const std::function<void(int, int, int)> f) const {
-  PostOrder(BinaryIdInfix(f));
+  BinaryIdPostOrder<const std::function<void(int, int, int)>&>(f);
 }
 
 void Node::TriplePreOrder(
     std::function<void(const Node*, const Node*, const Node*)> f_root,
     std::function<void(const Node*, const Node*, const Node*)> f_internal) const {
-  Assert(children_.size() == 3,
-         "TriplePreOrder expects a tree with a trifurcation at the root.");
-  f_root(children_[0].get(), children_[1].get(), children_[2].get());
-  children_[0]->TriplePreOrderBifurcating(f_internal);
-  f_root(children_[1].get(), children_[2].get(), children_[0].get());
-  children_[1]->TriplePreOrderBifurcating(f_internal);
-  f_root(children_[2].get(), children_[0].get(), children_[1].get());
-  children_[2]->TriplePreOrderBifurcating(f_internal);
+  TriplePreOrder<const std::function<void(const Node*, const Node*, const Node*)>&,
+                 const std::function<void(const Node*, const Node*, const Node*)>&>(
+      f_root, f_internal);
 }
 
 void Node::TriplePreOrderBifurcating(
     std::function<void(const Node*, const Node*, const Node*)> f) const {
-  if (IsLeaf()) {
-    return;
-  }  // else
-  std::stack<std::pair<const Node*, bool>> stack;
-  stack.push({this, false});
-  const Node* node;
-  bool visited;
-  while (stack.size()) {
-    // Here we visit each node twice, once for each orientation.
-    std::tie(node, visited) = stack.top();
-    stack.pop();
-    const auto& children = node->Children();
-    Assert(children.size() == 2,
-           "TriplePreOrderBifurcating expects a bifurcating tree.");
-    if (visited) {
-      // We've already visited this node once, so do the second orientation.
-      f(children[1].get(), children[0].get(), node);
-      // Next traverse the right child.
-      if (!children[1]->IsLeaf()) {
-        stack.push({children[1].get(), false});
-      }
-    } else {
-      // We are visiting this node for the first time.
-      // Apply f in the first orientation.
-      f(children[0].get(), children[1].get(), node);
-      // Then set it up so it gets executed in the second orientation...
-      stack.push({node, true});
-      // ... after first traversing the left child.
-      if (!children[0]->IsLeaf()) {
-        stack.push({children[0].get(), false});
-      }
-    }
-  }
+  TriplePreOrderBifurcating<
+      const std::function<void(const Node*, const Node*, const Node*)>&>(f);
 }
 
-// See the typedef of UnrootedPCSPFun to understand the argument type to this
-// function, and `doc/pcsp.svg` for a diagram that will greatly help you
-// understand the implementation.
 void Node::UnrootedPCSPPreOrder(UnrootedPCSPFun f) const {
-  this->TriplePreOrder(
-      // f_root
-      [&f](const Node* node0, const Node* node1, const Node* node2) {
-        // Virtual root on node2's edge, with subsplit pointing up.
-        f(node2, false, node2, true, node0, false, node1, false, nullptr);
-        if (!node2->IsLeaf()) {
-          Assert(node2->Children().size() == 2,
-                 "PCSPPreOrder expects a bifurcating tree.");
-          auto child0 = node2->Children()[0].get();
-          auto child1 = node2->Children()[1].get();
-          // Virtual root in node1.
-          f(node0, false, node2, false, child0, false, child1, false, node1);
-          // Virtual root in node0.
-          f(node1, false, node2, false, child0, false, child1, false, node0);
-          // Virtual root on node2's edge, with subsplit pointing down.
-          f(node2, true, node2, false, child0, false, child1, false, nullptr);
-          // Virtual root in child0.
-          f(child1, false, node2, true, node0, false, node1, false, child0);
-          // Virtual root in child1.
-          f(child0, false, node2, true, node0, false, node1, false, child1);
-        }
-      },
-      // f_internal
-      [&f, this](const Node* node, const Node* sister, const Node* parent) {
-        // Virtual root on node's edge, with subsplit pointing up.
-        f(node, false, node, true, parent, true, sister, false, nullptr);
-        if (!node->IsLeaf()) {
-          Assert(node->Children().size() == 2,
-                 "PCSPPreOrder expects a bifurcating tree.");
-          auto child0 = node->Children()[0].get();
-          auto child1 = node->Children()[1].get();
-          // Virtual root up the tree.
-          f(sister, false, node, false, child0, false, child1, false, this);
-          // Virtual root in sister.
-          f(parent, true, node, false, child0, false, child1, false, sister);
-          // Virtual root on node's edge, with subsplit pointing down.
-          f(node, true, node, false, child0, false, child1, false, nullptr);
-          // Virtual root in child0.
-          f(child1, false, node, true, sister, false, parent, true, child0);
-          // Virtual root in child1.
-          f(child0, false, node, true, sister, false, parent, true, child1);
-        }
-      });
+  UnrootedPCSPPreOrder<const UnrootedPCSPFun&>(f);
 }
 
 void Node::RootedPCSPPreOrder(RootedPCSPFun f) const {
-  this->TriplePreOrderBifurcating(
-      [&f](const Node* node, const Node* sister, const Node* parent) {
-        if (!node->IsLeaf()) {
-          Assert(node->Children().size() == 2,
-                 "RootedPCSPPreOrder expects a bifurcating tree.");
-          auto child0 = node->Children()[0].get();
-          auto child1 = node->Children()[1].get();
-          f(sister, node, child0, child1);
-        }
-      });
+  RootedPCSPPreOrder<const RootedPCSPFun&>(f);
 }
 
 // This function assigns ids to the nodes of the topology: the leaves get
@@ -437,10 +323,18 @@ Bitset Node::LeavesOf(const Node::NodePtrVec& children) {
 }
 
 // Class methods
+// These allocate in the current NodeArena, if there is one.
 Node::NodePtr Node::Leaf(uint32_t id, Bitset leaves) {
+  if (const NodeArena* arena = NodeArena::Current()) {
+    return std::allocate_shared<Node>(arena->GetAllocator<Node>(), id, leaves);
+  }  // else
   return std::make_shared<Node>(id, leaves);
 }
 Node::NodePtr Node::Join(NodePtrVec children, size_t id) {
+  if (const NodeArena* arena = NodeArena::Current()) {
+    return std::allocate_shared<Node>(arena->GetAllocator<Node>(), children, id,
+                                      Node::LeavesOf(children));
+  }  // else
   return std::make_shared<Node>(children, id, Node::LeavesOf(children));
 }
 Node::NodePtr Node::Join(NodePtr left, NodePtr right, size_t id) {
@@ -127,6 +127,31 @@ class Node {
   void UnrootedPCSPPreOrder(UnrootedPCSPFun f) const;
   void RootedPCSPPreOrder(RootedPCSPFun f) const;
 
+  // Templated versions of the traversals above, which are defined below the class.
+  // These accept any callable, so that the compiler can inline the visitor rather
+  // than making an indirect call through a std::function for every node. Each
+  // keeps an explicit stack in a vector rather than recurring. Passing a lambda
+  // picks these overloads; the std::function overloads remain for callers that
+  // need a fixed type.
+  template <typename Visitor>
+  void PreOrder(Visitor&& f) const;
+  template <typename Visitor>
+  void PostOrder(Visitor&& f) const;
+  template <typename RootVisitor, typename InternalVisitor>
+  void TriplePreOrder(RootVisitor&& f_root, InternalVisitor&& f_internal) const;
+  template <typename Visitor>
+  void TriplePreOrderBifurcating(Visitor&& f) const;
+  template <typename Visitor>
+  void TripleIdPreOrderBifurcating(Visitor&& f) const;
+  template <typename Visitor>
+  void BinaryIdPreOrder(Visitor&& f) const;
+  template <typename Visitor>
+  void BinaryIdPostOrder(Visitor&& f) const;
+  template <typename Visitor>
+  void UnrootedPCSPPreOrder(Visitor&& f) const;
+  template <typename Visitor>
+  void RootedPCSPPreOrder(Visitor&& f) const;
+
   // This function prepares the id_ and leaves_ member variables as described at
   // the start of this document. It returns a map that maps the tags to their
   // indices. It's the verb, not the nationality.
@@ -208,6 +233,186 @@ class Node {
   static Bitset LeavesOf(const NodePtrVec& children);
 };
 
+template <typename Visitor>
+void Node::PreOrder(Visitor&& f) const {
+  std::vector<const Node*> stack = {this};
+  while (!stack.empty()) {
+    const Node* node = stack.back();
+    stack.pop_back();
+    f(node);
+    const auto& children = node->Children();
+    for (auto iter = children.rbegin(); iter != children.rend(); ++iter) {
+      stack.push_back((*iter).get());
+    }
+  }
+}
+
+template <typename Visitor>
+void Node::PostOrder(Visitor&& f) const {
+  // The stack records the nodes and whether they have been visited or not.
+  std::vector<std::pair<const Node*, bool>> stack = {{this, false}};
+  while (!stack.empty()) {
+    const auto [node, visited] = stack.back();
+    stack.pop_back();
+    if (visited) {
+      // If we've already visited this node then we are on our way back.
+      f(node);
+    } else {
+      // If not then we need to push ourself back on the stack (noting that
+      // we've been visited)...
+      stack.push_back({node, true});
+      // And all of our children, which have not.
+      const auto& children = node->Children();
+      for (auto iter = children.rbegin(); iter != children.rend(); ++iter) {
+        stack.push_back({(*iter).get(), false});
+      }
+    }
+  }
+}
+
+template <typename RootVisitor, typename InternalVisitor>
+void Node::TriplePreOrder(RootVisitor&& f_root, InternalVisitor&& f_internal) const {
+  Assert(children_.size() == 3,
+         "TriplePreOrder expects a tree with a trifurcation at the root.");
+  f_root(children_[0].get(), children_[1].get(), children_[2].get());
+  children_[0]->TriplePreOrderBifurcating(f_internal);
+  f_root(children_[1].get(), children_[2].get(), children_[0].get());
+  children_[1]->TriplePreOrderBifurcating(f_internal);
+  f_root(children_[2].get(), children_[0].get(), children_[1].get());
+  children_[2]->TriplePreOrderBifurcating(f_internal);
+}
+
+template <typename Visitor>
+void Node::TriplePreOrderBifurcating(Visitor&& f) const {
+  if (IsLeaf()) {
+    return;
+  }  // else
+  std::vector<std::pair<const Node*, bool>> stack = {{this, false}};
+  while (!stack.empty()) {
+    // Here we visit each node twice, once for each orientation.
+    const auto [node, visited] = stack.back();
+    stack.pop_back();
+    const auto& children = node->Children();
+    Assert(children.size() == 2,
+           "TriplePreOrderBifurcating expects a bifurcating tree.");
+    if (visited) {
+      // We've already visited this node once, so do the second orientation.
+      f(children[1].get(), children[0].get(), node);
+      // Next traverse the right child.
+      if (!children[1]->IsLeaf()) {
+        stack.push_back({children[1].get(), false});
+      }
+    } else {
+      // We are visiting this node for the first time.
+      // Apply f in the first orientation.
+      f(children[0].get(), children[1].get(), node);
+      // Then set it up so it gets executed in the second orientation...
+      stack.push_back({node, true});
+      // ... after first traversing the left child.
+      if (!children[0]->IsLeaf()) {
+        stack.push_back({children[0].get(), false});
+      }
+    }
+  }
+}
+
+template <typename Visitor>
+void Node::TripleIdPreOrderBifurcating(Visitor&& f) const {
+  TriplePreOrderBifurcating(
+      [&f](const Node* node0, const Node* node1, const Node* node2) {
+        f(static_cast<int>(node0->Id()), static_cast<int>(node1->Id()),
+          static_cast<int>(node2->Id()));
+      });
+}
+
+template <typename Visitor>
+void Node::BinaryIdPreOrder(Visitor&& f) const {
+  PreOrder([&f](const Node* node) {
+    if (!node->IsLeaf()) {
+      Assert(node->Children().size() == 2,
+             "BinaryIdPreOrder expects a bifurcating tree.");
+      f(static_cast<int>(node->Id()), static_cast<int>(node->Children()[0]->Id()),
+        static_cast<int>(node->Children()[1]->Id()));
+    }
+  });
+}
+
+template <typename Visitor>
+void Node::BinaryIdPostOrder(Visitor&& f) const {
+  PostOrder([&f](const Node* node) {
+    if (!node->IsLeaf()) {
+      Assert(node->Children().size() == 2,
+             "BinaryIdPostOrder expects a bifurcating tree.");
+      f(static_cast<int>(node->Id()), static_cast<int>(node->Children()[0]->Id()),
+        static_cast<int>(node->Children()[1]->Id()));
+    }
+  });
+}
+
+// See the typedef of UnrootedPCSPFun to understand the argument type to this
+// function, and `doc/pcsp.svg` for a diagram that will greatly help you
+// understand the implementation.
+template <typename Visitor>
+void Node::UnrootedPCSPPreOrder(Visitor&& f) const {
+  this->TriplePreOrder(
+      // f_root
+      [&f](const Node* node0, const Node* node1, const Node* node2) {
+        // Virtual root on node2's edge, with subsplit pointing up.
+        f(node2, false, node2, true, node0, false, node1, false, nullptr);
+        if (!node2->IsLeaf()) {
+          Assert(node2->Children().size() == 2,
+                 "PCSPPreOrder expects a bifurcating tree.");
+          auto child0 = node2->Children()[0].get();
+          auto child1 = node2->Children()[1].get();
+          // Virtual root in node1.
+          f(node0, false, node2, false, child0, false, child1, false, node1);
+          // Virtual root in node0.
+          f(node1, false, node2, false, child0, false, child1, false, node0);
+          // Virtual root on node2's edge, with subsplit pointing down.
+          f(node2, true, node2, false, child0, false, child1, false, nullptr);
+          // Virtual root in child0.
+          f(child1, false, node2, true, node0, false, node1, false, child0);
+          // Virtual root in child1.
+          f(child0, false, node2, true, node0, false, node1, false, child1);
+        }
+      },
+      // f_internal
+      [&f, this](const Node* node, const Node* sister, const Node* parent) {
+        // Virtual root on node's edge, with subsplit pointing up.
+        f(node, false, node, true, parent, true, sister, false, nullptr);
+        if (!node->IsLeaf()) {
+          Assert(node->Children().size() == 2,
+                 "PCSPPreOrder expects a bifurcating tree.");
+          auto child0 = node->Children()[0].get();
+          auto child1 = node->Children()[1].get();
+          // Virtual root up the tree.
+          f(sister, false, node, false, child0, false, child1, false, this);
+          // Virtual root in sister.
+          f(parent, true, node, false, child0, false, child1, false, sister);
+          // Virtual root on node's edge, with subsplit pointing down.
+          f(node, true, node, false, child0, false, child1, false, nullptr);
+          // Virtual root in child0.
+          f(child1, false, node, true, sister, false, parent, true, child0);
+          // Virtual root in child1.
+          f(child0, false, node, true, sister, false, parent, true, child1);
+        }
+      });
+}
+
+template <typename Visitor>
+void Node::RootedPCSPPreOrder(Visitor&& f) const {
+  this->TriplePreOrderBifurcating(
+      [&f](const Node* node, const Node* sister, const Node* parent) {
+        if (!node->IsLeaf()) {
+          Assert(node->Children().size() == 2,
+                 "RootedPCSPPreOrder expects a bifurcating tree.");
+          auto child0 = node->Children()[0].get();
+          auto child1 = node->Children()[1].get();
+          f(sister, node, child0, child1);
+        }
+      });
+}
+
 // Compare NodePtrs by their Nodes.
 inline bool operator==(const Node::NodePtr& lhs, const Node::NodePtr& rhs) {
   return *lhs == *rhs;
@@ -274,6 +479,29 @@ TEST_CASE("Node") {
       {"10, 5, 6", "8, 9, 10", "7, 2, 8", "0, 1, 7", "1, 0, 7", "2, 7, 8", "9, 8, 10",
        "3, 4, 9", "4, 3, 9", "5, 6, 10", "6, 10, 5"});
   CHECK_EQ(triples, correct_triples);
+  // The std::function overload visits in the same order as the templated one.
+  triples.clear();
+  std::function<void(const Node*, const Node*, const Node*)> collect_function =
+      collect_triple;
+  t4->TriplePreOrder(collect_function, collect_function);
+  CHECK_EQ(triples, correct_triples);
+  std::vector<size_t> pcsp_ids, pcsp_function_ids;
+  t4->UnrootedPCSPPreOrder(
+      [&pcsp_ids](const Node* sister, bool, const Node* focal, bool, const Node* child0,
+                  bool, const Node* child1, bool, const Node*) {
+        pcsp_ids.insert(pcsp_ids.end(),
+                        {sister->Id(), focal->Id(), child0->Id(), child1->Id()});
+      });
+  Node::UnrootedPCSPFun collect_pcsp_ids =
+      [&pcsp_function_ids](const Node* sister, bool, const Node* focal, bool,
+                           const Node* child0, bool, const Node* child1, bool,
+                           const Node*) {
+        pcsp_function_ids.insert(
+            pcsp_function_ids.end(),
+            {sister->Id(), focal->Id(), child0->Id(), child1->Id()});
+      };
+  t4->UnrootedPCSPPreOrder(collect_pcsp_ids);
+  CHECK_EQ(pcsp_ids, pcsp_function_ids);
 
   // This is actually a non-trivial test (see note in Node constructor above),
   // which shows why we need bit rotation.
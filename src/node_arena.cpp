@@ -0,0 +1,38 @@
+// Copyright 2019-2020 libsbn project contributors.
+// libsbn is free software under the GPLv3; see LICENSE file for details.
+
+#include "node_arena.hpp"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace {
+thread_local const NodeArena* current_arena = nullptr;
+}  // namespace
+
+void* NodeArena::Resource::Allocate(size_t byte_count, size_t alignment) {
+  const size_t padding =
+      (alignment - reinterpret_cast<uintptr_t>(next_) % alignment) % alignment;
+  if (next_ == nullptr || padding + byte_count > remaining_) {
+    // Start a new block, which operator new[] aligns for any fundamental type.
+    const size_t block_size = std::max(next_block_size_, byte_count + alignment);
+    blocks_.emplace_back(new char[block_size]);
+    next_ = blocks_.back().get();
+    remaining_ = block_size;
+    capacity_ += block_size;
+    next_block_size_ = std::min(2 * next_block_size_, max_block_size_);
+    return Allocate(byte_count, alignment);
+  }
+  void* result = next_ + padding;
+  next_ += padding + byte_count;
+  remaining_ -= padding + byte_count;
+  return result;
+}
+
+NodeArena::Scope::Scope(const NodeArena& arena) : previous_(current_arena) {
+  current_arena = &arena;
+}
+
+NodeArena::Scope::~Scope() { current_arena = previous_; }
+
+const NodeArena* NodeArena::Current() { return current_arena; }
@@ -0,0 +1,150 @@
+// Copyright 2019-2020 libsbn project contributors.
+// libsbn is free software under the GPLv3; see LICENSE file for details.
+//
+// Monotonic arena allocation for the Nodes of a whole collection of trees.
+//
+// A tree collection holds many thousands of small Nodes, each of which is a separate
+// heap allocation that gets freed one by one when the collection goes away. A
+// NodeArena instead hands out Node storage by bumping a pointer through large blocks,
+// and never frees anything individually: the blocks all go at once, when the last
+// Node allocated from the arena is destroyed (every such Node keeps the arena's
+// blocks alive through its allocator).
+//
+// Nodes get allocated in an arena while a NodeArena::Scope for it is alive on the
+// current thread: Node::Leaf and Node::Join consult NodeArena::Current(). Arenas
+// aren't thread-safe, so use one arena per thread. Memory freed by Nodes in an arena
+// isn't reused until the whole arena goes, so only use arenas for Nodes that live as
+// long as their collection, and not for temporaries.
+
+#ifndef SRC_NODE_ARENA_HPP_
+#define SRC_NODE_ARENA_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+class NodeArena {
+ public:
+  // The block storage of an arena.
+  class Resource {
+   public:
+    Resource() = default;
+    Resource(const Resource&) = delete;
+    Resource& operator=(const Resource&) = delete;
+
+    void* Allocate(size_t byte_count, size_t alignment);
+    // The total size of the blocks allocated so far.
+    size_t Capacity() const { return capacity_; }
+
+   private:
+    static constexpr size_t initial_block_size_ = 1 << 16;
+    static constexpr size_t max_block_size_ = 1 << 22;
+
+    std::vector<std::unique_ptr<char[]>> blocks_;
+    char* next_ = nullptr;
+    size_t remaining_ = 0;
+    size_t next_block_size_ = initial_block_size_;
+    size_t capacity_ = 0;
+  };
+
+  // A standard allocator that allocates from an arena and keeps it alive.
+  template <class T>
+  class Allocator {
+   public:
+    using value_type = T;
+
+    explicit Allocator(std::shared_ptr<Resource> resource)
+        : resource_(std::move(resource)) {}
+    template <class U>
+    Allocator(const Allocator<U>& other)  // NOLINT(runtime/explicit)
+        : resource_(other.resource_) {}
+
+    T* allocate(size_t n) {
+      return static_cast<T*>(resource_->Allocate(n * sizeof(T), alignof(T)));
+    }
+    void deallocate(T*, size_t) {}
+
+    template <class U>
+    bool operator==(const Allocator<U>& other) const {
+      return resource_ == other.resource_;
+    }
+    template <class U>
+    bool operator!=(const Allocator<U>& other) const {
+      return !(*this == other);
+    }
+
+   private:
+    template <class U>
+    friend class Allocator;
+
+    std::shared_ptr<Resource> resource_;
+  };
+
+  // Make Nodes get allocated in the given arena on this thread for the lifetime of
+  // the Scope. Scopes nest.
+  class Scope {
+   public:
+    explicit Scope(const NodeArena& arena);
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+    ~Scope();
+
+   private:
+    const NodeArena* previous_;
+  };
+
+  NodeArena() : resource_(std::make_shared<Resource>()) {}
+
+  // The arena of the innermost Scope on this thread, or nullptr if there is none.
+  static const NodeArena* Current();
+
+  template <class T>
+  Allocator<T> GetAllocator() const {
+    return Allocator<T>(resource_);
+  }
+  size_t Capacity() const { return resource_->Capacity(); }
+  // The block storage lives as long as the arena or any node allocated in it does
+  // (including through a weak pointer), which this lets us check.
+  std::weak_ptr<const Resource> WeakResource() const { return resource_; }
+
+ private:
+  std::shared_ptr<Resource> resource_;
+};
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+TEST_CASE("NodeArena") {
+  std::weak_ptr<int> weak_int;
+  {
+    NodeArena arena;
+    CHECK_EQ(NodeArena::Current(), nullptr);
+    std::shared_ptr<int> shared_int;
+    {
+      NodeArena::Scope scope(arena);
+      CHECK_EQ(NodeArena::Current(), &arena);
+      {
+        NodeArena inner_arena;
+        NodeArena::Scope inner_scope(inner_arena);
+        CHECK_EQ(NodeArena::Current(), &inner_arena);
+      }
+      CHECK_EQ(NodeArena::Current(), &arena);
+      shared_int = std::allocate_shared<int>(arena.GetAllocator<int>(), 5);
+    }
+    CHECK_EQ(NodeArena::Current(), nullptr);
+    CHECK_GT(arena.Capacity(), 0);
+    weak_int = shared_int;
+    // Allocations are aligned and don't overlap.
+    auto doubles = arena.GetAllocator<double>();
+    double* x = doubles.allocate(3);
+    double* y = doubles.allocate(1);
+    CHECK_EQ(reinterpret_cast<uintptr_t>(x) % alignof(double), 0);
+    CHECK_GE(y, x + 3);
+    // Allocations bigger than a block get a block of their own.
+    CHECK_NE(doubles.allocate(1 << 20), nullptr);
+    CHECK_EQ(*shared_int, 5);
+  }
+  CHECK(weak_int.expired());
+}
+#endif  // DOCTEST_LIBRARY_INCLUDED
+
+#endif  // SRC_NODE_ARENA_HPP_
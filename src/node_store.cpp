@@ -0,0 +1,64 @@
+// Copyright 2019-2020 libsbn project contributors.
+// libsbn is free software under the GPLv3; see LICENSE file for details.
+
+#include "node_store.hpp"
+
+#include <utility>
+
+size_t NodeStore::KeyHash::operator()(const Key& key) const {
+  size_t hash = std::hash<size_t>{}(key.id_);
+  for (const Node* child : key.children_) {
+    hash = (hash ^ std::hash<const Node*>{}(child)) * 0x9e3779b97f4a7c15ULL;
+  }
+  return hash;
+}
+
+Node::NodePtr NodeStore::Canonicalize(const Node::NodePtr& topology) {
+  canonical_nodes_.assign(topology->Id() + 1, nullptr);
+  Node::NodePtrVec children;
+  topology->PostOrder([this, &children](const Node* node) {
+    Assert(node->Id() < canonical_nodes_.size(),
+           "NodeStore::Canonicalize expects a polished topology.");
+    if (node->IsLeaf()) {
+      canonical_nodes_[node->Id()] =
+          Leaf(static_cast<uint32_t>(node->Id()), node->Leaves().size());
+    } else {
+      children.clear();
+      for (const auto& child : node->Children()) {
+        children.push_back(canonical_nodes_[child->Id()]);
+      }
+      canonical_nodes_[node->Id()] = Join(children, node->Id());
+    }
+  });
+  Node::NodePtr result = std::move(canonical_nodes_[topology->Id()]);
+  canonical_nodes_.clear();
+  return result;
+}
+
+Node::NodePtr NodeStore::Leaf(uint32_t id, size_t leaf_count) {
+  key_.id_ = id;
+  key_.children_.clear();
+  auto& entry = nodes_[key_];
+  Node::NodePtr node = entry.lock();
+  if (node == nullptr) {
+    // Either this node is new to us or its entry has expired.
+    node = Node::Leaf(id, Bitset::Singleton(leaf_count, id));
+    entry = node;
+  }
+  return node;
+}
+
+Node::NodePtr NodeStore::Join(const Node::NodePtrVec& children, size_t id) {
+  key_.id_ = id;
+  key_.children_.clear();
+  for (const auto& child : children) {
+    key_.children_.push_back(child.get());
+  }
+  auto& entry = nodes_[key_];
+  Node::NodePtr node = entry.lock();
+  if (node == nullptr) {
+    node = Node::Join(children, id);
+    entry = node;
+  }
+  return node;
+}
@@ -0,0 +1,99 @@
+// Copyright 2019-2020 libsbn project contributors.
+// libsbn is free software under the GPLv3; see LICENSE file for details.
+//
+// A hash-consing store for polished topologies.
+//
+// The trees of a posterior sample repeat the same clades over and over, but each
+// parsed tree comes with its own Node graph. Canonicalize rebuilds a polished
+// topology out of the nodes of the store, so that identical subtrees across all of
+// the topologies passed through one store are represented by one shared Node.
+//
+// Because ids are part of a node (branch lengths are indexed by them), we only
+// share subtrees that have the same children *and* the same id. Leaves are always
+// shared, and so are identical topologies, which then compare equal in constant
+// time because Node::operator== checks for identity first.
+//
+// The store only holds weak pointers, so it doesn't keep any trees alive. Shared
+// nodes must not be modified, so don't (re-)Polish a canonical topology into
+// different ids.
+
+#ifndef SRC_NODE_STORE_HPP_
+#define SRC_NODE_STORE_HPP_
+
+#include <memory>
+#include <vector>
+
+#include "flat_hash_map.hpp"
+#include "node.hpp"
+
+class NodeStore {
+ public:
+  // Return a topology equal to the given polished topology (including its ids) that
+  // is built out of the nodes of this store.
+  Node::NodePtr Canonicalize(const Node::NodePtr& topology);
+  // The building blocks of Canonicalize, for building a canonical topology directly
+  // in postorder. Leaf returns the store's leaf with the given id in a topology with
+  // the given number of leaves. Join returns the store's node with the given id and
+  // children, which must come from the store and be in polished order (sorted by
+  // max leaf id).
+  Node::NodePtr Leaf(uint32_t id, size_t leaf_count);
+  Node::NodePtr Join(const Node::NodePtrVec& children, size_t id);
+
+  // The number of entries in the store, some of which may have expired.
+  size_t size() const { return nodes_.size(); }
+  void clear() { nodes_.clear(); }
+
+ private:
+  // A node is determined by its id and its (canonical) children.
+  struct Key {
+    size_t id_;
+    std::vector<const Node*> children_;
+
+    bool operator==(const Key& other) const {
+      return id_ == other.id_ && children_ == other.children_;
+    }
+  };
+  struct KeyHash {
+    size_t operator()(const Key& key) const;
+  };
+
+  FlatHashMap<Key, std::weak_ptr<Node>, KeyHash> nodes_;
+  // Scratch space for looking up keys.
+  Key key_;
+  // Scratch space for Canonicalize, indexed by node id.
+  std::vector<Node::NodePtr> canonical_nodes_;
+};
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+TEST_CASE("NodeStore") {
+  NodeStore store;
+  const auto examples = Node::ExampleTopologies();
+  // Topologies 0 and 1 are equal but separately built, whereas topology 2 differs.
+  const auto canonical0 = store.Canonicalize(examples[0]);
+  const auto canonical1 = store.Canonicalize(examples[1]);
+  const auto canonical2 = store.Canonicalize(examples[2]);
+  CHECK_EQ(canonical0, examples[0]);
+  CHECK_EQ(canonical0->Newick(), examples[0]->Newick());
+  CHECK_EQ(canonical0.get(), canonical1.get());
+  CHECK_EQ(canonical2, examples[2]);
+  CHECK_NE(canonical0.get(), canonical2.get());
+  // The leaves are shared.
+  CHECK_EQ(canonical0->Children()[0].get(), canonical2->Children()[0].get());
+  canonical0->PreOrder([](const Node* node) {
+    if (node->IsLeaf()) {
+      CHECK_EQ(node->Leaves(), Bitset::Singleton(4, node->Id()));
+    }
+  });
+  // Canonicalizing an equal topology again doesn't add entries.
+  const auto entry_count = store.size();
+  CHECK_EQ(store.Canonicalize(Node::ExampleTopologies()[0]).get(), canonical0.get());
+  CHECK_EQ(store.size(), entry_count);
+  // Building the same topology by hand in postorder gives the same nodes.
+  const auto leaf = [&store](uint32_t id) { return store.Leaf(id, 4); };
+  const auto cherry = store.Join({leaf(2), leaf(3)}, 4);
+  CHECK_EQ(store.Join({leaf(0), leaf(1), cherry}, 5).get(), canonical0.get());
+  CHECK_EQ(store.size(), entry_count);
+}
+#endif  // DOCTEST_LIBRARY_INCLUDED
+
+#endif  // SRC_NODE_STORE_HPP_
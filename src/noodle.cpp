@@ -1,3 +1,4 @@
+#include "task_processor.hpp"
 #include "unrooted_sbn_instance.hpp"
 
 // This is just a place to muck around, and check out performance.
@@ -8,20 +9,458 @@ auto now = std::chrono::high_resolution_clock::now;
 // valgrind --tool=callgrind ./_build/noodle
 // gprof2dot -f callgrind callgrind.out.16763 | dot -Tpng -o ~/output.png
 
-int main() {
+// Time a preorder traversal of a big ladder tree using the std::function overload,
+// the templated overload, and a FlatTopology, as well as the two versions of the
+// PCSP traversals.
+void PreOrderTiming() {
   uint32_t leaf_count = 10000;
+  const int rep_count = 100;
 
   Node::NodePtr topology = Node::Ladder(leaf_count);
 
   std::vector<size_t> ids;
   ids.reserve(1 + 2 * leaf_count);
+  auto time = [rep_count](const std::string& name, auto f) {
+    auto t_start = now();
+    for (int rep = 0; rep < rep_count; rep++) {
+      f();
+    }
+    std::chrono::duration<double> duration = now() - t_start;
+    std::cout << name << " time: " << duration.count() << " seconds\n";
+  };
 
-  auto t_start = now();
-  for (int i = 0; i < 100; i++) {
+  std::function<void(const Node*)> push_id = [&ids](const Node* node) {
+    ids.push_back(node->Id());
+  };
+  time("std::function PreOrder", [&topology, &ids, &push_id]() {
+    ids.clear();
+    topology->PreOrder(push_id);
+  });
+  time("templated PreOrder", [&topology, &ids]() {
     ids.clear();
     topology->PreOrder([&ids](const Node* node) { ids.push_back(node->Id()); });
+  });
+  // The same traversal as a loop over a FlatTopology.
+  const FlatTopology flat(topology);
+  time("FlatTopology preorder", [&flat, &ids]() {
+    ids.clear();
+    for (const auto id : flat.PreOrder()) {
+      ids.push_back(id);
+    }
+  });
+
+  size_t id_total = 0;
+  Node::RootedPCSPFun add_ids = [&id_total](const Node* sister, const Node* focal,
+                                            const Node* child0, const Node* child1) {
+    id_total += sister->Id() + focal->Id() + child0->Id() + child1->Id();
+  };
+  time("std::function RootedPCSPPreOrder",
+       [&topology, &add_ids]() { topology->RootedPCSPPreOrder(add_ids); });
+  time("templated RootedPCSPPreOrder", [&topology, &id_total]() {
+    topology->RootedPCSPPreOrder([&id_total](const Node* sister, const Node* focal,
+                                             const Node* child0, const Node* child1) {
+      id_total += sister->Id() + focal->Id() + child0->Id() + child1->Id();
+    });
+  });
+  std::cout << "(checksum " << id_total << ")\n";
+}
+
+// Compare hashing subsplits the way we used to (std::hash of a vector<bool>) with
+// the word-level Bitset hash, both computed from scratch and cached, as well as
+// the cost of looking them up in an indexer map.
+void BitsetHashTiming(size_t taxon_count) {
+  const size_t subsplit_count = 4096;
+  const int rep_count = 200;
+  std::vector<Bitset> subsplits;
+  std::vector<std::vector<bool>> old_subsplits;
+  BitsetSizeMap indexer;
+  for (size_t i = 0; i < subsplit_count; i++) {
+    std::vector<bool> value(2 * taxon_count);
+    for (size_t j = 0; j < value.size(); j++) {
+      value[j] = ((i + 1) * (j + 7) * 2654435761u >> 13) % 2;
+    }
+    subsplits.emplace_back(value);
+    old_subsplits.push_back(value);
+    indexer.insert({subsplits.back(), i});
+  }
+  size_t checksum = 0;
+  auto time = [&checksum, rep_count](const std::string& name, auto f) {
+    auto t_start = now();
+    for (int rep = 0; rep < rep_count; rep++) {
+      checksum += f();
+    }
+    std::chrono::duration<double> duration = now() - t_start;
+    std::cout << "  " << name << ": " << duration.count() << " seconds\n";
+  };
+  std::cout << "hashing " << subsplit_count << " subsplits on " << taxon_count
+            << " taxa, " << rep_count << " times:\n";
+  time("std::hash<std::vector<bool>>", [&old_subsplits]() {
+    size_t total = 0;
+    for (const auto& value : old_subsplits) {
+      total += std::hash<std::vector<bool>>{}(value);
+    }
+    return total;
+  });
+  time("Bitset::ComputeHash", [&subsplits]() {
+    size_t total = 0;
+    for (const auto& subsplit : subsplits) {
+      total += subsplit.ComputeHash();
+    }
+    return total;
+  });
+  time("Bitset::Hash (cached)", [&subsplits]() {
+    size_t total = 0;
+    for (const auto& subsplit : subsplits) {
+      total += subsplit.Hash();
+    }
+    return total;
+  });
+  time("BitsetSizeMap lookup", [&subsplits, &indexer]() {
+    size_t total = 0;
+    for (const auto& subsplit : subsplits) {
+      total += indexer.at(subsplit);
+    }
+    return total;
+  });
+  std::cout << "  (checksum " << checksum << ")\n";
+}
+
+// Compare sampling and parsing trees with their Nodes on the heap and in a NodeArena,
+// including the time it takes to free them again.
+void NodeArenaTiming() {
+  const size_t sample_count = 100000;
+  auto time = [](const std::string& name, auto f) {
+    auto t_start = now();
+    auto result = f();
+    std::chrono::duration<double> build_duration = now() - t_start;
+    t_start = now();
+    result = {};
+    std::chrono::duration<double> free_duration = now() - t_start;
+    std::cout << name << " time: " << build_duration.count() << " seconds, free "
+              << free_duration.count() << " seconds\n";
+  };
+  UnrootedSBNInstance inst("noodle");
+  inst.ReadNewickFile("data/DS1.100_topologies.nwk");
+  inst.ProcessLoadedTrees();
+  auto sample = [&inst, sample_count]() {
+    Node::NodePtrVec topologies;
+    topologies.reserve(sample_count);
+    for (size_t i = 0; i < sample_count; i++) {
+      topologies.push_back(inst.SampleTopology());
+    }
+    return topologies;
+  };
+  time("heap sampling", sample);
+  time("arena sampling", [&sample]() {
+    NodeArena arena;
+    NodeArena::Scope arena_scope(arena);
+    return sample();
+  });
+  for (const bool use_node_arena : {false, true}) {
+    time(use_node_arena ? "arena parsing" : "heap parsing", [use_node_arena]() {
+      Driver driver;
+      driver.use_node_arena_ = use_node_arena;
+      return driver.ParseNewickFile("data/DS1.100_topologies.nwk").trees_;
+    });
+  }
+}
+
+// Time parsing Nexus files: the BEAST example file, and synthetic files without any
+// trees, so that we just time their translate blocks. These have the given numbers
+// of taxa and end MrBayes-style (with a semicolon at the end of the last statement)
+// or BEAST-style (with a semicolon on a line of its own).
+void NexusTranslateTiming(const std::vector<size_t>& taxon_counts) {
+  auto time = [](const std::string& name, size_t repeat_count, auto f) {
+    const auto t_start = now();
+    size_t taxon_total = 0;
+    for (size_t i = 0; i < repeat_count; i++) {
+      taxon_total += f().TaxonCount();
+    }
+    std::chrono::duration<double> duration = now() - t_start;
+    std::cout << name << " time: " << duration.count() / repeat_count
+              << " seconds per file (checksum " << taxon_total << ")\n";
+  };
+  Driver driver;
+  time("BEAST example Nexus", 1000, [&driver]() {
+    return driver.ParseNexusFile("data/test_beast_tree_parsing.nexus");
+  });
+  const std::string path = "_noodle_translate.nexus";
+  for (const size_t taxon_count : taxon_counts) {
+    for (const bool is_beast : {false, true}) {
+      std::ofstream out(path);
+      out << "#NEXUS\nbegin trees;\n\ttranslate\n";
+      for (size_t taxon = 1; taxon <= taxon_count; taxon++) {
+        out << "\t\t" << taxon << " Taxon_number_" << taxon
+            << (taxon < taxon_count || is_beast ? ",\n" : ";\n");
+      }
+      if (is_beast) {
+        out << ";\n";
+      }
+      out << "end;\n";
+      out.close();
+      time(std::to_string(taxon_count) + (is_beast ? " taxon BEAST-style Nexus"
+                                                   : " taxon MrBayes-style Nexus"),
+           std::max<size_t>(1, 100000 / taxon_count),
+           [&driver, &path]() { return driver.ParseNexusFile(path); });
+    }
+  }
+  std::remove(path.c_str());
+}
+
+// Compare loading a collection of 100,000 trees from Newick and from a tree
+// collection file.
+void TreeCollectionFileTiming() {
+  const size_t copy_count = 1000;
+  Driver driver;
+  const auto topologies = driver.ParseNewickFile("data/DS1.100_topologies.nwk");
+  Tree::TreeVector trees;
+  for (size_t i = 0; i < copy_count; i++) {
+    trees.insert(trees.end(), topologies.Trees().begin(), topologies.Trees().end());
+  }
+  const TreeCollection collection(std::move(trees), topologies.TagTaxonMap());
+  const std::string newick_path = "_noodle_trees.nwk";
+  const std::string binary_path = "_noodle_trees.trees";
+  std::ofstream(newick_path) << collection.Newick();
+  auto time = [](const std::string& name, auto f) {
+    const auto t_start = now();
+    const auto tree_count = f();
+    std::chrono::duration<double> duration = now() - t_start;
+    std::cout << name << " time: " << duration.count() << " seconds for " << tree_count
+              << " trees\n";
+  };
+  time("Newick parsing",
+       [&]() { return driver.ParseNewickFile(newick_path).TreeCount(); });
+  time("tree collection file writing", [&]() {
+    TreeCollectionFile::Write(binary_path, collection);
+    return collection.TreeCount();
+  });
+  time("tree collection file reading", [&]() {
+    return TreeCollectionFile::ReadTreeCollection(binary_path).TreeCount();
+  });
+  std::remove(newick_path.c_str());
+  std::remove(binary_path.c_str());
+}
+
+void NewickWritingTiming() {
+  const size_t copy_count = 10000;
+  Driver driver;
+  const auto sample = driver.ParseNexusFile("data/DS1.subsampled_10.t");
+  Tree::TreeVector trees;
+  for (size_t i = 0; i < copy_count; i++) {
+    trees.insert(trees.end(), sample.Trees().begin(), sample.Trees().end());
+  }
+  const TreeCollection collection(std::move(trees), sample.TagTaxonMap());
+  const std::string path = "_noodle_trees.nwk";
+  auto time = [&collection](const std::string& name, auto f) {
+    const auto t_start = now();
+    f();
+    std::chrono::duration<double> duration = now() - t_start;
+    std::cout << name << " time: " << duration.count() << " seconds for "
+              << collection.TreeCount() << " trees\n";
+  };
+  std::string expected;
+  time("Node::Newick writing", [&]() {
+    for (const auto& tree : collection.Trees()) {
+      expected.append(tree.Newick(collection.TagTaxonMap()));
+      expected.push_back('\n');
+    }
+    std::ofstream(path) << expected;
+  });
+  for (const size_t thread_count : {1, 4}) {
+    time("NewickWriter writing on " + std::to_string(thread_count) + " threads",
+         [&]() { collection.ToNewickFile(path, thread_count); });
+  }
+  Assert(std::string(MmappedFile(path).View()) == expected,
+         "NewickWriter output differs from Node::Newick.");
+  std::remove(path.c_str());
+}
+
+void TreeFileRangeTiming() {
+  const size_t copy_count = 10000;
+  Driver driver;
+  const auto sample = driver.ParseNexusFile("data/DS1.subsampled_10.t");
+  Tree::TreeVector trees;
+  for (size_t i = 0; i < copy_count; i++) {
+    trees.insert(trees.end(), sample.Trees().begin(), sample.Trees().end());
+  }
+  const TreeCollection collection(std::move(trees), sample.TagTaxonMap());
+  const std::string path = "_noodle_trees.nwk";
+  collection.ToNewickFile(path);
+  const size_t tree_count = collection.TreeCount();
+  auto time = [](const std::string& name, auto f) {
+    const auto t_start = now();
+    const auto parsed_count = f();
+    std::chrono::duration<double> duration = now() - t_start;
+    std::cout << name << " time: " << duration.count() << " seconds for "
+              << parsed_count << " trees\n";
+  };
+  time("parsing everything and keeping the last 1000", [&]() {
+    auto parsed = driver.ParseNewickFile(path);
+    parsed.Erase(0, tree_count - 1000);
+    return parsed.TreeCount();
+  });
+  std::remove(TreeFileIndex::SidecarPath(path).c_str());
+  time("indexing and parsing the last 1000", [&]() {
+    return driver.ParseNewickFileRange(path, tree_count - 1000, tree_count).TreeCount();
+  });
+  time("parsing the last 1000 through the index", [&]() {
+    return driver.ParseNewickFileRange(path, tree_count - 1000, tree_count).TreeCount();
+  });
+  time("parsing every 100th through the index", [&]() {
+    return driver.ParseNewickFileRange(path, 0, tree_count, 100).TreeCount();
+  });
+  std::remove(TreeFileIndex::SidecarPath(path).c_str());
+  std::remove(path.c_str());
+}
+
+// Time reading a big FASTA file and compressing it into site patterns.
+void AlignmentTiming(size_t taxon_count, size_t site_count) {
+  const std::string path = "_noodle_alignment.fasta";
+  std::mt19937 random_engine(1);
+  std::uniform_int_distribution<size_t> symbol_distribution(0, 19);
+  TagStringMap tag_taxon_map;
+  {
+    // Each site is mostly one nucleotide, with the odd gap and substitution.
+    const std::string symbols = "AAAAAAAAAAAAAAAACGT-";
+    std::ofstream out(path);
+    for (size_t taxon = 0; taxon < taxon_count; taxon++) {
+      const std::string name = "taxon_" + std::to_string(taxon);
+      SafeInsert(tag_taxon_map, PackInts(static_cast<uint32_t>(taxon), 1), name);
+      out << ">" << name << "\n";
+      for (size_t site = 0; site < site_count; site++) {
+        out << symbols[(symbol_distribution(random_engine) + site) % symbols.size()];
+        if (site % 80 == 79 || site + 1 == site_count) {
+          out << "\n";
+        }
+      }
+    }
+  }
+  auto t_start = now();
+  const auto alignment = Alignment::ReadFasta(path);
+  std::chrono::duration<double> read_duration = now() - t_start;
+  t_start = now();
+  const SitePattern site_pattern(alignment, tag_taxon_map);
+  std::chrono::duration<double> compress_duration = now() - t_start;
+  std::cout << "FASTA reading time: " << read_duration.count()
+            << " seconds, site pattern time: " << compress_duration.count()
+            << " seconds for " << taxon_count << " taxa and " << site_count
+            << " sites (" << site_pattern.PatternCount() << " patterns)\n";
+  std::remove(path.c_str());
+}
+
+// Time likelihood calls on a few trees at a time, as an optimization loop makes them,
+// along with the cost of just handing out that many work items to the threads: first
+// with a TaskProcessor per call (which is what the Engine used to do) and then with a
+// ThreadPool that lives across calls.
+void LikelihoodCallTiming(size_t thread_count) {
+  const size_t total_tree_count = 10000;
+  UnrootedSBNInstance inst("noodle");
+  inst.ReadNexusFile("data/DS1.subsampled_10.t");
+  inst.ReadFastaFile("data/DS1.fasta");
+  const auto sample = inst.tree_collection_;
+  const PhyloModelSpecification specification{"JC69", "constant", "strict"};
+  ThreadPool thread_pool(thread_count);
+  for (const size_t tree_count : {10, 100, 1000}) {
+    const size_t call_count = total_tree_count / tree_count;
+    auto time = [call_count](const std::string& name, auto f) {
+      const auto t_start = now();
+      for (size_t call = 0; call < call_count; call++) {
+        f();
+      }
+      std::chrono::duration<double> duration = now() - t_start;
+      std::cout << name << " time: " << 1e6 * duration.count() / call_count
+                << " microseconds per call\n";
+    };
+    std::cout << tree_count << " trees on " << thread_count << " threads:\n";
+    time("  dispatch with a TaskProcessor per call", [&]() {
+      std::queue<size_t> thread_queue;
+      std::queue<size_t> work_queue;
+      for (size_t i = 0; i < thread_count; i++) {
+        thread_queue.push(i);
+      }
+      for (size_t i = 0; i < tree_count; i++) {
+        work_queue.push(i);
+      }
+      TaskProcessor<size_t, size_t> task_processor(
+          std::move(thread_queue), std::move(work_queue), [](size_t, size_t) {});
+      task_processor.Wait();
+    });
+    time("  dispatch with a ThreadPool",
+         [&]() { thread_pool.ParallelFor(tree_count, [](size_t, size_t) {}); });
+    UnrootedTree::UnrootedTreeVector trees;
+    for (size_t i = 0; i < tree_count; i++) {
+      trees.push_back(sample.GetTree(i % sample.TreeCount()));
+    }
+    inst.tree_collection_ =
+        UnrootedTreeCollection(std::move(trees), sample.TagTaxonMap());
+    inst.PrepareForPhyloLikelihood(specification, thread_count);
+    time("  Engine log likelihoods", [&]() { inst.LogLikelihoods(); });
   }
+}
 
-  std::chrono::duration<double> duration = now() - t_start;
-  std::cout << "time: " << duration.count() << " seconds\n";
+// Time handing out a lot of cheap work items to threads, through a TaskProcessor and
+// a ThreadPool, along with likelihoods of 100 DS1 trees, on 1 to 64 threads.
+void SchedulingTiming() {
+  const size_t work_count = 1000000;
+  const size_t tree_count = 100;
+  UnrootedSBNInstance inst("noodle");
+  inst.ReadNexusFile("data/DS1.subsampled_10.t");
+  inst.ReadFastaFile("data/DS1.fasta");
+  UnrootedTree::UnrootedTreeVector trees;
+  for (size_t i = 0; i < tree_count; i++) {
+    trees.push_back(inst.tree_collection_.GetTree(i % inst.TreeCount()));
+  }
+  inst.tree_collection_ = UnrootedTreeCollection(std::move(trees), inst.TagTaxonMap());
+  const PhyloModelSpecification specification{"JC69", "constant", "strict"};
+  std::vector<double> results(work_count);
+  auto cheap_task = [&results](size_t, size_t work) {
+    results[work] = std::sqrt(static_cast<double>(work));
+  };
+  auto time = [](auto f) {
+    const auto t_start = now();
+    f();
+    std::chrono::duration<double> duration = now() - t_start;
+    return duration.count();
+  };
+  for (const size_t thread_count : {1, 2, 4, 8, 16, 32, 64}) {
+    std::queue<size_t> thread_queue;
+    std::queue<size_t> work_queue;
+    for (size_t i = 0; i < thread_count; i++) {
+      thread_queue.push(i);
+    }
+    for (size_t i = 0; i < work_count; i++) {
+      work_queue.push(i);
+    }
+    const double task_processor_time = time([&]() {
+      TaskProcessor<size_t, size_t> task_processor(
+          std::move(thread_queue), std::move(work_queue), cheap_task);
+      task_processor.Wait();
+    });
+    ThreadPool thread_pool(thread_count);
+    const double thread_pool_time =
+        time([&]() { thread_pool.ParallelFor(work_count, cheap_task); });
+    inst.PrepareForPhyloLikelihood(specification, thread_count);
+    const double likelihood_time = time([&]() { inst.LogLikelihoods(); });
+    std::cout << thread_count << " threads: " << work_count
+              << " cheap tasks through a TaskProcessor in " << task_processor_time
+              << " seconds, through a ThreadPool in " << thread_pool_time
+              << " seconds; " << tree_count << " DS1 likelihoods in "
+              << likelihood_time << " seconds\n";
+  }
+}
+
+int main() {
+  PreOrderTiming();
+  NodeArenaTiming();
+  NexusTranslateTiming({100, 1000, 5000});
+  TreeCollectionFileTiming();
+  NewickWritingTiming();
+  TreeFileRangeTiming();
+  AlignmentTiming(1000, 20000);
+  LikelihoodCallTiming(1);
+  LikelihoodCallTiming(4);
+  SchedulingTiming();
+  // DS1 has 27 taxa.
+  BitsetHashTiming(27);
+  BitsetHashTiming(500);
 }
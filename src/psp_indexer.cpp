@@ -44,17 +44,26 @@ StringVector PSPIndexer::ToStringVector() const {
 }
 
 SizeVectorVector PSPIndexer::RepresentationOf(const Node::NodePtr& topology) const {
+  return RepresentationOf(FlatTopology(topology));
+}
+
+SizeVectorVector PSPIndexer::RepresentationOf(const FlatTopology& topology) const {
   Assert(first_empty_index_ > 0, "This PSPIndexer is uninitialized.");
-  SizeVector rootsplit_result(topology->Id(), first_empty_index_);
-  SizeVector psp_result_down(topology->Id(), first_empty_index_);
-  SizeVector psp_result_up(topology->Id(), first_empty_index_);
-  const auto leaf_count = topology->LeafCount();
+  Assert(topology.IsRootTrifurcating(),
+         "PSPIndexer::RepresentationOf expects a tree with a trifurcation at the "
+         "root.");
+  const auto root_id = topology.RootId();
+  SizeVector rootsplit_result(root_id, first_empty_index_);
+  SizeVector psp_result_down(root_id, first_empty_index_);
+  SizeVector psp_result_up(root_id, first_empty_index_);
+  const auto leaf_count = topology.LeafCount();
+  const auto leaves = topology.Leaves<Bitset>();
   Bitset rootsplit_bitset(leaf_count);
   Bitset psp_bitset(2 * leaf_count);
-  auto rootsplit_index = [&rootsplit_bitset,
-                          &indexer = this->indexer_](const Node* node) {
+  auto rootsplit_index = [&rootsplit_bitset, &leaves,
+                          &indexer = this->indexer_](FlatTopology::Id id) {
     rootsplit_bitset.Zero();
-    rootsplit_bitset.CopyFrom(node->Leaves(), 0, false);
+    rootsplit_bitset.CopyFrom(leaves[id], 0, false);
     rootsplit_bitset.Minorize();
     return indexer.at(rootsplit_bitset);
   };
@@ -70,23 +79,33 @@ SizeVectorVector PSPIndexer::RepresentationOf(const Node::NodePtr& topology) con
     psp_bitset.CopyFrom(std::min(z1, z2), leaf_count, false);
     return indexer.at(psp_bitset);
   };
-  topology->TriplePreOrder(
-      // f_root
-      [&rootsplit_result, &psp_result_up, &rootsplit_index, &psp_index](
-          const Node* node0, const Node* node1, const Node* node2) {
-        rootsplit_result[node0->Id()] = rootsplit_index(node0);
-        psp_result_up[node0->Id()] =
-            psp_index(node1->Leaves(), node2->Leaves(), ~node0->Leaves());
-      },
-      // f_internal
-      [&rootsplit_result, &psp_result_up, &psp_result_down, &rootsplit_index,
-       &psp_index](const Node* node, const Node* sister, const Node* parent) {
-        rootsplit_result[node->Id()] = rootsplit_index(node);
-        psp_result_up[node->Id()] =
-            psp_index(~parent->Leaves(), sister->Leaves(), ~node->Leaves());
-        psp_result_down[parent->Id()] =
-            psp_index(node->Leaves(), sister->Leaves(), parent->Leaves());
-      });
+  // The edges below the root, each paired with the other two root children.
+  const FlatTopology::Id root_children[3] = {topology.Child0Id(root_id),
+                                             topology.Child1Id(root_id),
+                                             topology.RootChild2Id()};
+  for (size_t i = 0; i < 3; i++) {
+    const auto node_id = root_children[i];
+    rootsplit_result[node_id] = rootsplit_index(node_id);
+    psp_result_up[node_id] = psp_index(leaves[root_children[(i + 1) % 3]],
+                                       leaves[root_children[(i + 2) % 3]],
+                                       ~leaves[node_id]);
+  }
+  // The edges below all of the other internal nodes, which are bifurcating.
+  for (const auto parent_id : topology.PreOrder()) {
+    if (parent_id == root_id || topology.IsLeaf(parent_id)) {
+      continue;
+    }
+    const auto child0_id = topology.Child0Id(parent_id);
+    const auto child1_id = topology.Child1Id(parent_id);
+    for (const auto& [node_id, sister_id] :
+         {std::make_pair(child0_id, child1_id), std::make_pair(child1_id, child0_id)}) {
+      rootsplit_result[node_id] = rootsplit_index(node_id);
+      psp_result_up[node_id] =
+          psp_index(~leaves[parent_id], leaves[sister_id], ~leaves[node_id]);
+      psp_result_down[parent_id] =
+          psp_index(leaves[node_id], leaves[sister_id], leaves[parent_id]);
+    }
+  }
   return {rootsplit_result, psp_result_down, psp_result_up};
 }
 
@@ -112,7 +131,7 @@ DoubleVectorVector PSPIndexer::SplitLengths(
   for (size_t tree_index = 0; tree_index < tree_count; tree_index++) {
     const auto& tree = tree_collection.GetTree(tree_index);
     // The 0th part of the PSP representation is the rootsplit vector.
-    auto split_indices = RepresentationOf(tree.Topology())[0];
+    auto split_indices = RepresentationOf(tree.Flat())[0];
     const auto branch_lengths = tree.BranchLengths();
     for (size_t edge_index = 0; edge_index < split_indices.size(); edge_index++) {
       result[split_indices[edge_index]].push_back(branch_lengths[edge_index]);
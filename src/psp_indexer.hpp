@@ -53,6 +53,7 @@ class PSPIndexer {
 
   // Get the PSP representation of a given topology.
   SizeVectorVector RepresentationOf(const Node::NodePtr& topology) const;
+  SizeVectorVector RepresentationOf(const FlatTopology& topology) const;
   // Get the string version of the representation.
   // Inefficiently implemented, so for testing only.
   StringVectorVector StringRepresentationOf(const Node::NodePtr& topology) const;
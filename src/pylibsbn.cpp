@@ -82,6 +82,9 @@ PYBIND11_MODULE(libsbn, m) {
            py::arg("fraction"))
       .def("newick", &RootedTreeCollection::Newick,
            "Get the current set of trees as a big Newick string.")
+      .def("to_newick_file", &RootedTreeCollection::ToNewickFile,
+           "Write the current set of trees to a Newick file, one tree per line.",
+           py::arg("path"), py::arg("thread_count") = 0)
       .def_readwrite("trees", &RootedTreeCollection::trees_);
 
   // CLASS
@@ -124,6 +127,9 @@ PYBIND11_MODULE(libsbn, m) {
            py::arg("fraction"))
       .def("newick", &UnrootedTreeCollection::Newick,
            "Get the current set of trees as a big Newick string.")
+      .def("to_newick_file", &UnrootedTreeCollection::ToNewickFile,
+           "Write the current set of trees to a Newick file, one tree per line.",
+           py::arg("path"), py::arg("thread_count") = 0)
       .def_readwrite("trees", &UnrootedTreeCollection::trees_);
 
   // UnrootedPhyloGradient
@@ -233,6 +239,10 @@ PYBIND11_MODULE(libsbn, m) {
            "Read trees from a Newick file.")
       .def("read_nexus_file", &RootedSBNInstance::ReadNexusFile,
            "Read trees from a Nexus file.")
+      .def("read_tree_collection_file", &RootedSBNInstance::ReadTreeCollectionFile,
+           "Read trees from a binary tree collection file.")
+      .def("write_tree_collection_file", &RootedSBNInstance::WriteTreeCollectionFile,
+           "Write the trees to a binary tree collection file.")
 
       // ** Member variables
       .def_readwrite("tree_collection", &RootedSBNInstance::tree_collection_);
@@ -336,6 +346,10 @@ PYBIND11_MODULE(libsbn, m) {
            "Read trees from a Newick file.")
       .def("read_nexus_file", &UnrootedSBNInstance::ReadNexusFile,
            "Read trees from a Nexus file.")
+      .def("read_tree_collection_file", &UnrootedSBNInstance::ReadTreeCollectionFile,
+           "Read trees from a binary tree collection file.")
+      .def("write_tree_collection_file", &UnrootedSBNInstance::WriteTreeCollectionFile,
+           "Write the trees to a binary tree collection file.")
 
       // ** Member variables
       .def_readonly("psp_indexer", &UnrootedSBNInstance::psp_indexer_)
@@ -38,3 +38,7 @@ void RootedSBNInstance::ReadNexusFile(std::string fname) {
   tree_collection_.ParseDatesFromTaxonNames();
   tree_collection_.InitializeParameters();
 }
+
+void RootedSBNInstance::ReadTreeCollectionFile(const std::string &fname) {
+  tree_collection_ = TreeCollectionFile::ReadRootedTreeCollection(fname);
+}
@@ -34,10 +34,15 @@ class RootedSBNInstance : public PreRootedSBNInstance {
 
   void ReadNewickFile(std::string fname);
   void ReadNexusFile(std::string fname);
+  // The rooted tree parameters come from the file, rather than being initialized.
+  void ReadTreeCollectionFile(const std::string& fname);
 };
 
 #ifdef DOCTEST_LIBRARY_INCLUDED
 
+#include <fstream>
+#include <random>
+
 #include "doctest_constants.hpp"
 
 // Centered finite difference approximation of the derivative wrt rate.
@@ -265,6 +270,71 @@ TEST_CASE("RootedSBNInstance: Weibull gradients") {
   CHECK_LT(fabs(gradients[0].log_likelihood_ - physher_ll), 0.001);
 }
 
+TEST_CASE("RootedSBNInstance: likelihood and gradient over pattern blocks") {
+  // A time tree and a random alignment with enough site patterns to split between
+  // threads.
+  const std::string newick_path = "_rooted_sbn_instance_test.nwk";
+  const std::string fasta_path = "_rooted_sbn_instance_test.fasta";
+  {
+    std::ofstream newick_file(newick_path);
+    newick_file << "((x0:1,x1:1):1,(x2:1.5,(x3:0.5,x4:0.5):1):0.5);\n";
+    std::ofstream fasta_file(fasta_path);
+    std::mt19937 random_engine(1);
+    std::uniform_int_distribution<size_t> state_distribution(0, 3);
+    for (size_t taxon = 0; taxon < 5; taxon++) {
+      fasta_file << ">x" << taxon << "\n";
+      for (size_t site = 0; site < 2000; site++) {
+        fasta_file << "ACGT"[state_distribution(random_engine)];
+      }
+      fasta_file << "\n";
+    }
+  }
+  RootedSBNInstance inst("charlie");
+  PhyloModelSpecification simple_specification{"JC69", "weibull+4", "strict"};
+  inst.ReadNewickFile(newick_path);
+  inst.ReadFastaFile(fasta_path);
+  inst.PrepareForPhyloLikelihood(simple_specification, 1);
+  for (auto& tree : inst.tree_collection_.trees_) {
+    tree.rates_.assign(tree.rates_.size(), 0.1);
+  }
+  inst.GetPhyloModelParamBlockMap().at(WeibullSiteModel::shape_key_).setConstant(0.1);
+  EigenMatrixXd params = inst.GetPhyloModelParams();
+  const SitePattern site_pattern(Alignment::ReadFasta(fasta_path), inst.TagTaxonMap());
+  std::remove(newick_path.c_str());
+  std::remove(fasta_path.c_str());
+  const std::vector<BeagleFlags> beagle_flags;
+  const Engine tree_engine({1, beagle_flags, true}, simple_specification,
+                           site_pattern);
+  const Engine pattern_engine({4, beagle_flags, true}, simple_specification,
+                              site_pattern);
+  CHECK_EQ(tree_engine.PatternBlockCount(), 0);
+  CHECK_GT(pattern_engine.PatternBlockCount(), 1);
+  auto check_close = [](const std::vector<double>& pattern_values,
+                        const std::vector<double>& values) {
+    REQUIRE_EQ(pattern_values.size(), values.size());
+    for (size_t i = 0; i < values.size(); i++) {
+      CHECK_LT(fabs(pattern_values[i] - values[i]), 1e-8);
+    }
+  };
+  for (const bool rescaling : {false, true}) {
+    const auto likelihood =
+        tree_engine.LogLikelihoods(inst.tree_collection_, params, rescaling)[0];
+    CHECK_LT(fabs(pattern_engine.LogLikelihoods(inst.tree_collection_, params,
+                                                rescaling)[0] -
+                  likelihood),
+             1e-8);
+    const auto gradient =
+        tree_engine.Gradients(inst.tree_collection_, params, rescaling)[0];
+    const auto pattern_gradient =
+        pattern_engine.Gradients(inst.tree_collection_, params, rescaling)[0];
+    CHECK_LT(fabs(pattern_gradient.log_likelihood_ - gradient.log_likelihood_), 1e-8);
+    check_close(pattern_gradient.branch_lengths_, gradient.branch_lengths_);
+    check_close(pattern_gradient.site_model_, gradient.site_model_);
+    check_close(pattern_gradient.ratios_root_height_, gradient.ratios_root_height_);
+    check_close(pattern_gradient.clock_model_, gradient.clock_model_);
+  }
+}
+
 TEST_CASE("RootedSBNInstance: parsing dates") {
   RootedSBNInstance inst("charlie");
   inst.ReadNexusFile("data/test_beast_tree_parsing.nexus");
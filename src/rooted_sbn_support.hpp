@@ -15,6 +15,16 @@ class RootedSBNSupport : public SBNSupport {
     std::tie(rootsplits_, indexer_, index_to_child_, parent_to_range_, gpcsp_count_) =
         SBNMaps::BuildIndexerBundle(RootedSBNMaps::RootsplitCounterOf(topologies),
                                     RootedSBNMaps::PCSPCounterOf(topologies));
+    BuildSubsplitIds();
+  }
+  // Build the support from rootsplit and PCSP counters, such as those of an
+  // OnlineSBNCounter.
+  explicit RootedSBNSupport(const BitsetSizeDict &rootsplit_counter,
+                            const PCSPDict &pcsp_counter, StringVector taxon_names)
+      : SBNSupport(std::move(taxon_names)) {
+    std::tie(rootsplits_, indexer_, index_to_child_, parent_to_range_, gpcsp_count_) =
+        SBNMaps::BuildIndexerBundle(rootsplit_counter, pcsp_counter);
+    BuildSubsplitIds();
   }
 
   RootedIndexerRepresentationCounter IndexerRepresentationCounterOf(
@@ -12,32 +12,41 @@
 
 SizeBitsetMap SBNMaps::IdIdSetMapOf(const Node::NodePtr& topology) {
   SizeBitsetMap map;
-  auto id_count = topology->Id() + 1;
-  topology->PostOrder([&map, id_count](const Node* node) {
-    Bitset bitset(static_cast<size_t>(id_count));
-    Assert(node->Id() < id_count, "Malformed ids in IdIdSetMapOf.");
+  const FlatTopology flat(topology);
+  const auto id_count = flat.NodeCount();
+  std::vector<Bitset> id_sets(id_count, Bitset(id_count));
+  for (const auto id : flat.PostOrder()) {
+    Bitset& bitset = id_sets[id];
     // Set the bit for the id of the current edge.
-    bitset.set(node->Id());
+    bitset.set(id);
     // Take the union of the children below.
-    for (const auto& child : node->Children()) {
-      bitset |= map.at(child->Id());
+    if (!flat.IsLeaf(id)) {
+      bitset |= id_sets[flat.Child0Id(id)];
+      bitset |= id_sets[flat.Child1Id(id)];
     }
-    SafeInsert(map, node->Id(), std::move(bitset));
-  });
+  }
+  if (flat.IsRootTrifurcating()) {
+    id_sets[flat.RootId()] |= id_sets[flat.RootChild2Id()];
+  }
+  map.reserve(id_count);
+  for (const auto id : flat.PostOrder()) {
+    SafeInsert(map, static_cast<size_t>(id), std::move(id_sets[id]));
+  }
   return map;
 }
 
 SizeVector SBNMaps::SplitIndicesOf(const BitsetSizeMap& indexer,
                                    const Node::NodePtr& topology) {
-  SizeVector split_result(topology->Id());
-  topology->PreOrder([&topology, &split_result, &indexer](const Node* node) {
-    // Skip the root.
-    if (node != topology.get()) {
-      Bitset rootsplit = node->Leaves();
-      rootsplit.Minorize();
-      split_result[node->Id()] = indexer.at(rootsplit);
-    }
-  });
+  const FlatTopology flat(topology);
+  const auto leaves = flat.Leaves<Bitset>();
+  SizeVector split_result(flat.RootId());
+  // Skip the root, which comes first in the preorder.
+  for (size_t i = 1; i < flat.PreOrder().size(); i++) {
+    const auto id = flat.PreOrder()[i];
+    Bitset rootsplit = leaves[id];
+    rootsplit.Minorize();
+    split_result[id] = indexer.at(rootsplit);
+  }
   return split_result;
 }
 
@@ -75,6 +84,14 @@ IndexerBundle SBNMaps::BuildIndexerBundle(const BitsetSizeDict& rootsplit_counte
   BitsetSizeMap indexer;
   SizeBitsetMap index_to_child;
   BitsetSizePairMap parent_to_range;
+  size_t pcsp_count = 0;
+  for (const auto& [_, child_counter] : pcsp_counter) {
+    pcsp_count += child_counter.size();
+  }
+  rootsplits.reserve(rootsplit_counter.size());
+  indexer.reserve(rootsplit_counter.size() + pcsp_count);
+  index_to_child.reserve(pcsp_count);
+  parent_to_range.reserve(pcsp_counter.size());
   size_t index = 0;
   // Start by adding the rootsplits.
   for (const auto& iter : rootsplit_counter) {
@@ -95,6 +112,64 @@ IndexerBundle SBNMaps::BuildIndexerBundle(const BitsetSizeDict& rootsplit_counte
   return {rootsplits, indexer, index_to_child, parent_to_range, index};
 }
 
+void SBNMaps::AddToRootsplitCounter(BitsetSizeDict& rootsplit_counter,
+                                    const BitsetSizeDict& other) {
+  for (const auto& [rootsplit, count] : other) {
+    rootsplit_counter.increment(rootsplit, count);
+  }
+}
+
+void SBNMaps::AddToPCSPCounter(PCSPDict& pcsp_counter, const PCSPDict& other) {
+  for (const auto& [parent, child_counter] : other) {
+    auto search = pcsp_counter.find(parent);
+    if (search == pcsp_counter.end()) {
+      SafeInsert(pcsp_counter, parent, child_counter);
+    } else {
+      for (const auto& [child, count] : child_counter) {
+        search->second.increment(child, count);
+      }
+    }
+  }
+}
+
+OnlineSBNCounter::OnlineSBNCounter(RootsplitCounterFunction rootsplit_counter_function,
+                                   PCSPCounterFunction pcsp_counter_function,
+                                   size_t pending_capacity)
+    : rootsplit_counter_function_(rootsplit_counter_function),
+      pcsp_counter_function_(pcsp_counter_function),
+      pending_capacity_(pending_capacity),
+      rootsplit_counter_(0) {
+  Assert(pending_capacity_ > 0, "OnlineSBNCounter needs a positive capacity.");
+}
+
+void OnlineSBNCounter::Add(const Node::NodePtr& topology, uint32_t count) {
+  pending_topologies_[topology] += count;
+  topology_count_ += count;
+  if (pending_topologies_.size() >= pending_capacity_) {
+    Flush();
+  }
+}
+
+void OnlineSBNCounter::Flush() {
+  if (pending_topologies_.empty()) {
+    return;
+  }
+  SBNMaps::AddToRootsplitCounter(rootsplit_counter_,
+                                 rootsplit_counter_function_(pending_topologies_));
+  SBNMaps::AddToPCSPCounter(pcsp_counter_, pcsp_counter_function_(pending_topologies_));
+  pending_topologies_.clear();
+}
+
+const BitsetSizeDict& OnlineSBNCounter::RootsplitCounter() {
+  Flush();
+  return rootsplit_counter_;
+}
+
+const PCSPDict& OnlineSBNCounter::PCSPCounter() {
+  Flush();
+  return pcsp_counter_;
+}
+
 BitsetSizeDict UnrootedSBNMaps::RootsplitCounterOf(
     const Node::TopologyCounter& topologies) {
   BitsetSizeDict rootsplit_counter(0);
@@ -145,7 +220,138 @@ void AddToPCSPDict(PCSPDict& pcsp_dict, const size_t topology_count,
   }
 }
 
+// A PCSP counter that works with FixedBitsets of a given word count, which hold
+// the PCSP parents (and hence also the clades). Before traversing a topology, call
+// SetTopology so that we have a FixedBitset of the leaves below each node; then the
+// PCSPs get built without touching the heap. Finally, ToPCSPDict converts the
+// counts back to our usual Bitset-keyed PCSPDict.
+template <size_t WordCount>
+class FixedPCSPCounter {
+ public:
+  using FixedBitsetType = FixedBitset<WordCount>;
+
+  explicit FixedPCSPCounter(size_t leaf_count) : leaf_count_(leaf_count) {
+    Assert(2 * leaf_count <= FixedBitsetType::Capacity,
+           "Too many leaves for FixedPCSPCounter.");
+  }
+
+  void SetTopology(const FlatTopology& topology) {
+    Assert(topology.LeafCount() == leaf_count_,
+           "FixedPCSPCounter requires topologies to have the same leaf count.");
+    leaves_ = topology.Leaves<FixedBitsetType>();
+  }
+
+  // See the comments above the definition of UnrootedPCSPFun to understand the
+  // collection of arguments starting with `sister_id`; here we pass node ids
+  // rather than nodes.
+  void Add(size_t topology_count, size_t sister_id, bool sister_direction,
+           size_t focal_id, bool focal_direction, size_t child0_id,
+           bool child0_direction, size_t child1_id, bool child1_direction) {
+    FixedBitsetType parent(2 * leaf_count_);
+    parent.CopyFrom(leaves_[sister_id], 0, sister_direction);
+    parent.CopyFrom(leaves_[focal_id], leaf_count_, focal_direction);
+    auto child0 = leaves_[child0_id];
+    if (child0_direction) {
+      child0.flip();
+    }
+    auto child1 = leaves_[child1_id];
+    if (child1_direction) {
+      child1.flip();
+    }
+    counts_[parent][std::min(child0, child1)] += topology_count;
+  }
+
+  PCSPDict ToPCSPDict() const {
+    PCSPDict pcsp_dict;
+    for (const auto& [parent, child_counts] : counts_) {
+      BitsetSizeDict child_dict(0);
+      for (const auto& [child, count] : child_counts) {
+        child_dict.increment(child.ToBitset(), count);
+      }
+      SafeInsert(pcsp_dict, parent.ToBitset(), std::move(child_dict));
+    }
+    return pcsp_dict;
+  }
+
+ private:
+  size_t leaf_count_;
+  // The leaves below each node of the current topology, indexed by node id.
+  std::vector<FixedBitsetType> leaves_;
+  FlatHashMap<FixedBitsetType, FlatHashMap<FixedBitsetType, size_t>> counts_;
+};
+
+// The leaf count of the topologies in a nonempty TopologyCounter.
+size_t LeafCountOf(const Node::TopologyCounter& topologies) {
+  Assert(!topologies.empty(), "LeafCountOf needs a nonempty TopologyCounter.");
+  return topologies.begin()->first->LeafCount();
+}
+
+// Count the PCSPs of unrooted topologies using FixedPCSPCounter.
+template <size_t WordCount>
+PCSPDict FixedUnrootedPCSPCounterOf(const Node::TopologyCounter& topologies) {
+  FixedPCSPCounter<WordCount> counter(LeafCountOf(topologies));
+  for (const auto& [topology, topology_count] : topologies) {
+    Assert(topology->Children().size() == 3,
+           "UnrootedSBNMaps::PCSPCounterOf was expecting a tree with a trifurcation at "
+           "the root!");
+    counter.SetTopology(FlatTopology(topology));
+    topology->UnrootedPCSPPreOrder(
+        [&counter, &topology_count = topology_count](
+            const Node* sister_node, bool sister_direction, const Node* focal_node,
+            bool focal_direction, const Node* child0_node, bool child0_direction,
+            const Node* child1_node, bool child1_direction,
+            const Node*  // ignore virtual root clade
+        ) {
+          counter.Add(topology_count, sister_node->Id(), sister_direction,
+                      focal_node->Id(), focal_direction, child0_node->Id(),
+                      child0_direction, child1_node->Id(), child1_direction);
+        });
+  }
+  return counter.ToPCSPDict();
+}
+
+// Count the PCSPs of rooted topologies using FixedPCSPCounter.
+template <size_t WordCount>
+PCSPDict FixedRootedPCSPCounterOf(const Node::TopologyCounter& topologies) {
+  FixedPCSPCounter<WordCount> counter(LeafCountOf(topologies));
+  for (const auto& [topology, topology_count] : topologies) {
+    Assert(topology->Children().size() == 2,
+           "RootedSBNMaps::PCSPCounterOf was expecting a bifurcating tree!");
+    const FlatTopology flat(topology);
+    counter.SetTopology(flat);
+    // As in Node::RootedPCSPPreOrder, each internal node other than the root is the
+    // focal node of a PCSP whose parent subsplit is (sister, focal).
+    for (const auto focal_id : flat.PreOrder()) {
+      if (focal_id != flat.RootId() && !flat.IsLeaf(focal_id)) {
+        counter.Add(topology_count, flat.SisterId(focal_id), false, focal_id, false,
+                    flat.Child0Id(focal_id), false, flat.Child1Id(focal_id), false);
+      }
+    }
+  }
+  return counter.ToPCSPDict();
+}
+
+// Count PCSPs using FixedBitsets if the PCSP parents fit in at most 8 words, and
+// otherwise fall back to dynamic Bitsets.
 PCSPDict UnrootedSBNMaps::PCSPCounterOf(const Node::TopologyCounter& topologies) {
+  if (topologies.empty()) {
+    return {};
+  }
+  return DispatchOnBitCount(
+      2 * LeafCountOf(topologies),
+      [&topologies](auto word_count) {
+        return FixedUnrootedPCSPCounterOf<decltype(word_count)::value>(topologies);
+      },
+      [&topologies]() { return UnrootedSBNMaps::DynamicPCSPCounterOf(topologies); });
+}
+
+OnlineSBNCounter UnrootedSBNMaps::OnlineCounter(size_t pending_capacity) {
+  return OnlineSBNCounter(UnrootedSBNMaps::RootsplitCounterOf,
+                          UnrootedSBNMaps::PCSPCounterOf, pending_capacity);
+}
+
+PCSPDict UnrootedSBNMaps::DynamicPCSPCounterOf(
+    const Node::TopologyCounter& topologies) {
   PCSPDict pcsp_dict;
   for (const auto& [topology, topology_count] : topologies) {
     auto leaf_count = topology->LeafCount();
@@ -273,6 +479,23 @@ BitsetSizeDict RootedSBNMaps::RootsplitCounterOf(
 }
 
 PCSPDict RootedSBNMaps::PCSPCounterOf(const Node::TopologyCounter& topologies) {
+  if (topologies.empty()) {
+    return {};
+  }
+  return DispatchOnBitCount(
+      2 * LeafCountOf(topologies),
+      [&topologies](auto word_count) {
+        return FixedRootedPCSPCounterOf<decltype(word_count)::value>(topologies);
+      },
+      [&topologies]() { return RootedSBNMaps::DynamicPCSPCounterOf(topologies); });
+}
+
+OnlineSBNCounter RootedSBNMaps::OnlineCounter(size_t pending_capacity) {
+  return OnlineSBNCounter(RootedSBNMaps::RootsplitCounterOf,
+                          RootedSBNMaps::PCSPCounterOf, pending_capacity);
+}
+
+PCSPDict RootedSBNMaps::DynamicPCSPCounterOf(const Node::TopologyCounter& topologies) {
   PCSPDict pcsp_dict;
   for (const auto& [topology, topology_count] : topologies) {
     auto leaf_count = topology->LeafCount();
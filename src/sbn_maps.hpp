@@ -14,12 +14,17 @@
 #include "bitset.hpp"
 #include "default_dict.hpp"
 #include "driver.hpp"
+#include "fixed_bitset.hpp"
+#include "flat_hash_map.hpp"
+#include "flat_topology.hpp"
 #include "node.hpp"
 
 using BitsetVector = std::vector<Bitset>;
-using SizeBitsetMap = std::unordered_map<size_t, Bitset>;
-using BitsetSizeMap = std::unordered_map<Bitset, size_t>;
-using BitsetSizePairMap = std::unordered_map<Bitset, std::pair<size_t, size_t>>;
+// The indexers are built once and then looked up many times, so they use the
+// open-addressing FlatHashMap.
+using SizeBitsetMap = FlatHashMap<size_t, Bitset>;
+using BitsetSizeMap = FlatHashMap<Bitset, size_t>;
+using BitsetSizePairMap = FlatHashMap<Bitset, std::pair<size_t, size_t>>;
 using BitsetSizeDict = DefaultDict<Bitset, size_t>;
 using RootedIndexerRepresentation = SizeVector;
 using RootedIndexerRepresentationCounter =
@@ -56,13 +61,56 @@ Bitset PCSPBitsetOf(const size_t leaf_count,  //
                     const Node* child1_node, bool child1_direction);
 IndexerBundle BuildIndexerBundle(const BitsetSizeDict& rootsplit_counter,
                                  const PCSPDict& pcsp_counter);
+// Add the counts of one counter to another.
+void AddToRootsplitCounter(BitsetSizeDict& rootsplit_counter,
+                           const BitsetSizeDict& other);
+void AddToPCSPCounter(PCSPDict& pcsp_counter, const PCSPDict& other);
 }  // namespace SBNMaps
 
+// Build the rootsplit and PCSP counters of topologies that come in one at a time,
+// for example from Driver::StreamNewickFile, without holding on to all of the trees.
+// Equal topologies get counted together: the Node hash serves as their fingerprint,
+// with Node equality to settle collisions. Once we have pending_capacity distinct
+// topologies we fold them into the counters and let them go, so memory stays bounded
+// even if every topology is distinct. Make one with UnrootedSBNMaps::OnlineCounter
+// or RootedSBNMaps::OnlineCounter.
+class OnlineSBNCounter {
+ public:
+  using RootsplitCounterFunction = BitsetSizeDict (*)(const Node::TopologyCounter&);
+  using PCSPCounterFunction = PCSPDict (*)(const Node::TopologyCounter&);
+
+  OnlineSBNCounter(RootsplitCounterFunction rootsplit_counter_function,
+                   PCSPCounterFunction pcsp_counter_function, size_t pending_capacity);
+
+  void Add(const Node::NodePtr& topology, uint32_t count = 1);
+  // Fold the pending topologies into the counters.
+  void Flush();
+  // The number of topologies added, counting multiplicity.
+  size_t TopologyCount() const { return topology_count_; }
+  // The counters of all of the topologies added so far. These flush first.
+  const BitsetSizeDict& RootsplitCounter();
+  const PCSPDict& PCSPCounter();
+
+ private:
+  RootsplitCounterFunction rootsplit_counter_function_;
+  PCSPCounterFunction pcsp_counter_function_;
+  size_t pending_capacity_;
+  Node::TopologyCounter pending_topologies_;
+  BitsetSizeDict rootsplit_counter_;
+  PCSPDict pcsp_counter_;
+  size_t topology_count_ = 0;
+};
+
 namespace UnrootedSBNMaps {
 // Make a DefaultDict mapping rootsplits to the number of times they were seen.
 BitsetSizeDict RootsplitCounterOf(const Node::TopologyCounter& topologies);
 // Make a PCSPDict mapping PCSPs to the number of times they were seen.
+// This dispatches on the number of taxa to use fixed-width bitsets if possible.
 PCSPDict PCSPCounterOf(const Node::TopologyCounter& topologies);
+// The same, but always using dynamic Bitsets.
+PCSPDict DynamicPCSPCounterOf(const Node::TopologyCounter& topologies);
+// Make an online counter for unrooted topologies.
+OnlineSBNCounter OnlineCounter(size_t pending_capacity = 4096);
 // This function gives information about the rootsplits and PCSPs of a given
 // topology with respect to the current indexing data structures.
 // Specifically, it returns a vector of vectors, such that the ith vector is the indices
@@ -93,7 +141,12 @@ namespace RootedSBNMaps {
 // Make a DefaultDict mapping rootsplits to the number of times they were seen.
 BitsetSizeDict RootsplitCounterOf(const Node::TopologyCounter& topologies);
 // Make a PCSPDict mapping PCSPs to the number of times they were seen.
+// This dispatches on the number of taxa to use fixed-width bitsets if possible.
 PCSPDict PCSPCounterOf(const Node::TopologyCounter& topologies);
+// The same, but always using dynamic Bitsets.
+PCSPDict DynamicPCSPCounterOf(const Node::TopologyCounter& topologies);
+// Make an online counter for rooted topologies.
+OnlineSBNCounter OnlineCounter(size_t pending_capacity = 4096);
 // A rooted indexer representation is the indexer representation of a given rooted tree.
 // That is, the first entry is the rootsplit for that rooting, and after that come the
 // PCSP indices.
@@ -125,9 +178,9 @@ void IncrementRootedIndexerRepresentationSizeDict(
 
 // Turn a <Key, T> map into a <std::string, T> map for any Key type that has
 // a ToString method.
-template <class Key, class T>
-std::unordered_map<std::string, T> StringifyMap(std::unordered_map<Key, T> m) {
-  std::unordered_map<std::string, T> m_str;
+template <class Map>
+std::unordered_map<std::string, typename Map::mapped_type> StringifyMap(const Map& m) {
+  std::unordered_map<std::string, typename Map::mapped_type> m_str;
   for (const auto& iter : m) {
     m_str[iter.first.ToString()] = iter.second;
   }
@@ -169,6 +222,44 @@ TEST_CASE("SBNMaps") {
     CHECK_EQ(correct_id_id_set_map.at(iter.first), iter.second);
   }
 
+  // The fixed-width PCSP counters should agree with the dynamic ones.
+  Node::TopologyCounter unrooted_counter;
+  for (const auto& topology : Node::ExampleTopologies()) {
+    if (topology->Children().size() == 3) {
+      unrooted_counter[topology]++;
+    }
+  }
+  CHECK_EQ(SBNMaps::StringPCSPMapOf(UnrootedSBNMaps::PCSPCounterOf(unrooted_counter)),
+           SBNMaps::StringPCSPMapOf(
+               UnrootedSBNMaps::DynamicPCSPCounterOf(unrooted_counter)));
+  Node::TopologyCounter rooted_counter;
+  rooted_counter[Node::OfParentIdVector({5, 5, 7, 6, 6, 8, 7, 8})]++;
+  rooted_counter[Node::OfParentIdVector({5, 5, 6, 6, 7, 7, 8, 8})]++;
+  CHECK_EQ(SBNMaps::StringPCSPMapOf(RootedSBNMaps::PCSPCounterOf(rooted_counter)),
+           SBNMaps::StringPCSPMapOf(RootedSBNMaps::DynamicPCSPCounterOf(rooted_counter)));
+
+  // Online counting, with a capacity small enough that we flush along the way, gives
+  // the same counts.
+  auto online_counter = UnrootedSBNMaps::OnlineCounter(1);
+  for (const auto& [topology, count] : unrooted_counter) {
+    for (uint32_t i = 0; i < count; i++) {
+      online_counter.Add(topology);
+    }
+  }
+  online_counter.Add(Node::ExampleTopologies()[1], 3);
+  unrooted_counter[Node::ExampleTopologies()[1]] += 3;
+  CHECK_EQ(online_counter.TopologyCount(), 6);
+  CHECK_EQ(StringifyMap(online_counter.RootsplitCounter().Map()),
+           StringifyMap(UnrootedSBNMaps::RootsplitCounterOf(unrooted_counter).Map()));
+  CHECK_EQ(SBNMaps::StringPCSPMapOf(online_counter.PCSPCounter()),
+           SBNMaps::StringPCSPMapOf(UnrootedSBNMaps::PCSPCounterOf(unrooted_counter)));
+  auto rooted_online_counter = RootedSBNMaps::OnlineCounter();
+  for (const auto& [topology, count] : rooted_counter) {
+    rooted_online_counter.Add(topology, count);
+  }
+  CHECK_EQ(SBNMaps::StringPCSPMapOf(rooted_online_counter.PCSPCounter()),
+           SBNMaps::StringPCSPMapOf(RootedSBNMaps::PCSPCounterOf(rooted_counter)));
+
   // Tests comparing to vbpi appear in Python test code.
   // Tests of IndexerRepresentationOf in unrooted_sbn_instance.hpp.
 }
@@ -116,10 +116,12 @@ void ProbabilityNormalizeRange(EigenVectorXdRef vec, std::pair<size_t, size_t> r
 
 // We assume that vec is laid out like sbn_parameters (see top).
 void ProbabilityNormalizeParams(EigenVectorXdRef vec, size_t rootsplit_count,
-                                const BitsetSizePairMap& parent_to_range) {
+                                const SizePairVector& subsplit_id_to_range) {
   ProbabilityNormalizeRange(vec, {0, rootsplit_count});
-  for (const auto& [_, range] : parent_to_range) {
-    ProbabilityNormalizeRange(vec, range);
+  for (const auto& range : subsplit_id_to_range) {
+    if (range.first < range.second) {
+      ProbabilityNormalizeRange(vec, range);
+    }
   }
 }
 
@@ -134,10 +136,12 @@ void SBNProbability::ProbabilityNormalizeRangeInLog(EigenVectorXdRef vec,
 // We assume that vec is laid out like sbn_parameters (see top).
 void SBNProbability::ProbabilityNormalizeParamsInLog(
     EigenVectorXdRef vec, size_t rootsplit_count,
-    const BitsetSizePairMap& parent_to_range) {
+    const SizePairVector& subsplit_id_to_range) {
   ProbabilityNormalizeRangeInLog(vec, {0, rootsplit_count});
-  for (const auto& [_, range] : parent_to_range) {
-    ProbabilityNormalizeRangeInLog(vec, range);
+  for (const auto& range : subsplit_id_to_range) {
+    if (range.first < range.second) {
+      ProbabilityNormalizeRangeInLog(vec, range);
+    }
   }
 }
 
@@ -146,7 +150,7 @@ void SBNProbability::ProbabilityNormalizeParamsInLog(
 void SetCounts(
     EigenVectorXdRef counts,
     const UnrootedIndexerRepresentationCounter& indexer_representation_counter,
-    size_t rootsplit_count, const BitsetSizePairMap& parent_to_range) {
+    size_t rootsplit_count, const SizePairVector& subsplit_id_to_range) {
   counts.setZero();
   for (const auto& [indexer_representation, int_topology_count] :
        indexer_representation_counter) {
@@ -164,7 +168,7 @@ void SetCounts(
 void SetLogCounts(
     EigenVectorXdRef counts,
     const RootedIndexerRepresentationCounter& indexer_representation_counter,
-    size_t rootsplit_count, const BitsetSizePairMap& parent_to_range) {
+    size_t rootsplit_count, const SizePairVector& subsplit_id_to_range) {
   counts.fill(DOUBLE_NEG_INF);
   for (const auto& [indexer_representation, int_topology_count] :
        indexer_representation_counter) {
@@ -178,9 +182,9 @@ void SetLogCounts(
 void SBNProbability::SimpleAverage(
     EigenVectorXdRef sbn_parameters,
     const RootedIndexerRepresentationCounter& indexer_representation_counter,
-    size_t rootsplit_count, const BitsetSizePairMap& parent_to_range) {
+    size_t rootsplit_count, const SizePairVector& subsplit_id_to_range) {
   SetLogCounts(sbn_parameters, indexer_representation_counter, rootsplit_count,
-               parent_to_range);
+               subsplit_id_to_range);
 }
 
 // Set the provided counts vector to be the log of the counts of the rootsplits and
@@ -189,7 +193,7 @@ void SBNProbability::SimpleAverage(
 void SetLogCounts(
     EigenVectorXdRef counts,
     const UnrootedIndexerRepresentationCounter& indexer_representation_counter,
-    size_t rootsplit_count, const BitsetSizePairMap& parent_to_range) {
+    size_t rootsplit_count, const SizePairVector& subsplit_id_to_range) {
   counts.fill(DOUBLE_NEG_INF);
   for (const auto& [indexer_representation, int_topology_count] :
        indexer_representation_counter) {
@@ -202,9 +206,9 @@ void SetLogCounts(
 void SBNProbability::SimpleAverage(
     EigenVectorXdRef sbn_parameters,
     const UnrootedIndexerRepresentationCounter& indexer_representation_counter,
-    size_t rootsplit_count, const BitsetSizePairMap& parent_to_range) {
+    size_t rootsplit_count, const SizePairVector& subsplit_id_to_range) {
   SetLogCounts(sbn_parameters, indexer_representation_counter, rootsplit_count,
-               parent_to_range);
+               subsplit_id_to_range);
 }
 
 // All references to equations, etc, are to the 2018 NeurIPS paper.
@@ -214,7 +218,7 @@ void SBNProbability::SimpleAverage(
 EigenVectorXd SBNProbability::ExpectationMaximization(
     EigenVectorXdRef sbn_parameters,
     const UnrootedIndexerRepresentationCounter& indexer_representation_counter,
-    size_t rootsplit_count, const BitsetSizePairMap& parent_to_range, double alpha,
+    size_t rootsplit_count, const SizePairVector& subsplit_id_to_range, double alpha,
     size_t max_iter, double score_epsilon) {
   Assert(!indexer_representation_counter.empty(),
          "Empty indexer_representation_counter.");
@@ -229,7 +233,7 @@ EigenVectorXd SBNProbability::ExpectationMaximization(
   // SimpleAverage estimate. If alpha is nonzero log_m_tilde gets scaled by it below.
   EigenVectorXd log_m_tilde(sbn_parameters.size());
   SetLogCounts(log_m_tilde, indexer_representation_counter, rootsplit_count,
-               parent_to_range);
+               subsplit_id_to_range);
   // m_tilde is the counts, but marginalized over a uniform distribution on the rooting
   // edge. Thus we take the total counts and then divide by the edge count.
   log_m_tilde = log_m_tilde.array() - log(static_cast<double>(edge_count));
@@ -237,7 +241,8 @@ EigenVectorXd SBNProbability::ExpectationMaximization(
   sbn_parameters = log_m_tilde;
   // We need to ensure sbn_parameters is normalized as we are computing log P(S_1, T^u)
   // repeatedly.
-  ProbabilityNormalizeParamsInLog(sbn_parameters, rootsplit_count, parent_to_range);
+  ProbabilityNormalizeParamsInLog(sbn_parameters, rootsplit_count,
+                                  subsplit_id_to_range);
   // We need an exponentiated version of log_m_tilde for the score calculation if alpha
   // is nonzero.
   EigenVectorXd m_tilde_for_positive_alpha;
@@ -298,7 +303,8 @@ EigenVectorXd SBNProbability::ExpectationMaximization(
                          ? NumericalUtils::LogAddVectors(log_m_bar, log_m_tilde)
                          : log_m_bar;
     // We normalize sbn_parameters right away to ensure that it is always normalized.
-    ProbabilityNormalizeParamsInLog(sbn_parameters, rootsplit_count, parent_to_range);
+    ProbabilityNormalizeParamsInLog(sbn_parameters, rootsplit_count,
+                                    subsplit_id_to_range);
     if (alpha > 0.) {
       // Last line of the section on EM in doc/tex.
       score_history[em_idx] += m_tilde_for_positive_alpha.dot(sbn_parameters);
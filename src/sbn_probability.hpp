@@ -5,6 +5,10 @@
 //
 // We assume that readers are familiar with how the sbn_parameters_ vector is laid out:
 // first probabilities of rootsplits, then conditional probabilities of PCSPs.
+//
+// The functions here that need to know the ranges of PCSPs sharing a parent take a
+// subsplit_id_to_range vector, as built by SBNSupport: it is indexed by subsplit id,
+// and subsplits that aren't parents have empty ranges.
 
 #ifndef SRC_SBN_PROBABILITY_HPP_
 #define SRC_SBN_PROBABILITY_HPP_
@@ -19,12 +23,12 @@ namespace SBNProbability {
 void SimpleAverage(
     EigenVectorXdRef sbn_parameters,
     const UnrootedIndexerRepresentationCounter& indexer_representation_counter,
-    size_t rootsplit_count, const BitsetSizePairMap& parent_to_range);
+    size_t rootsplit_count, const SizePairVector& subsplit_id_to_range);
 
 void SimpleAverage(
     EigenVectorXdRef sbn_parameters,
     const RootedIndexerRepresentationCounter& indexer_representation_counter,
-    size_t rootsplit_count, const BitsetSizePairMap& parent_to_range);
+    size_t rootsplit_count, const SizePairVector& subsplit_id_to_range);
 
 // The "SBN-EM" estimator described in the "Expectation Maximization" section of
 // the 2018 NeurIPS paper. Returns the sequence of scores (defined in the paper)
@@ -32,7 +36,7 @@ void SimpleAverage(
 EigenVectorXd ExpectationMaximization(
     EigenVectorXdRef sbn_parameters,
     const UnrootedIndexerRepresentationCounter& indexer_representation_counter,
-    size_t rootsplit_count, const BitsetSizePairMap& parent_to_range, double alpha,
+    size_t rootsplit_count, const SizePairVector& subsplit_id_to_range, double alpha,
     size_t max_iter, double score_epsilon);
 
 // Calculate the probability of an indexer_representation of a topology.
@@ -51,7 +55,7 @@ void ProbabilityNormalizeRangeInLog(EigenVectorXdRef vec,
 // Perform in-place normalization of vec when its values are in log space.
 // We assume that vec is laid out like sbn_parameters (see top).
 void ProbabilityNormalizeParamsInLog(EigenVectorXdRef vec, size_t rootsplit_count,
-                                     const BitsetSizePairMap& parent_to_range);
+                                     const SizePairVector& subsplit_id_to_range);
 bool IsInSBNSupport(const SizeVector& rooted_representation,
                     size_t out_of_support_sentinel_value);
 
@@ -48,5 +48,30 @@ StringVector SBNSupport::StringReversedIndexer() const {
 void SBNSupport::ProbabilityNormalizeSBNParametersInLog(
     EigenVectorXdRef sbn_parameters) const {
   SBNProbability::ProbabilityNormalizeParamsInLog(sbn_parameters, rootsplits_.size(),
-                                                  parent_to_range_);
+                                                  subsplit_id_to_range_);
+}
+
+void SBNSupport::BuildSubsplitIds() {
+  subsplits_ = SubsplitInterner();
+  rootsplit_subsplit_ids_.clear();
+  rootsplit_subsplit_ids_.reserve(rootsplits_.size());
+  for (const auto& rootsplit : rootsplits_) {
+    rootsplit_subsplit_ids_.push_back(subsplits_.Intern(rootsplit + ~rootsplit));
+  }
+  index_to_pcsp_ids_.assign(gpcsp_count_, {SubsplitInterner::missing_id_,
+                                           SubsplitInterner::missing_id_});
+  std::vector<std::pair<SubsplitInterner::Id, SizePair>> parent_ranges;
+  parent_ranges.reserve(parent_to_range_.size());
+  for (const auto& [parent, range] : parent_to_range_) {
+    const auto parent_id = subsplits_.Intern(parent);
+    parent_ranges.emplace_back(parent_id, range);
+    for (size_t pcsp_idx = range.first; pcsp_idx < range.second; pcsp_idx++) {
+      index_to_pcsp_ids_[pcsp_idx] = {parent_id,
+                                      subsplits_.Intern(index_to_child_.at(pcsp_idx))};
+    }
+  }
+  subsplit_id_to_range_.assign(subsplits_.size(), {0, 0});
+  for (const auto& [parent_id, range] : parent_ranges) {
+    subsplit_id_to_range_[parent_id] = range;
+  }
 }
@@ -10,6 +10,12 @@
 // indexing scheme. Details differ if we are looking at rooted or unrooted trees, hence
 // this class gets subclassed by RootedSBNSupport and UnrootedSBNSupport.
 //
+// In addition to the Bitset-keyed maps, each subsplit appearing in the support is
+// interned to a dense integer id (see subsplit_interner.hpp), and the id-based
+// versions of the maps are stored as flat vectors. These are what the inner loops of
+// gradient computation, training, and sampling use, so that they don't need to build
+// Bitsets.
+//
 // To learn more about these indexer maps, see the unit tests in rooted_sbn_instance.hpp
 // and unrooted_sbn_instance.hpp.
 
@@ -18,6 +24,10 @@
 
 #include "psp_indexer.hpp"
 #include "sbn_probability.hpp"
+#include "subsplit_interner.hpp"
+
+// A PCSP described as a pair of subsplit ids: (parent, child).
+using PCSPIdPair = std::pair<SubsplitInterner::Id, SubsplitInterner::Id>;
 
 class SBNSupport {
  public:
@@ -42,7 +52,27 @@ class SBNSupport {
     return index_to_child_.at(child_idx);
   }
 
+  const SubsplitInterner &Subsplits() const { return subsplits_; }
+  // The id of the subsplit formed by the given rootsplit followed by its complement.
+  inline SubsplitInterner::Id RootsplitSubsplitIdAt(size_t rootsplit_idx) const {
+    return rootsplit_subsplit_ids_.at(rootsplit_idx);
+  }
+  inline bool SubsplitIdIsParent(SubsplitInterner::Id subsplit_id) const {
+    const auto &[begin, end] = subsplit_id_to_range_.at(subsplit_id);
+    return begin < end;
+  }
+  inline const SizePair &SubsplitIdToRangeAt(SubsplitInterner::Id subsplit_id) const {
+    return subsplit_id_to_range_.at(subsplit_id);
+  }
+  inline SubsplitInterner::Id IndexToChildIdAt(size_t child_idx) const {
+    return index_to_pcsp_ids_.at(child_idx).second;
+  }
+  inline const PCSPIdPair &IndexToPCSPIdsAt(size_t pcsp_idx) const {
+    return index_to_pcsp_ids_.at(pcsp_idx);
+  }
+
   const BitsetSizePairMap &ParentToRange() const { return parent_to_range_; }
+  const SizePairVector &SubsplitIdToRange() const { return subsplit_id_to_range_; }
   const BitsetSizeMap &Indexer() const { return indexer_; }
 
   PSPIndexer BuildPSPIndexer() const { return PSPIndexer(rootsplits_, indexer_); }
@@ -61,6 +91,10 @@ class SBNSupport {
   void ProbabilityNormalizeSBNParametersInLog(EigenVectorXdRef sbn_parameters) const;
 
  protected:
+  // Intern the subsplits of the support and build the id-based maps. To be called by
+  // subclass constructors once the Bitset-keyed maps are built.
+  void BuildSubsplitIds();
+
   // A vector of the taxon names.
   StringVector taxon_names_;
   // The total number of rootsplits and PCSPs.
@@ -75,6 +109,17 @@ class SBNSupport {
   // sbn_parameters_ with its children. See the definition of Range for the indexing
   // convention.
   BitsetSizePairMap parent_to_range_;
+  // The interned subsplits: every parent, child, and rooting subsplit in the support,
+  // along with their rotations.
+  SubsplitInterner subsplits_;
+  // For each rootsplit, the id of the rootsplit + ~rootsplit subsplit.
+  std::vector<SubsplitInterner::Id> rootsplit_subsplit_ids_;
+  // The id version of parent_to_range_: indexed by subsplit id, with an empty range
+  // for subsplits that aren't parents in the support.
+  SizePairVector subsplit_id_to_range_;
+  // For each index in sbn_parameters_, the (parent, child) subsplit ids of that PCSP.
+  // Rootsplit entries hold missing ids.
+  std::vector<PCSPIdPair> index_to_pcsp_ids_;
 };
 
 #endif  // SRC_SBN_SUPPORT_HPP_
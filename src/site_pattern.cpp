@@ -3,14 +3,21 @@
 
 #include "site_pattern.hpp"
 
+#include <algorithm>
+#include <array>
 #include <cstdio>
+#include <numeric>
+#include <queue>
 #include <string>
+#include <thread>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
 #include "intpack.hpp"
 #include "sugar.hpp"
+#include "task_processor.hpp"
 
 // DNA assumption here.
 CharIntMap SitePattern::GetSymbolTable() {
@@ -64,54 +71,264 @@ SymbolVector SitePattern::SymbolVectorOf(const CharIntMap &symbol_table,
   return v;
 }
 
-struct IntVectorHasher {
-  int operator()(const std::vector<int> &values) const {
-    int hash = values[0];
-    for (size_t i = 1; i < values.size(); i++) {
-      hash ^= values[i] + 0x9e3779b9 + (hash << 6) + (hash >> 2);
-    }
-    return hash;
+namespace {
+
+// We pack the symbols of a column (that is, a site) into 64-bit words, 4 bits per
+// taxon, so that we can hash and compare columns a word rather than a taxon at a
+// time.
+constexpr size_t bits_per_symbol = 4;
+constexpr size_t symbols_per_word = 64 / bits_per_symbol;
+constexpr uint64_t symbol_mask = (uint64_t(1) << bits_per_symbol) - 1;
+
+uint64_t HashOfWords(const uint64_t *words, size_t word_count) {
+  uint64_t hash = word_count;
+  for (size_t i = 0; i < word_count; i++) {
+    hash = (hash ^ words[i]) * 0x9e3779b97f4a7c15;
+    hash ^= hash >> 32;
   }
+  return hash;
+}
+
+// The distinct columns of a block of consecutive sites, along with their counts.
+struct PackedColumns {
+  size_t word_count_;
+  std::vector<uint64_t> words_;
+  std::vector<uint64_t> hashes_;
+  std::vector<double> counts_;
+  // An unknown symbol that we found, or '\0' if there was none.
+  char unknown_symbol_ = '\0';
+
+  size_t size() const { return hashes_.size(); }
+  const uint64_t *Column(size_t i) const { return words_.data() + i * word_count_; }
 };
 
-void SitePattern::Compress() {
-  CharIntMap symbol_table = GetSymbolTable();
-  size_t sequence_length = alignment_.Length();
-  std::unordered_map<SymbolVector, double, IntVectorHasher> patterns;
+}  // namespace
 
-  std::unordered_map<size_t, std::string> taxon_number_to_sequence;
+// Sites get packed and deduplicated block by block in parallel. Then each of several
+// shards (split by hash) merges the distinct columns of the blocks that fall into it.
+// Finally, we sort the patterns into canonical order, which doesn't depend on the
+// number of threads (or on anything else but the alignment).
+void SitePattern::Compress(const Alignment &alignment) {
+  // Look symbols up by character code rather than through the map, with -1 for
+  // characters that aren't in the symbol table.
+  std::array<int, 256> symbols;
+  symbols.fill(-1);
+  for (const auto &[c, symbol] : GetSymbolTable()) {
+    Assert(static_cast<uint64_t>(symbol) <= symbol_mask,
+           "Symbol doesn't fit in a packed column.");
+    symbols[static_cast<uint8_t>(c)] = symbol;
+  }
+  const size_t sequence_count = alignment.SequenceCount();
+  const size_t sequence_length = alignment.Length();
+  const size_t word_count = (sequence_count + symbols_per_word - 1) / symbols_per_word;
+
+  // The alignment row of each taxon number.
+  std::vector<std::pair<size_t, size_t>> taxon_number_rows;
   for (const auto &[tag, taxon] : tag_taxon_map_) {
     const auto taxon_number = static_cast<size_t>(MaxLeafIDOfTag(tag));
-    SafeInsert(taxon_number_to_sequence, taxon_number, alignment_.at(taxon));
+    Assert(taxon_number < sequence_count,
+           "Taxon number out of range of the alignment in SitePattern.");
+    taxon_number_rows.emplace_back(taxon_number, alignment.RowOf(taxon));
   }
-
-  for (size_t pos = 0; pos < sequence_length; pos++) {
-    SymbolVector pattern(alignment_.SequenceCount());
-    for (const auto &[taxon_number, sequence] : taxon_number_to_sequence) {
-      const auto symbol_to_find = sequence[pos];
-      pattern[taxon_number] = SymbolTableAt(symbol_table, symbol_to_find);
+  const size_t thread_count =
+      std::max(size_t(1), size_t(std::thread::hardware_concurrency()));
+  // About four blocks per thread, so that the threads stay busy.
+  const size_t block_size =
+      std::max(size_t(1024), (sequence_length + 4 * thread_count - 1) /
+                                 (4 * thread_count));
+  const size_t block_count = (sequence_length + block_size - 1) / block_size;
+  std::vector<PackedColumns> blocks(block_count);
+  auto pack_block = [&](size_t block_index) {
+    auto &block = blocks[block_index];
+    block.word_count_ = word_count;
+    const size_t site_begin = block_index * block_size;
+    const size_t site_end = std::min(site_begin + block_size, sequence_length);
+    // The distinct columns so far, by their index in the block.
+    auto hash = [&block](size_t i) { return block.hashes_[i]; };
+    auto equal = [&block, word_count](size_t i, size_t j) {
+      return std::equal(block.Column(i), block.Column(i) + word_count, block.Column(j));
+    };
+    std::unordered_set<size_t, decltype(hash), decltype(equal)> distinct(
+        2 * (site_end - site_begin), hash, equal);
+    std::vector<uint64_t> column(word_count);
+    for (size_t site = site_begin; site < site_end; site++) {
+      std::fill(column.begin(), column.end(), 0);
+      for (const auto &[taxon_number, row] : taxon_number_rows) {
+        const uint8_t c = alignment.Row(row)[site];
+        const int symbol = symbols[c];
+        if (symbol < 0) {
+          block.unknown_symbol_ = static_cast<char>(c);
+          return;
+        }
+        column[taxon_number / symbols_per_word] |=
+            static_cast<uint64_t>(symbol)
+            << (bits_per_symbol * (taxon_number % symbols_per_word));
+      }
+      // Tentatively add the column to the block, and take it off again if we have
+      // already seen it.
+      const size_t index = block.size();
+      block.words_.insert(block.words_.end(), column.begin(), column.end());
+      block.hashes_.push_back(HashOfWords(column.data(), word_count));
+      const auto [iter, inserted] = distinct.insert(index);
+      if (inserted) {
+        block.counts_.push_back(1.);
+      } else {
+        block.words_.resize(block.words_.size() - word_count);
+        block.hashes_.pop_back();
+        block.counts_[*iter]++;
+      }
     }
-    if (patterns.find(pattern) == patterns.end()) {
-      SafeInsert(patterns, pattern, 1.);
-    } else {
-      patterns[pattern]++;
+  };
+  // A distinct column of the alignment, as a column of one of the blocks.
+  struct MergedColumn {
+    double count_;
+    size_t block_index_;
+    size_t index_;
+  };
+  const size_t shard_count = thread_count;
+  std::vector<std::vector<MergedColumn>> shards(shard_count);
+  auto merge_shard = [&](size_t shard_index) {
+    auto &merged = shards[shard_index];
+    auto column_of = [&blocks, &merged](size_t i) {
+      return blocks[merged[i].block_index_].Column(merged[i].index_);
+    };
+    auto hash = [&blocks, &merged](size_t i) {
+      return blocks[merged[i].block_index_].hashes_[merged[i].index_];
+    };
+    auto equal = [&column_of, word_count](size_t i, size_t j) {
+      return std::equal(column_of(i), column_of(i) + word_count, column_of(j));
+    };
+    std::unordered_set<size_t, decltype(hash), decltype(equal)> distinct(16, hash,
+                                                                         equal);
+    for (size_t block_index = 0; block_index < blocks.size(); block_index++) {
+      const auto &block = blocks[block_index];
+      for (size_t index = 0; index < block.size(); index++) {
+        if ((block.hashes_[index] >> 32) % shard_count != shard_index) {
+          continue;
+        }
+        merged.push_back({block.counts_[index], block_index, index});
+        const auto [iter, inserted] = distinct.insert(merged.size() - 1);
+        if (!inserted) {
+          merged[*iter].count_ += merged.back().count_;
+          merged.pop_back();
+        }
+      }
+    }
+  };
+  auto run_in_parallel = [thread_count](size_t task_count, auto task) {
+    if (thread_count == 1 || task_count <= 1) {
+      for (size_t i = 0; i < task_count; i++) {
+        task(i);
+      }
+      return;
+    }
+    std::queue<size_t> thread_queue;
+    for (size_t i = 0; i < std::min(thread_count, task_count); i++) {
+      thread_queue.push(i);
+    }
+    std::queue<size_t> task_queue;
+    for (size_t i = 0; i < task_count; i++) {
+      task_queue.push(i);
+    }
+    TaskProcessor<size_t, size_t> task_processor(
+        std::move(thread_queue), std::move(task_queue),
+        [&task](size_t, size_t task_index) { task(task_index); });
+    task_processor.Wait();
+  };
+  run_in_parallel(block_count, pack_block);
+  for (const auto &block : blocks) {
+    if (block.unknown_symbol_ != '\0') {
+      char error[50];
+      std::snprintf(error, sizeof(error), "Symbol '%c' not known.",
+                    block.unknown_symbol_);
+      Failwith(error);
     }
   }
+  run_in_parallel(shard_count, merge_shard);
 
-  // Collect the site patterns per taxon.
-  for (const auto &iter_tag_taxon : tag_taxon_map_) {
-    SymbolVector compressed_sequence;
-    auto taxon_number = static_cast<size_t>(MaxLeafIDOfTag(iter_tag_taxon.first));
-    for (const auto &iter_patterns : patterns) {
-      compressed_sequence.push_back(iter_patterns.first[taxon_number]);
+  std::vector<MergedColumn> merged;
+  for (const auto &shard : shards) {
+    merged.insert(merged.end(), shard.begin(), shard.end());
+  }
+  // Unpack the distinct columns, pattern by pattern, with the taxa in taxon number
+  // order.
+  std::vector<size_t> taxon_numbers;
+  for (const auto &[taxon_number, row] : taxon_number_rows) {
+    taxon_numbers.push_back(taxon_number);
+  }
+  std::sort(taxon_numbers.begin(), taxon_numbers.end());
+  const size_t taxon_count = taxon_numbers.size();
+  const size_t pattern_count = merged.size();
+  std::vector<int> unpacked(pattern_count * taxon_count);
+  std::vector<char> is_invariant(pattern_count);
+  for (size_t i = 0; i < pattern_count; i++) {
+    const uint64_t *column = blocks[merged[i].block_index_].Column(merged[i].index_);
+    int *pattern = unpacked.data() + i * taxon_count;
+    for (size_t k = 0; k < taxon_count; k++) {
+      const size_t taxon_number = taxon_numbers[k];
+      pattern[k] = static_cast<int>(
+          (column[taxon_number / symbols_per_word] >>
+           (bits_per_symbol * (taxon_number % symbols_per_word))) &
+          symbol_mask);
     }
-    patterns_[taxon_number] = compressed_sequence;
+    is_invariant[i] = std::all_of(pattern, pattern + taxon_count,
+                                  [pattern](int symbol) {
+                                    return symbol == pattern[0];
+                                  });
   }
+  std::vector<size_t> order(pattern_count);
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(),
+            [&unpacked, &is_invariant, taxon_count](size_t lhs, size_t rhs) {
+              if (is_invariant[lhs] != is_invariant[rhs]) {
+                return is_invariant[rhs] != 0;
+              }
+              const int *lhs_pattern = unpacked.data() + lhs * taxon_count;
+              const int *rhs_pattern = unpacked.data() + rhs * taxon_count;
+              return std::lexicographical_compare(lhs_pattern,
+                                                  lhs_pattern + taxon_count,
+                                                  rhs_pattern,
+                                                  rhs_pattern + taxon_count);
+            });
+  // Collect the site patterns per taxon, and the site weights.
+  for (size_t k = 0; k < taxon_count; k++) {
+    auto &compressed_sequence = patterns_[taxon_numbers[k]];
+    compressed_sequence.resize(pattern_count);
+    for (size_t i = 0; i < pattern_count; i++) {
+      compressed_sequence[i] = unpacked[order[i] * taxon_count + k];
+    }
+  }
+  weights_.resize(pattern_count);
+  for (size_t i = 0; i < pattern_count; i++) {
+    weights_[i] = merged[order[i]].count_;
+  }
+  invariant_pattern_count_ =
+      static_cast<size_t>(std::count(is_invariant.begin(), is_invariant.end(), 1));
+}
 
-  // Collect the site weights.
-  for (const auto &iter : patterns) {
-    weights_.push_back(iter.second);
+SitePattern SitePattern::Slice(size_t begin, size_t end) const {
+  Assert(begin <= end && end <= PatternCount(), "Bad range for SitePattern::Slice.");
+  using difference_type = std::vector<double>::difference_type;
+  const auto begin_offset = static_cast<difference_type>(begin);
+  const auto end_offset = static_cast<difference_type>(end);
+  SitePattern slice;
+  slice.tag_taxon_map_ = tag_taxon_map_;
+  for (const auto &sequence_patterns : patterns_) {
+    // Sequences without a taxon in the map have no patterns.
+    if (sequence_patterns.empty()) {
+      slice.patterns_.emplace_back();
+    } else {
+      slice.patterns_.emplace_back(sequence_patterns.begin() + begin_offset,
+                                   sequence_patterns.begin() + end_offset);
+    }
   }
+  slice.weights_.assign(weights_.begin() + begin_offset, weights_.begin() + end_offset);
+  // The invariant block is at the end, so the slice holds whatever part of it lies
+  // in the range.
+  const size_t invariant_begin =
+      std::min(end, std::max(begin, PatternCount() - invariant_pattern_count_));
+  slice.invariant_pattern_count_ = end - invariant_begin;
+  return slice;
 }
 
 const std::vector<double> SitePattern::GetPartials(size_t sequence_idx) const {
@@ -2,11 +2,18 @@
 // libsbn is free software under the GPLv3; see LICENSE file for details.
 //
 // A class for an alignment that has been compressed into site patterns.
+//
+// The patterns come in a canonical order, so that they are the same whatever the
+// platform or the number of threads: first the variable patterns, sorted
+// lexicographically as vectors of symbols in taxon number order, and then the block
+// of invariant patterns (in which every taxon has the same symbol), sorted by symbol.
 
 #ifndef SRC_SITE_PATTERN_HPP_
 #define SRC_SITE_PATTERN_HPP_
 
+#include <map>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "alignment.hpp"
@@ -16,9 +23,9 @@ class SitePattern {
  public:
   SitePattern() = default;
   SitePattern(const Alignment& alignment, TagStringMap tag_taxon_map)
-      : alignment_(alignment), tag_taxon_map_(std::move(tag_taxon_map)) {
+      : tag_taxon_map_(std::move(tag_taxon_map)) {
     patterns_.resize(alignment.SequenceCount());
-    Compress();
+    Compress(alignment);
   }
 
   static CharIntMap GetSymbolTable();
@@ -29,6 +36,11 @@ class SitePattern {
   size_t PatternCount() const { return patterns_.at(0).size(); }
   size_t SequenceCount() const { return patterns_.size(); }
   const std::vector<double>& GetWeights() const { return weights_; }
+  // The invariant patterns are the last InvariantPatternCount() patterns.
+  size_t InvariantPatternCount() const { return invariant_pattern_count_; }
+  // The patterns from begin up to (but not including) end, as a SitePattern of their
+  // own.
+  SitePattern Slice(size_t begin, size_t end) const;
   // Make a flattened partial likelihood vector for a given sequence, where anything
   // above 4 is given a uniform distribution.
   const std::vector<double> GetPartials(size_t sequence_idx) const;
@@ -40,15 +52,15 @@ class SitePattern {
   }
 
  private:
-  Alignment alignment_;
   TagStringMap tag_taxon_map_;
   // The first index of patterns_ is across sequences, and the second is across site
   // patterns.
   std::vector<SymbolVector> patterns_;
   // The number of times each site pattern was seen in the alignment.
   std::vector<double> weights_;
+  size_t invariant_pattern_count_ = 0;
 
-  void Compress();
+  void Compress(const Alignment& alignment);
   static int SymbolTableAt(const CharIntMap& symbol_table, char c);
 };
 
@@ -58,6 +70,38 @@ TEST_CASE("SitePattern") {
   SymbolVector symbol_vector = SitePattern::SymbolVectorOf(symbol_table, "-tgcaTGCA?");
   SymbolVector correct_symbol_vector = {4, 3, 2, 1, 0, 3, 2, 1, 0, 4};
   CHECK_EQ(symbol_vector, correct_symbol_vector);
+  // Compress the hello alignment by hand, and then sort the patterns into canonical
+  // order.
+  const auto alignment = Alignment::HelloAlignment();
+  const std::vector<std::string> taxa = {"mars", "saturn", "jupiter"};
+  std::map<std::pair<bool, SymbolVector>, double> pattern_weights;
+  for (size_t site = 0; site < alignment.Length(); site++) {
+    SymbolVector column;
+    for (const auto& taxon : taxa) {
+      column.push_back(symbol_table.at(alignment.at(taxon)[site]));
+    }
+    const bool is_invariant = std::count(column.begin(), column.end(), column[0]) ==
+                              static_cast<long>(column.size());
+    pattern_weights[{is_invariant, column}]++;
+  }
+  std::vector<SymbolVector> columns;
+  std::vector<double> weights;
+  size_t invariant_pattern_count = 0;
+  for (const auto& [key, weight] : pattern_weights) {
+    columns.push_back(key.second);
+    weights.push_back(weight);
+    invariant_pattern_count += key.first;
+  }
+  CHECK_GT(invariant_pattern_count, 0);
+  const auto site_pattern = SitePattern::HelloSitePattern();
+  CHECK_EQ(site_pattern.GetWeights(), weights);
+  CHECK_EQ(site_pattern.InvariantPatternCount(), invariant_pattern_count);
+  for (size_t taxon_number = 0; taxon_number < taxa.size(); taxon_number++) {
+    for (size_t pattern = 0; pattern < columns.size(); pattern++) {
+      CHECK_EQ(site_pattern.GetPatterns()[taxon_number][pattern],
+               columns[pattern][taxon_number]);
+    }
+  }
 }
 #endif  // DOCTEST_LIBRARY_INCLUDED
 #endif  // SRC_SITE_PATTERN_HPP_
@@ -0,0 +1,93 @@
+// Copyright 2019-2020 libsbn project contributors.
+// libsbn is free software under the GPLv3; see LICENSE file for details.
+//
+// An interning table for subsplits.
+//
+// Each distinct subsplit gets a dense uint32_t id, so that a PCSP can be described
+// by a (parent id, child id) pair and per-subsplit data can live in flat vectors
+// indexed by id rather than in maps keyed by Bitset. Whenever we intern a subsplit
+// we also intern its rotation, so that both sides of every parent are available
+// without making a new Bitset. We also precompute whether the second half of each
+// subsplit is a single taxon, which is what we need to know when building a
+// topology top-down.
+
+#ifndef SRC_SUBSPLIT_INTERNER_HPP_
+#define SRC_SUBSPLIT_INTERNER_HPP_
+
+#include <cstdint>
+#include <vector>
+
+#include "bitset.hpp"
+#include "flat_hash_map.hpp"
+
+class SubsplitInterner {
+ public:
+  using Id = uint32_t;
+  // The id returned for subsplits that aren't in the table.
+  static constexpr Id missing_id_ = UINT32_MAX;
+
+  size_t size() const { return subsplits_.size(); }
+
+  // Get the id of a subsplit, adding it (and its rotation) if needed.
+  Id Intern(const Bitset &subsplit) {
+    auto search = ids_.find(subsplit);
+    if (search != ids_.end()) {
+      return search->second;
+    }
+    const Id id = Add(subsplit);
+    Bitset rotated = subsplit.RotateSubsplit();
+    const Id rotated_id = (rotated == subsplit) ? id : Add(rotated);
+    rotated_ids_[id] = rotated_id;
+    rotated_ids_[rotated_id] = id;
+    return id;
+  }
+
+  // Get the id of a subsplit, or missing_id_ if it hasn't been interned.
+  Id IdOf(const Bitset &subsplit) const {
+    auto search = ids_.find(subsplit);
+    return search == ids_.end() ? missing_id_ : search->second;
+  }
+
+  const Bitset &SubsplitOf(Id id) const { return subsplits_.at(id); }
+  // The id of the subsplit with its two sides exchanged.
+  Id RotatedOf(Id id) const { return rotated_ids_.at(id); }
+  // If the second half of the subsplit is a single taxon then return the index of
+  // that taxon, otherwise return missing_id_.
+  Id SingletonOf(Id id) const { return singletons_.at(id); }
+
+ private:
+  FlatHashMap<Bitset, Id> ids_;
+  std::vector<Bitset> subsplits_;
+  std::vector<Id> rotated_ids_;
+  std::vector<Id> singletons_;
+
+  Id Add(const Bitset &subsplit) {
+    Assert(subsplits_.size() < missing_id_, "Too many subsplits in SubsplitInterner.");
+    const auto id = static_cast<Id>(subsplits_.size());
+    SafeInsert(ids_, subsplit, id);
+    subsplits_.push_back(subsplit);
+    rotated_ids_.push_back(missing_id_);
+    const auto singleton_option = subsplit.SplitChunk(1).SingletonOption();
+    singletons_.push_back(singleton_option.value_or(missing_id_));
+    return id;
+  }
+};
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+TEST_CASE("SubsplitInterner") {
+  SubsplitInterner interner;
+  auto id = interner.Intern(Bitset("100011"));
+  CHECK_EQ(interner.size(), 2);
+  CHECK_EQ(interner.Intern(Bitset("100011")), id);
+  CHECK_EQ(interner.SubsplitOf(id), Bitset("100011"));
+  auto rotated_id = interner.RotatedOf(id);
+  CHECK_EQ(interner.SubsplitOf(rotated_id), Bitset("011100"));
+  CHECK_EQ(interner.RotatedOf(rotated_id), id);
+  CHECK_EQ(interner.IdOf(Bitset("011100")), rotated_id);
+  CHECK_EQ(interner.IdOf(Bitset("010001")), SubsplitInterner::missing_id_);
+  CHECK_EQ(interner.SingletonOf(id), SubsplitInterner::missing_id_);
+  CHECK_EQ(interner.SingletonOf(rotated_id), 0);
+}
+#endif  // DOCTEST_LIBRARY_INCLUDED
+
+#endif  // SRC_SUBSPLIT_INTERNER_HPP_
@@ -36,6 +36,7 @@ using StringSetVector = std::vector<StringSet>;
 using SuperCrusher = std::pair<int, double>;
 using DoublePair = std::pair<double, double>;
 using SizePair = std::pair<size_t, size_t>;
+using SizePairVector = std::vector<SizePair>;
 
 inline uint32_t MaxLeafIDOfTag(Tag tag) { return UnpackFirstInt(tag); }
 inline uint32_t LeafCountOfTag(Tag tag) { return UnpackSecondInt(tag); }
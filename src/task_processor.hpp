@@ -23,23 +23,30 @@
 // design like this-- we can't just use something like a C++17 parallel for
 // loop.
 //
+// Each thread holds on to one Executor for its whole life, and the threads take
+// chunks of the Work through a WorkCounter, so that handing out Work takes no lock.
+// The first version of this code kept the Executors in a queue behind a mutex and a
+// condition variable, and took that lock twice per unit of Work, which became the
+// bottleneck when the Tasks were cheap.
+//
 // I realize that it's not recommended to write your own thread-handling
 // library, and for good reason: see https://www.youtube.com/watch?v=QIHy8pXbneI
 // https://sean-parent.stlab.cc/presentations/2016-08-08-concurrency/2016-08-08-concurrency.pdf
-// However, here the tasks are few and big, the time required during locking is
-// small (put an integer in a dequeue). The overhead of including a true
-// threading library wouldn't be worth it for this example.
+// However, here the tasks are few and big, and handing them out is a single atomic
+// operation per chunk. The overhead of including a true threading library wouldn't
+// be worth it for this example.
 
 #ifndef SRC_TASK_PROCESSOR_HPP_
 #define SRC_TASK_PROCESSOR_HPP_
 
-#include <condition_variable>
 #include <functional>
-#include <mutex>
 #include <queue>
 #include <thread>
+#include <utility>
 #include <vector>
 
+#include "work_counter.hpp"
+
 template <class Executor, class Work>
 class TaskProcessor {
  public:
@@ -48,13 +55,14 @@ class TaskProcessor {
   typedef std::queue<Work> WorkQueue;
 
   TaskProcessor(ExecutorQueue executor_queue, WorkQueue work_queue, Task task)
-      : executor_queue_(executor_queue),
-        work_queue_(work_queue),
-        task_(task),
-        threads_(executor_queue.size()) {
+      : executors_(VectorOf(std::move(executor_queue))),
+        work_(VectorOf(std::move(work_queue))),
+        task_(std::move(task)),
+        work_counter_(work_.size(), executors_.size()) {
     // Make as many threads as there are executors.
-    for (size_t i = 0; i < threads_.size(); i++) {
-      threads_[i] = std::thread(&TaskProcessor::thread_handler, this);
+    threads_.reserve(executors_.size());
+    for (size_t i = 0; i < executors_.size(); i++) {
+      threads_.emplace_back(&TaskProcessor::thread_handler, this, i);
     }
   }
 
@@ -68,7 +76,6 @@ class TaskProcessor {
   ~TaskProcessor() { Wait(); }
 
   void Wait() {
-    condition_variable_.notify_all();
     // Wait for threads to finish before we exit
     for (size_t i = 0; i < threads_.size(); i++) {
       if (threads_[i].joinable()) {
@@ -78,34 +85,32 @@ class TaskProcessor {
   }
 
  private:
-  ExecutorQueue executor_queue_;
-  WorkQueue work_queue_;
+  std::vector<Executor> executors_;
+  std::vector<Work> work_;
   Task task_;
+  WorkCounter work_counter_;
   std::vector<std::thread> threads_;
-  std::mutex lock_;
-  std::condition_variable condition_variable_;
 
-  void thread_handler(void) {
-    std::unique_lock<std::mutex> lock(lock_);
-    while (work_queue_.size()) {
-      // Wait until we have an executor available. This right here is the key of
-      // the whole implementation, giving a nice way to wait until the resources
-      // are avaiable to run the next thing in the queue.
-      condition_variable_.wait(lock, [this] { return executor_queue_.size(); });
-      // After wait, we own the lock.
-      if (work_queue_.size()) {
-        auto work = work_queue_.front();
-        work_queue_.pop();
-        auto executor = executor_queue_.front();
-        executor_queue_.pop();
-        // Unlock now that we're done messing with the queues.
-        lock.unlock();
-        // Run task.
-        task_(executor, work);
-        // Lock again so that we can mess with the queues.
-        lock.lock();
-        // We're done with the executor so we can put it back on the queue.
-        executor_queue_.push(executor);
+  template <class T>
+  static std::vector<T> VectorOf(std::queue<T> queue) {
+    std::vector<T> vector;
+    vector.reserve(queue.size());
+    while (!queue.empty()) {
+      vector.push_back(std::move(queue.front()));
+      queue.pop();
+    }
+    return vector;
+  }
+
+  void thread_handler(size_t executor_index) {
+    const Executor &executor = executors_[executor_index];
+    while (true) {
+      const auto [begin, end] = work_counter_.Next();
+      if (begin == end) {
+        return;
+      }
+      for (size_t i = begin; i < end; i++) {
+        task_(executor, work_[i]);
       }
     }
   }
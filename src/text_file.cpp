@@ -0,0 +1,119 @@
+// Copyright 2019-2020 libsbn project contributors.
+// libsbn is free software under the GPLv3; see LICENSE file for details.
+
+#include "text_file.hpp"
+
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#include "sugar.hpp"
+
+TextFile::TextFile(const std::string &path, size_t chunk_size)
+    : path_(path), chunk_size_(std::max(chunk_size, size_t(1))) {
+  // zlib passes text that isn't gzip-compressed through unchanged.
+  struct stat file_stat;
+  if (stat(path.c_str(), &file_stat) == 0 && !S_ISREG(file_stat.st_mode)) {
+    OpenStream();
+    return;
+  }
+  mmapped_file_ = std::make_unique<MmappedFile>(path);
+  const auto header = mmapped_file_->View().substr(0, 4);
+  if (IsZstdMagic(header)) {
+    Failwith("The File '" + path +
+             "' is zstd-compressed, which we can't read. Please recompress it with "
+             "gzip, or decompress it.");
+  }
+  if (IsGzipMagic(header)) {
+    mmapped_file_.reset();
+    OpenStream();
+  }
+}
+
+TextFile::~TextFile() {
+  if (gz_file_ != nullptr) {
+    gzclose(gz_file_);
+  }
+}
+
+bool TextFile::IsCompressed() const {
+  return gz_file_ != nullptr && !gzdirect(gz_file_);
+}
+
+bool TextFile::AtEnd() const {
+  return at_end_ && (mmapped_file_ != nullptr || chunk_end_ == buffer_.size());
+}
+
+std::string_view TextFile::NextChunk() {
+  if (mmapped_file_ != nullptr) {
+    if (at_end_) {
+      return {};
+    }
+    at_end_ = true;
+    return mmapped_file_->View();
+  }
+  buffer_.erase(0, chunk_end_);
+  chunk_end_ = 0;
+  Decompress();
+  return std::string_view(buffer_).substr(0, chunk_end_);
+}
+
+std::string_view TextFile::ExtendChunk() {
+  if (mmapped_file_ != nullptr) {
+    at_end_ = true;
+    return mmapped_file_->View();
+  }
+  Decompress();
+  return std::string_view(buffer_).substr(0, chunk_end_);
+}
+
+void TextFile::Release(size_t byte_count) const {
+  if (mmapped_file_ != nullptr) {
+    mmapped_file_->Release(byte_count);
+  }
+}
+
+bool TextFile::IsGzipMagic(std::string_view header) {
+  return header.substr(0, 2) == "\x1f\x8b";
+}
+
+bool TextFile::IsZstdMagic(std::string_view header) {
+  return header.substr(0, 4) == "\x28\xb5\x2f\xfd";
+}
+
+void TextFile::OpenStream() {
+  gz_file_ = gzopen(path_.c_str(), "rb");
+  if (gz_file_ == nullptr) {
+    Failwith("Cannot open the File : " + path_);
+  }
+  gzbuffer(gz_file_, 1 << 17);
+}
+
+void TextFile::Decompress() {
+  const size_t target_size = buffer_.size() + chunk_size_;
+  // Whether we have read the newline that ends a line beyond the current chunk.
+  bool has_new_line = false;
+  while (!at_end_ && (buffer_.size() < target_size || !has_new_line)) {
+    const size_t read_begin = buffer_.size();
+    const size_t read_size =
+        std::min(read_begin < target_size ? target_size - read_begin : chunk_size_,
+                 size_t(std::numeric_limits<int>::max()));
+    buffer_.resize(read_begin + read_size);
+    const int read_count =
+        gzread(gz_file_, buffer_.data() + read_begin, static_cast<unsigned>(read_size));
+    if (read_count < 0) {
+      int error_number;
+      Failwith("Problem decompressing '" + path_ +
+               "': " + gzerror(gz_file_, &error_number));
+    }
+    buffer_.resize(read_begin + static_cast<size_t>(read_count));
+    at_end_ = (read_count == 0);
+    has_new_line =
+        has_new_line || std::memchr(buffer_.data() + read_begin, '\n',
+                                    static_cast<size_t>(read_count)) != nullptr;
+  }
+  chunk_end_ = at_end_ ? buffer_.size() : buffer_.rfind('\n') + 1;
+}
@@ -0,0 +1,111 @@
+// Copyright 2019-2020 libsbn project contributors.
+// libsbn is free software under the GPLv3; see LICENSE file for details.
+//
+// Reading a text file in chunks of whole lines, whether it is plain or
+// gzip-compressed.
+//
+// Posterior tree samples and alignments are big, so they are often kept compressed.
+// We tell whether a file is gzip-compressed from its first bytes (not its name), and
+// then decompress it a chunk at a time into a buffer, without a temporary file. A
+// plain file comes as a single chunk straight from a memory map. Pipes and devices
+// (such as /dev/stdin) can't be mapped, so we stream them through the buffer like a
+// compressed file, whether they are compressed or not.
+
+#ifndef SRC_TEXT_FILE_HPP_
+#define SRC_TEXT_FILE_HPP_
+
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "mmapped_file.hpp"
+
+// zlib's file handle, as gzFile is a pointer to it.
+struct gzFile_s;
+
+class TextFile {
+ public:
+  // Open the file at the given path, failing if it can't be opened. Chunks of a
+  // compressed file are at least chunk_size bytes long, apart from the last.
+  explicit TextFile(const std::string& path, size_t chunk_size = 1 << 24);
+  TextFile(const TextFile&) = delete;
+  TextFile& operator=(const TextFile&) = delete;
+  ~TextFile();
+
+  bool IsCompressed() const;
+  // Do we read the file through a buffer rather than a memory map? If so, we can't go
+  // back to the start of the file.
+  bool IsStreamed() const { return gz_file_ != nullptr; }
+  // Have we handed out all of the file?
+  bool AtEnd() const;
+  // The next chunk of whole lines, or an empty view at the end of the file. (The last
+  // line of a file may lack its newline.) A chunk stays valid until the next call to
+  // NextChunk or ExtendChunk.
+  std::string_view NextChunk();
+  // The current chunk followed by the chunk that would come next, for when we need
+  // to look further ahead.
+  std::string_view ExtendChunk();
+  // Let go of the memory holding the first byte_count bytes of the current chunk, as
+  // we are done with them.
+  void Release(size_t byte_count) const;
+
+  // Tell whether some bytes from the start of a file are those of a gzip or zstd file.
+  static bool IsGzipMagic(std::string_view header);
+  static bool IsZstdMagic(std::string_view header);
+
+ private:
+  std::unique_ptr<MmappedFile> mmapped_file_;
+  gzFile_s* gz_file_ = nullptr;
+  std::string path_;
+  size_t chunk_size_;
+  // The decompressed text, which starts with the current chunk.
+  std::string buffer_;
+  size_t chunk_end_ = 0;
+  // Have we read to the end of the file?
+  bool at_end_ = false;
+
+  void OpenStream();
+  // Decompress at least chunk_size_ more bytes (unless the file ends first) onto the
+  // end of the buffer, and extend the chunk to the last whole line.
+  void Decompress();
+};
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+TEST_CASE("TextFile") {
+  // Read a file in chunks, checking that they consist of whole lines.
+  auto read_all = [](TextFile& file) {
+    std::string text;
+    for (auto chunk = file.NextChunk(); !chunk.empty(); chunk = file.NextChunk()) {
+      CHECK((chunk.back() == '\n' || file.AtEnd()));
+      text += chunk;
+    }
+    CHECK(file.AtEnd());
+    return text;
+  };
+  const auto plain_text = std::string(MmappedFile("data/DS1.subsampled_10.t").View());
+  TextFile plain_file("data/DS1.subsampled_10.t");
+  CHECK_FALSE(plain_file.IsCompressed());
+  CHECK_FALSE(plain_file.IsStreamed());
+  CHECK_EQ(read_all(plain_file), plain_text);
+  // Use small chunks so that we get lots of them.
+  TextFile compressed_file("data/DS1.subsampled_10.t.gz", 1000);
+  CHECK(compressed_file.IsCompressed());
+  CHECK_EQ(read_all(compressed_file), plain_text);
+  TextFile extended_file("data/DS1.subsampled_10.t.gz", 1000);
+  const auto first_chunk = std::string(extended_file.NextChunk());
+  const auto extended_chunk = std::string(extended_file.ExtendChunk());
+  CHECK_GT(extended_chunk.size(), first_chunk.size());
+  CHECK_EQ(extended_chunk.substr(0, first_chunk.size()), first_chunk);
+  CHECK_EQ(extended_chunk + read_all(extended_file), plain_text);
+  CHECK(TextFile::IsZstdMagic("\x28\xb5\x2f\xfd"));
+  CHECK_FALSE(TextFile::IsGzipMagic("#NEXUS"));
+  // Devices and pipes come through the buffer.
+  TextFile device_file("/dev/null");
+  CHECK(device_file.IsStreamed());
+  CHECK_FALSE(device_file.IsCompressed());
+  CHECK_EQ(read_all(device_file), "");
+  CHECK_THROWS(TextFile("data/no_such_file.nwk"));
+}
+#endif  // DOCTEST_LIBRARY_INCLUDED
+
+#endif  // SRC_TEXT_FILE_HPP_
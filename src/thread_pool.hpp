@@ -0,0 +1,178 @@
+// Copyright 2019-2020 libsbn project contributors.
+// libsbn is free software under the GPLv3; see LICENSE file for details.
+//
+// A fixed set of threads that we keep around to run loops in parallel.
+//
+// A TaskProcessor makes its threads when it is constructed and joins them when it is
+// done, which is fine for a big one-off job but adds up when we run many small ones,
+// such as computing likelihoods for a handful of trees at each step of an
+// optimization. A ThreadPool makes its threads once, and parks them on a condition
+// variable between calls to ParallelFor.
+//
+// Each thread has an index from 0 to ThreadCount() - 1, which ParallelFor hands to
+// the task, so that each thread can use its own Executor (say, its own FatBeagle).
+// The thread calling ParallelFor does the work of thread 0, so a pool with one
+// thread runs everything on the caller. The threads take chunks of the work through a
+// WorkCounter, so we only take the lock to start and finish a call.
+
+#ifndef SRC_THREAD_POOL_HPP_
+#define SRC_THREAD_POOL_HPP_
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "sugar.hpp"
+#include "work_counter.hpp"
+
+class ThreadPool {
+ public:
+  // The task gets the index of the thread it is running on and the index of the
+  // work item.
+  using Task = std::function<void(size_t, size_t)>;
+
+  explicit ThreadPool(size_t thread_count) {
+    Assert(thread_count > 0, "A ThreadPool needs at least one thread.");
+    for (size_t thread_index = 1; thread_index < thread_count; thread_index++) {
+      workers_.emplace_back(&ThreadPool::WorkerLoop, this, thread_index);
+    }
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool(const ThreadPool &&) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &&) = delete;
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    work_available_.notify_all();
+    for (auto &worker : workers_) {
+      worker.join();
+    }
+  }
+
+  size_t ThreadCount() const { return workers_.size() + 1; }
+
+  // Run the task on the work items 0 up to work_count, with each thread taking the
+  // next chunk of items that nobody has started on, and return once they are all
+  // done. If a task throws, the other items still get run, and then we rethrow the
+  // first exception. Calls from different threads take turns.
+  void ParallelFor(size_t work_count, const Task &task) {
+    std::lock_guard<std::mutex> call_lock(call_mutex_);
+    std::unique_lock<std::mutex> lock(mutex_);
+    task_ = &task;
+    work_counter_.Reset(work_count, ThreadCount());
+    busy_worker_count_ = workers_.size();
+    generation_++;
+    lock.unlock();
+    work_available_.notify_all();
+    RunWork(0);
+    lock.lock();
+    work_done_.wait(lock, [this] { return busy_worker_count_ == 0; });
+    task_ = nullptr;
+    if (exception_ != nullptr) {
+      std::exception_ptr exception = nullptr;
+      std::swap(exception, exception_);
+      std::rethrow_exception(exception);
+    }
+  }
+
+ private:
+  std::vector<std::thread> workers_;
+  // Makes calls to ParallelFor take turns.
+  std::mutex call_mutex_;
+  // Guards everything below but the work counter.
+  std::mutex mutex_;
+  std::condition_variable work_available_;
+  std::condition_variable work_done_;
+  // Which call to ParallelFor we are on, so that the workers can tell a new call
+  // from a spurious wakeup.
+  size_t generation_ = 0;
+  bool stopping_ = false;
+  const Task *task_ = nullptr;
+  WorkCounter work_counter_;
+  // The number of workers that haven't yet finished the current call.
+  size_t busy_worker_count_ = 0;
+  std::exception_ptr exception_ = nullptr;
+
+  // Take chunks of work items until there are none left. We don't hold the lock,
+  // except to record an exception.
+  void RunWork(size_t thread_index) {
+    while (true) {
+      const auto [begin, end] = work_counter_.Next();
+      if (begin == end) {
+        return;
+      }
+      for (size_t work = begin; work < end; work++) {
+        try {
+          (*task_)(thread_index, work);
+        } catch (...) {
+          std::lock_guard<std::mutex> lock(mutex_);
+          if (exception_ == nullptr) {
+            exception_ = std::current_exception();
+          }
+        }
+      }
+    }
+  }
+
+  void WorkerLoop(size_t thread_index) {
+    size_t generation = 0;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      work_available_.wait(
+          lock, [this, generation] { return stopping_ || generation_ != generation; });
+      if (stopping_) {
+        return;
+      }
+      generation = generation_;
+      lock.unlock();
+      RunWork(thread_index);
+      lock.lock();
+      if (--busy_worker_count_ == 0) {
+        work_done_.notify_one();
+      }
+    }
+  }
+};
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+TEST_CASE("ThreadPool") {
+  ThreadPool thread_pool(4);
+  CHECK_EQ(thread_pool.ThreadCount(), 4);
+  // Use the same pool for a few calls, of more and fewer items than threads.
+  for (const size_t work_count : {0, 2, 100}) {
+    std::vector<size_t> results(work_count);
+    std::vector<size_t> thread_indices(work_count);
+    thread_pool.ParallelFor(work_count, [&](size_t thread_index, size_t work) {
+      results[work] = 2 * work;
+      thread_indices[work] = thread_index;
+    });
+    for (size_t work = 0; work < work_count; work++) {
+      CHECK_EQ(results[work], 2 * work);
+      CHECK_LT(thread_indices[work], thread_pool.ThreadCount());
+    }
+  }
+  CHECK_THROWS(thread_pool.ParallelFor(10, [](size_t, size_t work) {
+    if (work == 3) {
+      Failwith("Bad work item.");
+    }
+  }));
+  // The pool still works after a task throws.
+  size_t total = 0;
+  std::mutex total_mutex;
+  thread_pool.ParallelFor(10, [&](size_t, size_t work) {
+    std::lock_guard<std::mutex> lock(total_mutex);
+    total += work;
+  });
+  CHECK_EQ(total, 45);
+}
+#endif  // DOCTEST_LIBRARY_INCLUDED
+
+#endif  // SRC_THREAD_POOL_HPP_
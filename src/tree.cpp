@@ -45,6 +45,20 @@ std::string Tree::Newick(TagStringMapOption node_labels) const {
   return Topology()->Newick(branch_lengths_, node_labels);
 }
 
+const FlatTopology& Tree::Flat() const {
+  auto flat_topology = std::atomic_load(&flat_topology_);
+  if (flat_topology == nullptr) {
+    Assert(topology_ != nullptr, "Tree::Flat called on a tree without a topology.");
+    auto new_flat_topology = std::make_shared<const FlatTopology>(topology_);
+    // If another thread got there first then flat_topology gets its version.
+    if (std::atomic_compare_exchange_strong(&flat_topology_, &flat_topology,
+                                            new_flat_topology)) {
+      flat_topology = new_flat_topology;
+    }
+  }
+  return *flat_topology;
+}
+
 double Tree::BranchLength(const Node* node) const {
   Assert(node->Id() < branch_lengths_.size(),
          "Requested id is out of range in Tree::BranchLength.");
@@ -10,6 +10,7 @@
 #include <unordered_map>
 #include <vector>
 
+#include "flat_topology.hpp"
 #include "node.hpp"
 #include "sugar.hpp"
 
@@ -34,6 +35,9 @@ class Tree {
   Node::NodePtrVec Children() const { return Topology()->Children(); }
   size_t Id() const { return Topology()->Id(); }
   std::vector<size_t> ParentIdVector() const { return Topology()->ParentIdVector(); }
+  // The flattened topology, which is built the first time it is requested and then
+  // shared between copies of this tree.
+  const FlatTopology& Flat() const;
 
   bool operator==(const Tree& other) const;
 
@@ -55,12 +59,24 @@ class Tree {
 
  protected:
   Node::NodePtr topology_;
+
+ private:
+  // Access this only through std::atomic_load and std::atomic_store, because
+  // several threads may ask for the flat topology of the same tree.
+  mutable std::shared_ptr<const FlatTopology> flat_topology_;
 };
 
 inline bool operator!=(const Tree& lhs, const Tree& rhs) { return !(lhs == rhs); }
 
 #ifdef DOCTEST_LIBRARY_INCLUDED
 // Lots of tests in UnrootedTree and RootedTree.
-TEST_CASE("Tree") {}
+TEST_CASE("Tree") {
+  auto tree = Tree::ExampleTrees()[3];
+  const auto& flat = tree.Flat();
+  CHECK_EQ(flat.RootId(), tree.Id());
+  // The flat topology is built once and shared with copies.
+  auto copy = tree;
+  CHECK_EQ(&copy.Flat(), &flat);
+}
 #endif  // DOCTEST_LIBRARY_INCLUDED
 #endif  // SRC_TREE_HPP_
@@ -0,0 +1,437 @@
+// Copyright 2019-2020 libsbn project contributors.
+// libsbn is free software under the GPLv3; see LICENSE file for details.
+
+#include "tree_collection_file.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+#include "mmapped_file.hpp"
+#include "node_store.hpp"
+
+namespace {
+
+constexpr char magic[8] = {'L', 'S', 'B', 'N', 'T', 'R', 'E', 'E'};
+constexpr uint64_t version = 1;
+// The bits of Header::flags_.
+constexpr uint64_t is_rooted_flag = 1;
+
+struct Header {
+  char magic_[8];
+  uint64_t version_;
+  uint64_t flags_;
+  uint64_t taxon_count_;
+  uint64_t topology_count_;
+  uint64_t tree_count_;
+};
+
+class Writer {
+ public:
+  explicit Writer(const std::string &path) : path_(path), out_(path, std::ios::binary) {
+    if (!out_) {
+      Failwith("Cannot open the File : " + path);
+    }
+  }
+
+  template <class T>
+  void Write(const T *data, size_t count) {
+    const uint64_t count64 = count;
+    out_.write(reinterpret_cast<const char *>(&count64), sizeof(count64));
+    out_.write(reinterpret_cast<const char *>(data),
+               static_cast<std::streamsize>(count * sizeof(T)));
+    const char padding[8] = {};
+    out_.write(padding, static_cast<std::streamsize>((8 - count * sizeof(T) % 8) % 8));
+  }
+  template <class T>
+  void Write(const std::vector<T> &data) {
+    Write(data.data(), data.size());
+  }
+  // Write the vectors vector_of(i) for i in [0, count) as a ragged array.
+  template <class VectorOf>
+  void WriteRagged(size_t count, VectorOf vector_of) {
+    std::vector<uint64_t> offsets(count + 1, 0);
+    for (size_t i = 0; i < count; i++) {
+      offsets[i + 1] = offsets[i] + vector_of(i).size();
+    }
+    Write(offsets);
+    const uint64_t count64 = offsets.back();
+    out_.write(reinterpret_cast<const char *>(&count64), sizeof(count64));
+    size_t byte_count = 0;
+    for (size_t i = 0; i < count; i++) {
+      const auto &data = vector_of(i);
+      using T = typename std::decay_t<decltype(data)>::value_type;
+      out_.write(reinterpret_cast<const char *>(data.data()),
+                 static_cast<std::streamsize>(data.size() * sizeof(T)));
+      byte_count += data.size() * sizeof(T);
+    }
+    const char padding[8] = {};
+    out_.write(padding, static_cast<std::streamsize>((8 - byte_count % 8) % 8));
+  }
+  void WriteHeader(const Header &header) {
+    out_.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  }
+  void Close() {
+    out_.close();
+    if (!out_) {
+      Failwith("Problem writing '" + path_ + "'.");
+    }
+  }
+
+ private:
+  std::string path_;
+  std::ofstream out_;
+};
+
+// A view of an array in the memory map.
+template <class T>
+struct ArrayView {
+  const T *data_;
+  size_t size_;
+
+  const T &operator[](size_t i) const { return data_[i]; }
+  const T *begin() const { return data_; }
+  const T *end() const { return data_ + size_; }
+};
+
+// A view of a ragged array in the memory map.
+template <class T>
+struct RaggedArrayView {
+  ArrayView<uint64_t> offsets_;
+  ArrayView<T> data_;
+
+  size_t size() const { return offsets_.size_ - 1; }
+  size_t SizeAt(size_t i) const { return offsets_[i + 1] - offsets_[i]; }
+  std::vector<T> VectorAt(size_t i) const {
+    return std::vector<T>(data_.data_ + offsets_[i], data_.data_ + offsets_[i + 1]);
+  }
+};
+
+class Reader {
+ public:
+  explicit Reader(const std::string &path) : path_(path), file_(path) {
+    const auto view = file_.View();
+    position_ = view.data();
+    end_ = view.data() + view.size();
+    Check(view.size() >= sizeof(Header), "it is too short");
+    std::memcpy(&header_, position_, sizeof(Header));
+    Check(std::memcmp(header_.magic_, magic, sizeof(magic)) == 0,
+          "it isn't a tree collection file");
+    Check(header_.version_ == version,
+          "it has version " + std::to_string(header_.version_) +
+              " of the format, rather than " + std::to_string(version));
+    position_ += sizeof(Header);
+  }
+
+  const Header &GetHeader() const { return header_; }
+
+  template <class T>
+  ArrayView<T> Read() {
+    static_assert(alignof(T) <= 8, "We only align arrays to 8 bytes.");
+    Check(end_ - position_ >= 8, "it ends early");
+    uint64_t count;
+    std::memcpy(&count, position_, sizeof(count));
+    position_ += sizeof(count);
+    Check(count <= static_cast<size_t>(end_ - position_) / sizeof(T), "it ends early");
+    ArrayView<T> array{reinterpret_cast<const T *>(position_), count};
+    const size_t byte_count = count * sizeof(T);
+    position_ += std::min(byte_count + (8 - byte_count % 8) % 8,
+                          static_cast<size_t>(end_ - position_));
+    return array;
+  }
+  template <class T>
+  ArrayView<T> Read(size_t expected_count) {
+    const auto array = Read<T>();
+    Check(array.size_ == expected_count, "an array has the wrong size");
+    return array;
+  }
+  template <class T>
+  RaggedArrayView<T> ReadRagged(size_t expected_count) {
+    RaggedArrayView<T> ragged{Read<uint64_t>(expected_count + 1), Read<T>()};
+    Check(std::is_sorted(ragged.offsets_.begin(), ragged.offsets_.end()) &&
+              ragged.offsets_[expected_count] == ragged.data_.size_,
+          "a ragged array has bad offsets");
+    return ragged;
+  }
+
+  void Check(bool condition, const std::string &problem) const {
+    if (!condition) {
+      Failwith("Problem reading tree collection file '" + path_ + "': " + problem +
+               ".");
+    }
+  }
+
+ private:
+  std::string path_;
+  MmappedFile file_;
+  const char *position_;
+  const char *end_;
+  Header header_;
+};
+
+// Write everything but the rooted fields.
+template <class TTree>
+void WriteTrees(Writer &writer, const GenericTreeCollection<TTree> &collection,
+                bool is_rooted) {
+  // Find the distinct topologies, first by identity (parsed trees share their
+  // topologies) and then by value, including the ids.
+  std::unordered_map<const Node *, uint32_t> topology_indices;
+  std::map<std::vector<uint32_t>, uint32_t> parent_id_vector_indices;
+  std::vector<const std::vector<uint32_t> *> parent_id_vectors;
+  std::vector<uint32_t> tree_topology_indices;
+  tree_topology_indices.reserve(collection.TreeCount());
+  for (const auto &tree : collection.Trees()) {
+    const Node *topology = tree.Topology().get();
+    auto search = topology_indices.find(topology);
+    if (search == topology_indices.end()) {
+      std::vector<uint32_t> parent_id_vector;
+      parent_id_vector.reserve(topology->Id());
+      for (const size_t parent_id : topology->ParentIdVector()) {
+        Assert(parent_id > parent_id_vector.size(),
+               "TreeCollectionFile::Write needs topologies with ids that increase "
+               "towards the root.");
+        parent_id_vector.push_back(static_cast<uint32_t>(parent_id));
+      }
+      const auto [iter, is_new] = parent_id_vector_indices.emplace(
+          std::move(parent_id_vector), static_cast<uint32_t>(parent_id_vectors.size()));
+      if (is_new) {
+        parent_id_vectors.push_back(&iter->first);
+      }
+      search = topology_indices.emplace(topology, iter->second).first;
+    }
+    tree_topology_indices.push_back(search->second);
+  }
+  const auto taxon_names = collection.TaxonNames();
+  writer.WriteHeader({{magic[0], magic[1], magic[2], magic[3], magic[4], magic[5],
+                       magic[6], magic[7]},
+                      version,
+                      is_rooted ? is_rooted_flag : 0,
+                      taxon_names.size(),
+                      parent_id_vectors.size(),
+                      collection.TreeCount()});
+  writer.WriteRagged(taxon_names.size(),
+                     [&taxon_names](size_t i) -> const std::string & {
+                       return taxon_names[i];
+                     });
+  writer.WriteRagged(parent_id_vectors.size(),
+                     [&parent_id_vectors](size_t i) -> const std::vector<uint32_t> & {
+                       return *parent_id_vectors[i];
+                     });
+  writer.Write(tree_topology_indices);
+  writer.WriteRagged(collection.TreeCount(),
+                     [&collection](size_t i) -> const std::vector<double> & {
+                       return collection.GetTree(i).branch_lengths_;
+                     });
+}
+
+struct TreesAndTaxa {
+  std::vector<Node::NodePtr> topologies_;
+  ArrayView<uint32_t> tree_topology_indices_;
+  RaggedArrayView<double> branch_lengths_;
+  std::vector<std::string> taxon_names_;
+};
+
+TreesAndTaxa ReadTreesAndTaxa(Reader &reader) {
+  const auto &header = reader.GetHeader();
+  TreesAndTaxa result;
+  const auto taxon_names = reader.ReadRagged<char>(header.taxon_count_);
+  result.taxon_names_.reserve(header.taxon_count_);
+  for (size_t i = 0; i < header.taxon_count_; i++) {
+    const auto name = taxon_names.VectorAt(i);
+    result.taxon_names_.emplace_back(name.begin(), name.end());
+  }
+  const auto parent_id_vectors = reader.ReadRagged<uint32_t>(header.topology_count_);
+  // Build the topologies in postorder, which is id order.
+  NodeStore node_store;
+  std::vector<Node::NodePtr> nodes;
+  std::vector<uint32_t> child_counts;
+  std::vector<uint32_t> child_ids;
+  Node::NodePtrVec children;
+  result.topologies_.reserve(header.topology_count_);
+  for (size_t topology = 0; topology < header.topology_count_; topology++) {
+    const auto begin = parent_id_vectors.offsets_[topology];
+    const ArrayView<uint32_t> parent_ids{
+        parent_id_vectors.data_.data_ + begin,
+        parent_id_vectors.offsets_[topology + 1] - begin};
+    const size_t node_count = parent_ids.size_ + 1;
+    reader.Check(parent_ids.size_ > 0, "a topology is empty");
+    // The leaf count is the smallest parent id.
+    const size_t leaf_count = *std::min_element(parent_ids.begin(), parent_ids.end());
+    reader.Check(header.taxon_count_ == 0 || leaf_count == header.taxon_count_,
+                 "a topology doesn't have a leaf for each taxon");
+    // Sort the child ids by parent id, keeping them in id order.
+    child_counts.assign(node_count + 1, 0);
+    for (size_t id = 0; id < parent_ids.size_; id++) {
+      reader.Check(parent_ids[id] > id && parent_ids[id] < node_count,
+                   "a topology has bad parent ids");
+      child_counts[parent_ids[id] + 1]++;
+    }
+    for (size_t id = 0; id < node_count; id++) {
+      child_counts[id + 1] += child_counts[id];
+    }
+    child_ids.resize(parent_ids.size_);
+    for (size_t id = 0; id < parent_ids.size_; id++) {
+      child_ids[child_counts[parent_ids[id]]++] = static_cast<uint32_t>(id);
+    }
+    // Now child_counts[id] is the end of the children of id in child_ids.
+    nodes.resize(node_count);
+    for (size_t id = 0; id < node_count; id++) {
+      if (id < leaf_count) {
+        nodes[id] = node_store.Leaf(static_cast<uint32_t>(id), leaf_count);
+        continue;
+      }
+      children.clear();
+      for (size_t i = id > 0 ? child_counts[id - 1] : 0; i < child_counts[id]; i++) {
+        children.push_back(nodes[child_ids[i]]);
+      }
+      reader.Check(!children.empty(), "a topology has a childless internal node");
+      std::sort(children.begin(), children.end(), [](const auto &lhs, const auto &rhs) {
+        return lhs->MaxLeafID() < rhs->MaxLeafID();
+      });
+      nodes[id] = node_store.Join(children, id);
+    }
+    result.topologies_.push_back(nodes.back());
+  }
+  result.tree_topology_indices_ = reader.Read<uint32_t>(header.tree_count_);
+  for (const auto topology_index : result.tree_topology_indices_) {
+    reader.Check(topology_index < header.topology_count_,
+                 "a tree has a bad topology index");
+  }
+  result.branch_lengths_ = reader.ReadRagged<double>(header.tree_count_);
+  for (size_t i = 0; i < header.tree_count_; i++) {
+    const auto &topology = result.topologies_[result.tree_topology_indices_[i]];
+    reader.Check(result.branch_lengths_.SizeAt(i) == topology->Id() + 1,
+                 "a tree has the wrong number of branch lengths");
+  }
+  return result;
+}
+
+template <class TTree, class TTreeCollection>
+TTreeCollection ReadTrees(const std::string &path) {
+  Reader reader(path);
+  auto trees_and_taxa = ReadTreesAndTaxa(reader);
+  std::vector<TTree> trees;
+  trees.reserve(reader.GetHeader().tree_count_);
+  for (size_t i = 0; i < reader.GetHeader().tree_count_; i++) {
+    trees.emplace_back(
+        trees_and_taxa.topologies_[trees_and_taxa.tree_topology_indices_[i]],
+        trees_and_taxa.branch_lengths_.VectorAt(i));
+  }
+  if (trees_and_taxa.taxon_names_.empty()) {
+    return TTreeCollection(std::move(trees));
+  }  // else
+  return TTreeCollection(std::move(trees), trees_and_taxa.taxon_names_);
+}
+
+}  // namespace
+
+void TreeCollectionFile::Write(const std::string &path,
+                               const TreeCollection &collection) {
+  Writer writer(path);
+  WriteTrees(writer, collection, false);
+  writer.Close();
+}
+
+void TreeCollectionFile::Write(const std::string &path,
+                               const UnrootedTreeCollection &collection) {
+  Writer writer(path);
+  WriteTrees(writer, collection, false);
+  writer.Close();
+}
+
+void TreeCollectionFile::Write(const std::string &path,
+                               const RootedTreeCollection &collection) {
+  Writer writer(path);
+  WriteTrees(writer, collection, true);
+  const size_t tree_count = collection.TreeCount();
+  for (const auto field :
+       {&RootedTree::height_ratios_, &RootedTree::node_heights_,
+        &RootedTree::node_bounds_, &RootedTree::rates_}) {
+    writer.WriteRagged(tree_count,
+                       [&collection, field](size_t i) -> const std::vector<double> & {
+                         return collection.GetTree(i).*field;
+                       });
+  }
+  std::vector<uint64_t> rate_counts;
+  rate_counts.reserve(tree_count);
+  for (const auto &tree : collection.Trees()) {
+    rate_counts.push_back(tree.rate_count_);
+  }
+  writer.Write(rate_counts);
+  std::vector<double> dates;
+  if (!collection.tag_date_map_.empty()) {
+    dates.resize(collection.TaxonCount());
+    for (const auto &[tag, date] : collection.tag_date_map_) {
+      const auto leaf_id = MaxLeafIDOfTag(tag);
+      Assert(leaf_id < dates.size(), "Leaf ID is out of range in the date map.");
+      dates[leaf_id] = date;
+    }
+  }
+  writer.Write(dates);
+  writer.Close();
+}
+
+TreeCollection TreeCollectionFile::ReadTreeCollection(const std::string &path) {
+  return ReadTrees<Tree, TreeCollection>(path);
+}
+
+UnrootedTreeCollection TreeCollectionFile::ReadUnrootedTreeCollection(
+    const std::string &path) {
+  return ReadTrees<UnrootedTree, UnrootedTreeCollection>(path);
+}
+
+RootedTreeCollection TreeCollectionFile::ReadRootedTreeCollection(
+    const std::string &path) {
+  Reader reader(path);
+  reader.Check(reader.GetHeader().flags_ & is_rooted_flag,
+               "it holds an unrooted tree collection");
+  auto trees_and_taxa = ReadTreesAndTaxa(reader);
+  const size_t tree_count = reader.GetHeader().tree_count_;
+  const auto height_ratios = reader.ReadRagged<double>(tree_count);
+  const auto node_heights = reader.ReadRagged<double>(tree_count);
+  const auto node_bounds = reader.ReadRagged<double>(tree_count);
+  const auto rates = reader.ReadRagged<double>(tree_count);
+  const auto rate_counts = reader.Read<uint64_t>(tree_count);
+  const auto dates = reader.Read<double>();
+  reader.Check(dates.size_ == 0 || dates.size_ == reader.GetHeader().taxon_count_,
+               "the dates don't match the taxa");
+  RootedTree::RootedTreeVector trees;
+  trees.reserve(tree_count);
+  for (size_t i = 0; i < tree_count; i++) {
+    const auto &topology =
+        trees_and_taxa.topologies_[trees_and_taxa.tree_topology_indices_[i]];
+    reader.Check(topology->Children().size() == 2,
+                 "a rooted tree isn't bifurcating at the root");
+    // The parameters of a tree are empty until they get initialized.
+    auto check_size = [&reader, i](const RaggedArrayView<double> &parameters,
+                                   size_t expected_size) {
+      reader.Check(parameters.SizeAt(i) == 0 || parameters.SizeAt(i) == expected_size,
+                   "a rooted tree has parameters of the wrong size");
+    };
+    const size_t node_count = topology->Id() + 1;
+    check_size(height_ratios, topology->LeafCount() - 1);
+    check_size(node_heights, node_count);
+    check_size(node_bounds, node_count);
+    check_size(rates, node_count - 1);
+    trees.emplace_back(topology, trees_and_taxa.branch_lengths_.VectorAt(i));
+    auto &tree = trees.back();
+    tree.height_ratios_ = height_ratios.VectorAt(i);
+    tree.node_heights_ = node_heights.VectorAt(i);
+    tree.node_bounds_ = node_bounds.VectorAt(i);
+    tree.rates_ = rates.VectorAt(i);
+    tree.rate_count_ = rate_counts[i];
+  }
+  auto collection = trees_and_taxa.taxon_names_.empty()
+                        ? RootedTreeCollection(std::move(trees))
+                        : RootedTreeCollection(std::move(trees),
+                                               trees_and_taxa.taxon_names_);
+  for (size_t leaf_id = 0; leaf_id < dates.size_; leaf_id++) {
+    SafeInsert(collection.tag_date_map_, PackInts(static_cast<uint32_t>(leaf_id), 1),
+               dates[leaf_id]);
+  }
+  return collection;
+}
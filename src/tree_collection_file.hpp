@@ -0,0 +1,118 @@
+// Copyright 2019-2020 libsbn project contributors.
+// libsbn is free software under the GPLv3; see LICENSE file for details.
+//
+// A binary file format for tree collections, so that we can save a parsed collection
+// and load it again without parsing any text.
+//
+// The file consists of a header followed by a sequence of arrays, each of which is
+// stored as its uint64_t element count followed by its elements, padded to a multiple
+// of 8 bytes. Everything is in native byte order. Ragged arrays (one vector per
+// tree, say) are stored as an array of uint64_t offsets followed by the flattened
+// data. In order, the arrays are:
+//
+// * the taxon names, in leaf id order, as a ragged array of chars;
+// * the distinct topologies, as a ragged array of uint32_t parent id vectors (see
+//   Node::ParentIdVector);
+// * the uint32_t topology index of each tree;
+// * the branch lengths of each tree, as a ragged array of doubles;
+// and for rooted tree collections,
+// * the height ratios, node heights, node bounds, and rates of each tree, each as a
+//   ragged array of doubles;
+// * the uint64_t rate count of each tree;
+// * the tip dates, in leaf id order (or nothing if there is no date map).
+//
+// We read a file through a memory map, so loading amounts to building each distinct
+// topology once (through a NodeStore, so topologies share identical subtrees) and
+// copying the branch lengths and other per-tree vectors straight out of the map.
+
+#ifndef SRC_TREE_COLLECTION_FILE_HPP_
+#define SRC_TREE_COLLECTION_FILE_HPP_
+
+#include <string>
+
+#include "rooted_tree_collection.hpp"
+#include "tree_collection.hpp"
+#include "unrooted_tree_collection.hpp"
+
+namespace TreeCollectionFile {
+
+// The topologies must have ids that increase from each node to its parent, as they
+// do after Node::Polish or parsing.
+void Write(const std::string& path, const TreeCollection& collection);
+void Write(const std::string& path, const UnrootedTreeCollection& collection);
+void Write(const std::string& path, const RootedTreeCollection& collection);
+
+// The unrooted readers also read files of rooted collections, skipping the rooted
+// fields. Reading a rooted collection requires a file written from one.
+TreeCollection ReadTreeCollection(const std::string& path);
+UnrootedTreeCollection ReadUnrootedTreeCollection(const std::string& path);
+RootedTreeCollection ReadRootedTreeCollection(const std::string& path);
+
+}  // namespace TreeCollectionFile
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+#include "driver.hpp"
+
+TEST_CASE("TreeCollectionFile") {
+  const std::string path = "_tree_collection_file_test.trees";
+  Driver driver;
+  const auto collection = driver.ParseNewickFile("data/DS1.100_topologies.nwk");
+  TreeCollectionFile::Write(path, collection);
+  const auto loaded = TreeCollectionFile::ReadTreeCollection(path);
+  CHECK_EQ(loaded, collection);
+  CHECK_EQ(loaded.TagTaxonMap(), collection.TagTaxonMap());
+  // Identical topologies are stored once and share their nodes again.
+  CHECK_EQ(loaded.GetTree(0).Topology().get(), loaded.GetTree(1).Topology().get());
+  const auto unrooted_collection = UnrootedTreeCollection::OfTreeCollection(collection);
+  TreeCollectionFile::Write(path, unrooted_collection);
+  CHECK_EQ(TreeCollectionFile::ReadUnrootedTreeCollection(path), unrooted_collection);
+  CHECK_THROWS(TreeCollectionFile::ReadRootedTreeCollection(path));
+  // Rooted collections keep their parameters.
+  auto rooted_collection = RootedTreeCollection::OfTreeCollection(
+      driver.ParseNewickFile("data/five_taxon_rooted.nwk"));
+  rooted_collection.ParseDatesFromTaxonNames();
+  for (auto& tree : rooted_collection.trees_) {
+    const size_t node_count = tree.Id() + 1;
+    tree.height_ratios_ = std::vector<double>(tree.LeafCount() - 1, 0.5);
+    tree.node_heights_ = std::vector<double>(node_count, 1.5);
+    tree.node_bounds_ = std::vector<double>(node_count, 0.25);
+    tree.rates_ = std::vector<double>(node_count - 1, 1.);
+    tree.rate_count_ = 1;
+  }
+  rooted_collection.trees_[0].rates_[1] = 2.5;
+  TreeCollectionFile::Write(path, rooted_collection);
+  const auto loaded_rooted = TreeCollectionFile::ReadRootedTreeCollection(path);
+  CHECK_EQ(loaded_rooted, rooted_collection);
+  CHECK_EQ(loaded_rooted.tag_date_map_, rooted_collection.tag_date_map_);
+  for (size_t i = 0; i < rooted_collection.TreeCount(); i++) {
+    const auto& tree = rooted_collection.GetTree(i);
+    const auto& loaded_tree = loaded_rooted.GetTree(i);
+    CHECK_EQ(loaded_tree.height_ratios_, tree.height_ratios_);
+    CHECK_EQ(loaded_tree.node_heights_, tree.node_heights_);
+    CHECK_EQ(loaded_tree.node_bounds_, tree.node_bounds_);
+    CHECK_EQ(loaded_tree.rates_, tree.rates_);
+    CHECK_EQ(loaded_tree.rate_count_, tree.rate_count_);
+  }
+  CHECK_EQ(TreeCollectionFile::ReadTreeCollection(path).TreeCount(),
+           rooted_collection.TreeCount());
+  // Text isn't a tree collection file.
+  CHECK_THROWS(TreeCollectionFile::ReadTreeCollection("data/five_taxon_rooted.nwk"));
+  // Nor is a file whose arrays don't fit the trees.
+  auto bad_rates = rooted_collection;
+  bad_rates.trees_[0].rates_.pop_back();
+  TreeCollectionFile::Write(path, bad_rates);
+  CHECK_THROWS(TreeCollectionFile::ReadRootedTreeCollection(path));
+  auto bad_branch_lengths = collection;
+  bad_branch_lengths.trees_[0].branch_lengths_.pop_back();
+  TreeCollectionFile::Write(path, bad_branch_lengths);
+  CHECK_THROWS(TreeCollectionFile::ReadTreeCollection(path));
+  // Nor is a file whose topologies don't fit its taxa.
+  auto bad_taxa = collection;
+  bad_taxa.trees_ = driver.ParseNewickFile("data/five_taxon_unrooted.nwk").Trees();
+  TreeCollectionFile::Write(path, bad_taxa);
+  CHECK_THROWS(TreeCollectionFile::ReadTreeCollection(path));
+  std::remove(path.c_str());
+}
+#endif  // DOCTEST_LIBRARY_INCLUDED
+
+#endif  // SRC_TREE_COLLECTION_FILE_HPP_
@@ -0,0 +1,151 @@
+// Copyright 2019-2020 libsbn project contributors.
+// libsbn is free software under the GPLv3; see LICENSE file for details.
+
+#include "tree_file_index.hpp"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <thread>
+
+#include "mmapped_file.hpp"
+#include "sugar.hpp"
+
+namespace {
+
+constexpr char magic[8] = {'L', 'S', 'B', 'N', 'T', 'I', 'D', 'X'};
+constexpr uint64_t version = 1;
+
+struct Header {
+  char magic_[8];
+  uint64_t version_;
+  // What we know of the tree file, to tell whether the index is up to date.
+  uint64_t file_size_;
+  uint64_t modification_time_;
+  uint64_t first_tree_position_;
+  uint64_t tree_count_;
+};
+
+// The modification time of a file in nanoseconds, or 0 if we can't stat it.
+uint64_t ModificationTime(const std::string &path) {
+  struct stat file_stat;
+  if (stat(path.c_str(), &file_stat) != 0) {
+    return 0;
+  }
+#ifdef __APPLE__
+  const struct timespec &modification_time = file_stat.st_mtimespec;
+#else
+  const struct timespec &modification_time = file_stat.st_mtim;
+#endif
+  return static_cast<uint64_t>(modification_time.tv_sec) * 1000000000 +
+         static_cast<uint64_t>(modification_time.tv_nsec);
+}
+
+}  // namespace
+
+TreeFileIndex::TreeFileIndex(std::string_view text, size_t first_tree_position) {
+  Assert(first_tree_position <= text.size(),
+         "TreeFileIndex: the first tree position is past the end of the text.");
+  const char *const begin = text.data();
+  const char *const end = begin + text.size();
+  const char *position = begin;
+  uint64_t line_number = 1;
+  // Count the lines of the header, and then look for a '(' on each line after it.
+  while (position < begin + first_tree_position) {
+    const auto *newline = static_cast<const char *>(
+        std::memchr(position, '\n', static_cast<size_t>(end - position)));
+    if (newline == nullptr) {
+      break;
+    }
+    position = newline + 1;
+    line_number++;
+  }
+  position = begin + first_tree_position;
+  while (position < end) {
+    const auto *newline = static_cast<const char *>(
+        std::memchr(position, '\n', static_cast<size_t>(end - position)));
+    const char *line_end = newline == nullptr ? end : newline;
+    const auto *tree_start = static_cast<const char *>(
+        std::memchr(position, '(', static_cast<size_t>(line_end - position)));
+    if (tree_start != nullptr) {
+      offsets_.push_back(static_cast<uint64_t>(tree_start - begin));
+      line_numbers_.push_back(line_number);
+    }
+    position = line_end + 1;
+    line_number++;
+  }
+}
+
+TreeFileIndex TreeFileIndex::OfFile(const std::string &path, std::string_view text,
+                                    size_t first_tree_position) {
+  const std::string sidecar_path = SidecarPath(path);
+  const uint64_t modification_time = ModificationTime(path);
+  Header header;
+  // Load the sidecar if there is an up-to-date one.
+  std::unique_ptr<MmappedFile> sidecar;
+  try {
+    sidecar = std::make_unique<MmappedFile>(sidecar_path);
+  } catch (const std::exception &) {
+  }
+  if (sidecar != nullptr && sidecar->size() >= sizeof(Header)) {
+    const char *data = sidecar->View().data();
+    std::memcpy(&header, data, sizeof(Header));
+    if (std::memcmp(header.magic_, magic, sizeof(magic)) == 0 &&
+        header.version_ == version && header.file_size_ == text.size() &&
+        header.modification_time_ == modification_time &&
+        header.first_tree_position_ == first_tree_position &&
+        sidecar->size() == sizeof(Header) + 2 * header.tree_count_ * sizeof(uint64_t)) {
+      TreeFileIndex index;
+      const auto *offsets = reinterpret_cast<const uint64_t *>(data + sizeof(Header));
+      index.offsets_.assign(offsets, offsets + header.tree_count_);
+      const auto *line_numbers = offsets + header.tree_count_;
+      index.line_numbers_.assign(line_numbers, line_numbers + header.tree_count_);
+      return index;
+    }
+  }
+  TreeFileIndex index(text, first_tree_position);
+  // We write the sidecar under a temporary name and then rename it, so that nobody
+  // reads a partial sidecar. The temporary name is our own, so that processes or
+  // threads indexing the same file at once don't write into each other's temporary
+  // file. If we can't write it (say the directory is read-only) we just go without.
+  std::memcpy(header.magic_, magic, sizeof(magic));
+  header.version_ = version;
+  header.file_size_ = text.size();
+  header.modification_time_ = modification_time;
+  header.first_tree_position_ = first_tree_position;
+  header.tree_count_ = index.TreeCount();
+  const std::string temporary_path =
+      sidecar_path + ".tmp." + std::to_string(getpid()) + "." +
+      std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+  {
+    std::ofstream out(temporary_path, std::ios::binary);
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    const auto byte_count =
+        static_cast<std::streamsize>(index.TreeCount() * sizeof(uint64_t));
+    out.write(reinterpret_cast<const char *>(index.offsets_.data()), byte_count);
+    out.write(reinterpret_cast<const char *>(index.line_numbers_.data()), byte_count);
+    out.close();
+    if (!out) {
+      std::remove(temporary_path.c_str());
+      return index;
+    }
+  }
+  if (std::rename(temporary_path.c_str(), sidecar_path.c_str()) != 0) {
+    std::remove(temporary_path.c_str());
+  }
+  return index;
+}
+
+std::string_view TreeFileIndex::TreeText(std::string_view text,
+                                         size_t tree_index) const {
+  Assert(tree_index < TreeCount(), "TreeFileIndex: tree index out of range.");
+  const size_t start = offsets_[tree_index];
+  const size_t end = std::min(text.find('\n', start), text.size());
+  return text.substr(start, end - start);
+}
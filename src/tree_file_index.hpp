@@ -0,0 +1,90 @@
+// Copyright 2019-2020 libsbn project contributors.
+// libsbn is free software under the GPLv3; see LICENSE file for details.
+//
+// An index of where the trees of a plain-text Newick or Nexus file start.
+//
+// To parse only some of the trees of a big posterior sample (to subsample, thin, or
+// pick up where we left off) we want to jump straight to them rather than parse
+// from the top. So we scan the file once for the lines holding trees (which is much
+// faster than parsing them) and record the byte offset of the '(' that starts each
+// tree, along with its line number for error messages.
+//
+// We keep the index in a sidecar file next to the tree file, along with the size and
+// modification time of the tree file, so that later runs can load it rather than scan
+// again, and rebuild it if the tree file has changed. The sidecar holds a header
+// followed by the uint64_t offsets and then the uint64_t line numbers, in native byte
+// order.
+
+#ifndef SRC_TREE_FILE_INDEX_HPP_
+#define SRC_TREE_FILE_INDEX_HPP_
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class TreeFileIndex {
+ public:
+  // Index the text of a tree file, whose trees are the lines from first_tree_position
+  // on that contain a '(' (as in the parsers).
+  TreeFileIndex(std::string_view text, size_t first_tree_position);
+
+  // The index of the tree file at the given path, whose text is given. We load the
+  // sidecar if it is up to date, and otherwise index the text and (if we can) write
+  // the sidecar.
+  static TreeFileIndex OfFile(const std::string& path, std::string_view text,
+                              size_t first_tree_position);
+  static std::string SidecarPath(const std::string& path) { return path + ".idx"; }
+
+  size_t TreeCount() const { return offsets_.size(); }
+  // The byte offset of the '(' that starts a tree.
+  uint64_t Offset(size_t tree_index) const { return offsets_[tree_index]; }
+  // The one-based line number of a tree.
+  uint64_t LineNumber(size_t tree_index) const { return line_numbers_[tree_index]; }
+  // The text of a tree, from its '(' to the end of its line.
+  std::string_view TreeText(std::string_view text, size_t tree_index) const;
+
+ private:
+  std::vector<uint64_t> offsets_;
+  std::vector<uint64_t> line_numbers_;
+
+  TreeFileIndex() = default;
+};
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+#include <cstdio>
+
+#include "mmapped_file.hpp"
+
+TEST_CASE("TreeFileIndex") {
+  const std::string text =
+      "#NEXUS\n"
+      "begin trees;\n"
+      "tree STATE_0 = ((a:1,b:2):3,c:4);\n"
+      "[a comment]\n"
+      "tree STATE_1 = ((a:1,c:2):3,b:4);\n"
+      "end;\n";
+  const size_t first_tree_position = text.find("tree STATE_0");
+  const TreeFileIndex index(text, first_tree_position);
+  CHECK_EQ(index.TreeCount(), 2);
+  CHECK_EQ(index.Offset(0), text.find("(("));
+  CHECK_EQ(index.LineNumber(0), 3);
+  CHECK_EQ(index.LineNumber(1), 5);
+  CHECK_EQ(index.TreeText(text, 1), "((a:1,c:2):3,b:4);");
+  // The sidecar gets written for a file and then read back.
+  const std::string path = "data/DS1.100_topologies.nwk";
+  const std::string sidecar_path = TreeFileIndex::SidecarPath(path);
+  std::remove(sidecar_path.c_str());
+  const MmappedFile file(path);
+  const auto scanned = TreeFileIndex::OfFile(path, file.View(), 0);
+  CHECK_EQ(scanned.TreeCount(), 100);
+  CHECK_EQ(MmappedFile(sidecar_path).size(), 48 + 2 * 8 * 100);
+  const auto loaded = TreeFileIndex::OfFile(path, file.View(), 0);
+  CHECK_EQ(loaded.TreeCount(), 100);
+  CHECK_EQ(loaded.Offset(99), scanned.Offset(99));
+  CHECK_EQ(loaded.LineNumber(99), 100);
+  std::remove(sidecar_path.c_str());
+}
+#endif  // DOCTEST_LIBRARY_INCLUDED
+
+#endif  // SRC_TREE_FILE_INDEX_HPP_
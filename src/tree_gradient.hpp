@@ -6,6 +6,12 @@
 
 #include <vector>
 
+#include "sugar.hpp"
+
+// The log likelihood and its derivatives with respect to the branch lengths and the
+// model parameters are sums over sites, so we can add up the gradients of a tree for
+// disjoint blocks of site patterns with +=. The rooted gradients that we compute from
+// the branch length gradient are not, so += leaves them out (see RootedPhyloGradient).
 struct PhyloGradient {
   PhyloGradient() = default;
   PhyloGradient(double log_likelihood, std::vector<double> site_model_gradient,
@@ -17,6 +23,19 @@ struct PhyloGradient {
   double log_likelihood_;
   std::vector<double> site_model_;
   std::vector<double> substitution_model_;
+
+ protected:
+  void Add(const PhyloGradient &other) {
+    log_likelihood_ += other.log_likelihood_;
+    AddVector(&site_model_, other.site_model_);
+    AddVector(&substitution_model_, other.substitution_model_);
+  }
+  static void AddVector(std::vector<double> *sum, const std::vector<double> &other) {
+    Assert(sum->size() == other.size(), "Can't add gradients of different sizes.");
+    for (size_t i = 0; i < other.size(); i++) {
+      (*sum)[i] += other[i];
+    }
+  }
 };
 
 struct UnrootedPhyloGradient : PhyloGradient {
@@ -28,6 +47,12 @@ struct UnrootedPhyloGradient : PhyloGradient {
       : PhyloGradient(log_likelihood, site_model_gradient, substitution_model_gradient),
         branch_lengths_(branch_length_gradient){};
 
+  UnrootedPhyloGradient &operator+=(const UnrootedPhyloGradient &other) {
+    Add(other);
+    AddVector(&branch_lengths_, other.branch_lengths_);
+    return *this;
+  }
+
   std::vector<double> branch_lengths_;
 };
 
@@ -43,6 +68,16 @@ struct RootedPhyloGradient : PhyloGradient {
         clock_model_(clock_model_gradient),
         ratios_root_height_(ratios_root_height_gradient){};
 
+  // The ratio and root height gradient includes terms from the log Jacobian of the
+  // height ratio transform, which aren't sums over sites, so we only add up the
+  // components that are. Then FatBeagle::SetRatioAndClockGradients computes the
+  // others from the summed branch length gradient.
+  RootedPhyloGradient &operator+=(const RootedPhyloGradient &other) {
+    Add(other);
+    AddVector(&branch_lengths_, other.branch_lengths_);
+    return *this;
+  }
+
   std::vector<double> branch_lengths_;
   std::vector<double> clock_model_;
   std::vector<double> ratios_root_height_;
@@ -8,6 +8,7 @@
 #include <unordered_set>
 
 #include "eigen_sugar.hpp"
+#include "node_arena.hpp"
 #include "numerical_utils.hpp"
 
 // ** Building SBN-related items
@@ -20,13 +21,14 @@ EigenVectorXd UnrootedSBNInstance::TrainExpectationMaximization(double alpha,
       sbn_support_.IndexerRepresentationCounterOf(topology_counter_);
   return SBNProbability::ExpectationMaximization(
       sbn_parameters_, indexer_representation_counter, sbn_support_.RootsplitCount(),
-      sbn_support_.ParentToRange(), alpha, max_iter, score_epsilon);
+      sbn_support_.SubsplitIdToRange(), alpha, max_iter, score_epsilon);
 }
 
 EigenVectorXd UnrootedSBNInstance::CalculateSBNProbabilities() {
   EigenVectorXd sbn_parameters_copy = sbn_parameters_;
-  SBNProbability::ProbabilityNormalizeParamsInLog(
-      sbn_parameters_copy, sbn_support_.RootsplitCount(), sbn_support_.ParentToRange());
+  SBNProbability::ProbabilityNormalizeParamsInLog(sbn_parameters_copy,
+                                                  sbn_support_.RootsplitCount(),
+                                                  sbn_support_.SubsplitIdToRange());
   return SBNProbability::ProbabilityOf(sbn_parameters_copy,
                                        MakeIndexerRepresentations());
 }
@@ -43,6 +45,10 @@ void UnrootedSBNInstance::SampleTrees(size_t count) {
   // 2n-2 because trees are unrooted.
   auto edge_count = 2 * static_cast<int>(taxon_count) - 2;
   tree_collection_.trees_.clear();
+  // The sampled trees get allocated together, and freed together when they get
+  // replaced.
+  NodeArena arena;
+  NodeArena::Scope arena_scope(arena);
   for (size_t i = 0; i < count; i++) {
     std::vector<double> branch_lengths(static_cast<size_t>(edge_count));
     tree_collection_.trees_.emplace_back(
@@ -65,7 +71,7 @@ std::vector<SizeVectorVector> UnrootedSBNInstance::MakePSPIndexerRepresentations
   std::vector<SizeVectorVector> representations;
   representations.reserve(tree_collection_.trees_.size());
   for (const auto &tree : tree_collection_.trees_) {
-    representations.push_back(psp_indexer_.RepresentationOf(tree.Topology()));
+    representations.push_back(psp_indexer_.RepresentationOf(tree.Flat()));
   }
   return representations;
 }
@@ -107,6 +113,10 @@ void UnrootedSBNInstance::ReadNexusFile(const std::string &fname) {
       UnrootedTreeCollection::OfTreeCollection(driver.ParseNexusFile(fname));
 }
 
+void UnrootedSBNInstance::ReadTreeCollectionFile(const std::string &fname) {
+  tree_collection_ = TreeCollectionFile::ReadUnrootedTreeCollection(fname);
+}
+
 // ** Phylogenetic likelihood
 
 std::vector<double> UnrootedSBNInstance::LogLikelihoods() {
@@ -117,32 +127,6 @@ std::vector<UnrootedPhyloGradient> UnrootedSBNInstance::PhyloGradients() {
   return GetEngine()->Gradients(tree_collection_, phylo_model_params_, rescaling_);
 }
 
-void UnrootedSBNInstance::PushBackRangeForParentIfAvailable(
-    const Bitset &parent, UnrootedSBNInstance::RangeVector &range_vector) {
-  if (sbn_support_.ParentInSupport(parent)) {
-    range_vector.push_back(sbn_support_.ParentToRangeAt(parent));
-  }
-}
-
-// Retrieves range of subsplits for each s|t that appears in the tree
-// given by rooted_representation.
-UnrootedSBNInstance::RangeVector UnrootedSBNInstance::GetSubsplitRanges(
-    const SizeVector &rooted_representation) {
-  RangeVector subsplit_ranges;
-  // PROFILE: should we be reserving here?
-  subsplit_ranges.emplace_back(0, sbn_support_.RootsplitCount());
-  Bitset root = sbn_support_.RootsplitsAt(rooted_representation[0]);
-  PushBackRangeForParentIfAvailable(root + ~root, subsplit_ranges);
-  PushBackRangeForParentIfAvailable(~root + root, subsplit_ranges);
-  // Starting at 1 here because we took care of the rootsplit above (the 0th element).
-  for (size_t i = 1; i < rooted_representation.size(); i++) {
-    Bitset child = sbn_support_.IndexToChildAt(rooted_representation[i]);
-    PushBackRangeForParentIfAvailable(child, subsplit_ranges);
-    PushBackRangeForParentIfAvailable(child.RotateSubsplit(), subsplit_ranges);
-  }
-  return subsplit_ranges;
-}
-
 // This gives the gradient of log q at a specific unrooted topology.
 // See eq:gradLogQ in the tex, and TopologyGradients for more information about
 // normalized_sbn_parameters_in_log.
@@ -82,12 +82,7 @@ class UnrootedSBNInstance : public PreUnrootedSBNInstance {
 
   void ReadNewickFile(const std::string &fname);
   void ReadNexusFile(const std::string &fname);
-
- protected:
-  void PushBackRangeForParentIfAvailable(
-      const Bitset &parent, UnrootedSBNInstance::RangeVector &range_vector);
-  RangeVector GetSubsplitRanges(
-      const RootedIndexerRepresentation &rooted_representation);
+  void ReadTreeCollectionFile(const std::string &fname);
 };
 
 #ifdef DOCTEST_LIBRARY_INCLUDED
@@ -238,6 +233,8 @@ TEST_CASE("UnrootedSBNInstance: likelihood and gradient") {
       for (size_t i = 0; i < likelihoods.size(); i++) {
         CHECK_LT(fabs(likelihoods[i] - pybeagle_likelihoods[i]), 0.00011);
       }
+      // Evaluating again replays the cached operation schedules.
+      CHECK_EQ(inst.LogLikelihoods(), likelihoods);
 
       auto gradients = inst.PhyloGradients();
       // Test the log likelihoods.
@@ -340,6 +337,47 @@ TEST_CASE("UnrootedSBNInstance: likelihood and gradient with Weibull") {
   }
 }
 
+TEST_CASE("UnrootedSBNInstance: likelihood and gradient over pattern blocks") {
+  UnrootedSBNInstance inst("charlie");
+  PhyloModelSpecification simple_specification{"JC69", "weibull+4", "strict"};
+  inst.ReadNexusFile("data/DS1.subsampled_10.t");
+  inst.ReadFastaFile("data/DS1.fasta");
+  // With a single tree and several threads, the engine splits the site patterns
+  // between the threads rather than the trees.
+  inst.tree_collection_.Erase(1, inst.TreeCount());
+  inst.PrepareForPhyloLikelihood(simple_specification, 1);
+  inst.GetPhyloModelParamBlockMap().at(WeibullSiteModel::shape_key_).setConstant(0.1);
+  EigenMatrixXd params = inst.GetPhyloModelParams();
+  const SitePattern site_pattern(Alignment::ReadFasta("data/DS1.fasta"),
+                                 inst.TagTaxonMap());
+  const std::vector<BeagleFlags> beagle_flags;
+  const Engine tree_engine({1, beagle_flags, true}, simple_specification,
+                           site_pattern);
+  const Engine pattern_engine({4, beagle_flags, true}, simple_specification,
+                              site_pattern);
+  CHECK_EQ(tree_engine.PatternBlockCount(), 0);
+  CHECK_GT(pattern_engine.PatternBlockCount(), 1);
+  for (const bool rescaling : {false, true}) {
+    const auto likelihood =
+        tree_engine.LogLikelihoods(inst.tree_collection_, params, rescaling)[0];
+    CHECK_LT(fabs(pattern_engine.LogLikelihoods(inst.tree_collection_, params,
+                                                rescaling)[0] -
+                  likelihood),
+             1e-8);
+    const auto gradient =
+        tree_engine.Gradients(inst.tree_collection_, params, rescaling)[0];
+    const auto pattern_gradient =
+        pattern_engine.Gradients(inst.tree_collection_, params, rescaling)[0];
+    CHECK_LT(fabs(pattern_gradient.log_likelihood_ - gradient.log_likelihood_), 1e-8);
+    REQUIRE_EQ(pattern_gradient.branch_lengths_.size(),
+               gradient.branch_lengths_.size());
+    for (size_t i = 0; i < gradient.branch_lengths_.size(); i++) {
+      CHECK_LT(fabs(pattern_gradient.branch_lengths_[i] - gradient.branch_lengths_[i]),
+               1e-8);
+    }
+  }
+}
+
 TEST_CASE("UnrootedSBNInstance: SBN training") {
   UnrootedSBNInstance inst("charlie");
   inst.ReadNewickFile("data/DS1.100_topologies.nwk");
@@ -362,6 +400,34 @@ TEST_CASE("UnrootedSBNInstance: SBN training") {
   CheckVectorXdEquality(inst.CalculateSBNProbabilities(), expected_EM_05_100, 1e-5);
 }
 
+TEST_CASE("UnrootedSBNInstance: online support from a tree stream") {
+  UnrootedSBNInstance inst("charlie");
+  inst.ReadNewickFile("data/DS1.100_topologies.nwk");
+  inst.ProcessLoadedTrees();
+  auto counter = UnrootedSBNMaps::OnlineCounter(16);
+  Driver driver;
+  const auto tag_taxon_map = driver.StreamNewickFile(
+      "data/DS1.100_topologies.nwk",
+      [&counter](Tree::TreeVector trees) {
+        for (const auto& tree : trees) {
+          counter.Add(tree.Topology());
+        }
+      },
+      0, 1, 10);
+  CHECK_EQ(counter.TopologyCount(), inst.TreeCount());
+  UnrootedSBNSupport support(counter.RootsplitCounter(), counter.PCSPCounter(),
+                             TreeCollection({}, tag_taxon_map).TaxonNames());
+  CHECK_EQ(support.TaxonNames(), inst.TaxonNames());
+  CHECK_EQ(support.GPCSPCount(), inst.SBNSupport().GPCSPCount());
+  // The indexing may come out in a different order, but the support is the same.
+  auto sorted_pretty_indexer = [](const SBNSupport& support) {
+    auto pretty_indexer = support.PrettyIndexer();
+    std::sort(pretty_indexer.begin(), pretty_indexer.end());
+    return pretty_indexer;
+  };
+  CHECK_EQ(sorted_pretty_indexer(support), sorted_pretty_indexer(inst.SBNSupport()));
+}
+
 TEST_CASE("UnrootedSBNInstance: tree sampling") {
   UnrootedSBNInstance inst("charlie");
   inst.ReadNewickFile("data/five_taxon_unrooted.nwk");
@@ -16,6 +16,16 @@ class UnrootedSBNSupport : public SBNSupport {
     std::tie(rootsplits_, indexer_, index_to_child_, parent_to_range_, gpcsp_count_) =
         SBNMaps::BuildIndexerBundle(UnrootedSBNMaps::RootsplitCounterOf(topologies),
                                     UnrootedSBNMaps::PCSPCounterOf(topologies));
+    BuildSubsplitIds();
+  }
+  // Build the support from rootsplit and PCSP counters, such as those of an
+  // OnlineSBNCounter.
+  explicit UnrootedSBNSupport(const BitsetSizeDict &rootsplit_counter,
+                              const PCSPDict &pcsp_counter, StringVector taxon_names)
+      : SBNSupport(std::move(taxon_names)) {
+    std::tie(rootsplits_, indexer_, index_to_child_, parent_to_range_, gpcsp_count_) =
+        SBNMaps::BuildIndexerBundle(rootsplit_counter, pcsp_counter);
+    BuildSubsplitIds();
   }
 
   UnrootedIndexerRepresentationCounter IndexerRepresentationCounterOf(
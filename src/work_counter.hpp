@@ -0,0 +1,80 @@
+// Copyright 2019-2020 libsbn project contributors.
+// libsbn is free software under the GPLv3; see LICENSE file for details.
+//
+// Hands out the work items 0 up to some count to threads in chunks, through a single
+// atomic counter rather than a lock.
+//
+// When the work items are cheap (say likelihoods of small trees) a lock around a
+// queue of items becomes the bottleneck, and handing out one item at a time means
+// the threads keep fighting over the counter. So we use guided chunk sizes: each
+// chunk is a 1/(2 * thread_count) share of the items that are left, which makes for
+// big chunks at the start and single items at the end, where they help balance the
+// load between threads.
+
+#ifndef SRC_WORK_COUNTER_HPP_
+#define SRC_WORK_COUNTER_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <utility>
+
+class WorkCounter {
+ public:
+  WorkCounter() = default;
+  WorkCounter(size_t work_count, size_t thread_count) {
+    Reset(work_count, thread_count);
+  }
+
+  // Start handing out the items 0 up to work_count. Nobody may be calling Next while
+  // we do this.
+  void Reset(size_t work_count, size_t thread_count) {
+    work_count_ = work_count;
+    divisor_ = 2 * std::max(thread_count, size_t(1));
+    next_.store(0, std::memory_order_relaxed);
+  }
+
+  // Claim the next chunk of items, as a half-open range. The range is empty once all
+  // of the items have been handed out.
+  std::pair<size_t, size_t> Next() {
+    size_t begin = next_.load(std::memory_order_relaxed);
+    while (begin < work_count_) {
+      const size_t chunk_size = std::max((work_count_ - begin) / divisor_, size_t(1));
+      if (next_.compare_exchange_weak(begin, begin + chunk_size,
+                                      std::memory_order_relaxed)) {
+        return {begin, begin + chunk_size};
+      }
+    }
+    return {work_count_, work_count_};
+  }
+
+ private:
+  std::atomic<size_t> next_{0};
+  size_t work_count_ = 0;
+  size_t divisor_ = 2;
+};
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+TEST_CASE("WorkCounter") {
+  WorkCounter counter(100, 4);
+  // The chunks cover every item once, in order, and get smaller as we go.
+  size_t expected_begin = 0;
+  size_t last_chunk_size = 100;
+  while (true) {
+    const auto [begin, end] = counter.Next();
+    if (begin == end) {
+      break;
+    }
+    CHECK_EQ(begin, expected_begin);
+    CHECK_LE(end - begin, last_chunk_size);
+    last_chunk_size = end - begin;
+    expected_begin = end;
+  }
+  CHECK_EQ(expected_begin, 100);
+  CHECK_EQ(last_chunk_size, 1);
+  counter.Reset(0, 4);
+  const auto [begin, end] = counter.Next();
+  CHECK_EQ(begin, end);
+}
+#endif  // DOCTEST_LIBRARY_INCLUDED
+
+#endif  // SRC_WORK_COUNTER_HPP_